@@ -0,0 +1,88 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __ALSA_SEQ_BACKEND_H
+#define __ALSA_SEQ_BACKEND_H
+
+#include <alsa/asoundlib.h>
+
+#include "MidiBackend.h"
+
+// MIDI through the ALSA sequencer.  Devices are sequencer ports, kept up
+// to date from the system announcements.  Output is scheduled on a queue
+// of our own.
+class AlsaSeqBackend : public MidiBackend {
+  public:
+
+    // Without list_hardware, the ports of sound cards are not devices (the
+    // raw devices list them when both are used, see CombinedBackend)
+    AlsaSeqBackend(bool list_hardware = true);
+    ~AlsaSeqBackend();
+
+    std::string Open();
+    void Close();
+
+    MidiCommDescriptionList InputDevices() const;
+    MidiCommDescriptionList OutputDevices() const;
+    void Rescan();
+
+    bool IsKeyboard(const MidiCommDescription& device) const;
+
+    std::string ConnectInput(const MidiCommDescription& device);
+    void DisconnectInput(const MidiCommDescription& device);
+    std::string ConnectOutput(const MidiCommDescription& device);
+    void DisconnectOutput(const MidiCommDescription& device);
+
+    unsigned int ReadBatch(MidiBackendEventList& events);
+    void DropInput();
+
+    void Write(const MidiEvent& out, microseconds_t delay_microseconds);
+    void Drain();
+    void DropScheduled();
+
+    void KeyboardNote(unsigned char note, bool on, unsigned char velocity);
+
+    std::vector<pollfd> PollDescriptors() const;
+    microseconds_t Now() const;
+
+  private:
+    AlsaSeqBackend(const AlsaSeqBackend&);
+    AlsaSeqBackend& operator=(const AlsaSeqBackend&);
+
+    void Enumerate(unsigned int perms, MidiCommDescriptionList& devices) const;
+    bool IsOwnPort(int client, int port) const;
+    bool IsListed(int client) const;
+
+    // Apply an announcement to the lists, return whether they changed.  A
+    // negative port means the whole client.
+    bool PortGone(int client, int port);
+    bool PortChanged(int client, int port);
+
+    // Returns false for events that are not input (announcements), after
+    // applying them.  result gets the MidiReadResult they amount to.
+    bool Decode(const snd_seq_event_t *ev, MidiEventSimple *simple, unsigned int *result);
+    bool Encode(const MidiEvent& out, snd_seq_event_t *ev) const;
+
+    snd_seq_t *m_seq;
+    bool m_list_hardware;
+
+    // meanings of READ and WRITE are permissions of the port from the
+    // viewpoint of other ports
+    int m_local_out;
+    int m_local_in;
+    int m_anon_in;
+    int m_keybd_out;
+
+    // Used to schedule output ahead of time
+    int m_queue;
+
+    MidiCommDescriptionList m_inputs;
+    MidiCommDescriptionList m_outputs;
+};
+
+#endif // __ALSA_SEQ_BACKEND_H
@@ -0,0 +1,83 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __CALIBRATION_STATE_H
+#define __CALIBRATION_STATE_H
+
+#include <string>
+#include <vector>
+
+#include "SharedState.h"
+#include "GameState.h"
+#include "MenuLayout.h"
+#include "libmidi/MidiTypes.h"
+
+// Measures the latency of the selected MIDI devices.  The user first taps
+// along with a flashing light, which gives the input latency (as seen
+// against the screen).  Then they tap along with clicks played on the
+// output device, which gives input plus output latency.
+class CalibrationState : public GameState {
+  public:
+
+    CalibrationState(const SharedState& state) :
+        m_state(state),
+        m_phase(PhaseVisual),
+        m_phase_start(0),
+        m_clicks_scheduled(0),
+        m_visual_offset(0),
+        m_input_latency(0),
+        m_output_latency(0),
+        m_retrying(false) {
+    }
+
+  protected:
+    virtual void Init();
+    virtual void Update();
+    virtual void Draw(Renderer& renderer) const;
+    virtual bool IsAnimating() const;
+
+  private:
+    enum Phase {
+
+        PhaseVisual,
+        PhaseAudio,
+        PhaseDone
+    };
+
+    void StartPhase(Phase phase);
+    void FinishPhase();
+
+    void ReadTaps();
+    void ScheduleClicks();
+
+    // Time since the current phase started
+    microseconds_t PhaseTime() const;
+    microseconds_t BeatTime(int beat) const;
+    bool IsBeatFlashing() const;
+
+    ButtonState m_back_button;
+    std::string m_tooltip;
+
+    SharedState m_state;
+
+    Phase m_phase;
+    unsigned long m_phase_start;
+    int m_clicks_scheduled;
+
+    // Tap time minus beat time, for every tap of the phase
+    std::vector<microseconds_t> m_offsets;
+
+    microseconds_t m_visual_offset;
+    microseconds_t m_input_latency;
+    microseconds_t m_output_latency;
+
+    // The last phase had too few taps and is being repeated
+    bool m_retrying;
+};
+
+#endif // __CALIBRATION_STATE_H
@@ -0,0 +1,71 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __COMBINED_BACKEND_H
+#define __COMBINED_BACKEND_H
+
+#include "MidiBackend.h"
+
+// Several backends at once, e.g. the ALSA sequencer and the raw devices.
+// Their devices are listed one after the other (MidiCommDescription's
+// backend tells them apart) and every call goes to the part the device
+// belongs to, output to the part of the connected output device.  Only
+// the first part's PC keyboard is listed.
+class CombinedBackend : public MidiBackend {
+  public:
+
+    // Takes ownership of the parts, which must share the same clock
+    CombinedBackend(const std::vector<MidiBackend *>& parts);
+    ~CombinedBackend();
+
+    std::string Open();
+    void Close();
+
+    MidiCommDescriptionList InputDevices() const;
+    MidiCommDescriptionList OutputDevices() const;
+    void Rescan();
+
+    bool IsKeyboard(const MidiCommDescription& device) const;
+
+    std::string ConnectInput(const MidiCommDescription& device);
+    void DisconnectInput(const MidiCommDescription& device);
+    std::string ConnectOutput(const MidiCommDescription& device);
+    void DisconnectOutput(const MidiCommDescription& device);
+
+    unsigned int ReadBatch(MidiBackendEventList& events);
+    void DropInput();
+
+    void Write(const MidiEvent& out, microseconds_t delay_microseconds);
+    void Drain();
+    void DropScheduled();
+
+    void KeyboardNote(unsigned char note, bool on, unsigned char velocity);
+
+    std::vector<pollfd> PollDescriptors() const;
+    microseconds_t Now() const;
+
+  private:
+    CombinedBackend(const CombinedBackend&);
+    CombinedBackend& operator=(const CombinedBackend&);
+
+    void Merge();
+    MidiBackend *PartOf(const MidiCommDescription& device) const;
+
+    std::vector<MidiBackend *> m_parts;
+
+    // The parts that opened fine
+    std::vector<bool> m_open;
+
+    // The part output goes to, null while no output device is connected
+    MidiBackend *m_output_part;
+
+    MidiCommDescriptionList m_inputs;
+    MidiCommDescriptionList m_outputs;
+};
+
+#endif // __COMBINED_BACKEND_H
@@ -11,12 +11,18 @@
 
 #include <string>
 
+#include "libmidi/MidiTypes.h"
+
 namespace Compatible {
 
 // Some monotonically increasing value tied to the system
 // clock (but not necessarily based on app-start)
 unsigned long GetMilliseconds();
 
+// Same, in microseconds and never affected by clock changes.  Used
+// to time MIDI input.
+microseconds_t GetMicroseconds();
+
 // Shows an error box with an OK button
 void ShowError(const std::string& err);
 
@@ -0,0 +1,100 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __DRAW_LIST_H
+#define __DRAW_LIST_H
+
+#include <vector>
+#include <memory>
+
+// Whatever OpenGL work a frame needs besides quads (a framebuffer to draw
+// into, a vertex buffer, a texture upload), done when the list is
+// submitted, in order with the quads around it.
+class DrawCommand {
+  public:
+
+    virtual ~DrawCommand() {
+    }
+
+    // On the thread with the OpenGL context
+    virtual void Submit() = 0;
+};
+
+// One frame, as the Renderer recorded it: quads in drawing order, a few
+// runs of them per texture, and the commands in between.  Recording
+// doesn't touch OpenGL, so it can happen on another thread than the one
+// submitting (see DrawThread).
+class DrawList {
+  public:
+
+    DrawList();
+    ~DrawList();
+
+    // Recording.  The color and texture are those of the next quads.
+    void SetColor(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
+    void SetTexture(unsigned int texture_id);
+
+    unsigned int GetTexture() const {
+        return m_texture;
+    }
+
+    const unsigned char *GetColor() const {
+        return m_color;
+    }
+
+    void AddQuad(int x, int y, int w, int h, double tx, double ty, double tw, double th);
+
+    // The list takes ownership
+    void AddCommand(DrawCommand *command);
+
+    // resource stays alive until the list is cleared, so whatever it
+    // frees is freed after the commands using it were submitted (and on
+    // the thread with the OpenGL context)
+    void Hold(std::shared_ptr<void> resource);
+
+    bool IsEmpty() const {
+        return m_runs.empty();
+    }
+
+    // Draws the frame, on the thread with the OpenGL context
+    void Submit() const;
+
+    // Once submitted, on the same thread.  Back to white and no texture.
+    void Clear();
+
+  private:
+    DrawList(const DrawList&);
+    DrawList& operator=(const DrawList&);
+
+    struct Vertex {
+
+        int x, y;
+        float u, v;
+        unsigned char r, g, b, a;
+    };
+
+    // Either count vertices from first on, with one texture, or a command
+    struct Run {
+
+        unsigned int texture;
+        size_t first;
+        size_t count;
+        DrawCommand *command;
+    };
+
+    void AddVertex(int x, int y, double u, double v);
+
+    std::vector<Vertex> m_vertices;
+    std::vector<Run> m_runs;
+    std::vector<std::shared_ptr<void> > m_held;
+
+    unsigned int m_texture;
+    unsigned char m_color[4];
+};
+
+#endif // __DRAW_LIST_H
@@ -0,0 +1,68 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __DRAW_THREAD_H
+#define __DRAW_THREAD_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "Renderer.h"
+
+class GameStateManager;
+
+// Records frames (GameStateManager::Draw()) on a thread of its own, so
+// the main thread only has to submit them to OpenGL.  With two DrawLists
+// taking turns, one frame is recorded here while the one before it is
+// submitted and shown.
+//
+// The manager is not touched at all while a frame is being recorded, not
+// even for input or IsAnimating(): all of that (and Update()) goes after
+// Wait() and before the next Record().  Input arriving in between is
+// queued on the main thread until then.
+class DrawThread {
+  public:
+
+    DrawThread();
+
+    // Waits for the frame being recorded
+    ~DrawThread();
+
+    // Starts recording a frame of manager into the renderer's DrawList.
+    // Neither the manager nor the list are to be touched until Wait().
+    void Record(GameStateManager *manager, const Renderer& renderer);
+
+    // Until the frame is recorded (right away if there is none).  What
+    // Draw() threw is thrown from here.
+    void Wait();
+
+  private:
+    DrawThread(const DrawThread&);
+    DrawThread& operator=(const DrawThread&);
+
+    void run();
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+
+    GameStateManager *m_manager;
+
+    // A copy, while recording
+    Renderer *m_renderer;
+
+    bool m_recording;
+    bool m_should_exit;
+    std::exception_ptr m_error;
+
+    // Last, it starts with everything above set up
+    std::thread m_thread;
+};
+
+#endif // __DRAW_THREAD_H
@@ -17,6 +17,7 @@
 #include "CompatibleSystem.h"
 #include "FrameCounter.h"
 #include "Renderer.h"
+#include "TextureAtlas.h"
 
 class GameStateError : public std::exception {
   public:
@@ -63,10 +64,11 @@ enum GameKey {
     KeyBackward = 0x0800,
 
     KeyVolumeUp = 0x1000,
-    KeyVolumeDown = 0x2000
+    KeyVolumeDown = 0x2000,
 
-    // = 0x4000
-    // = 0x8000
+    KeyF2 = 0x4000,
+
+    KeyF7 = 0x8000
 };
 
 enum MouseButton {
@@ -128,6 +130,13 @@ class GameState {
     // GetStateWidth()) and [0, GetStateHeight())
     virtual void Draw(Renderer& renderer) const = 0;
 
+    // Whether the state needs frames even without any user input
+    // (something moves on screen or is being played).  When false,
+    // the main loop may go to sleep until the next input arrives.
+    virtual bool IsAnimating() const {
+        return true;
+    }
+
     // How long has this state been running
     unsigned long GetStateMilliseconds() const {
         return m_state_milliseconds;
@@ -190,8 +199,15 @@ class GameStateManager {
         m_inside_update(false),
         m_fps(500.0),
         m_show_fps(false),
+        m_show_midi_stats(false),
         m_screen_x(screen_width),
-        m_screen_y(screen_height) {
+        m_screen_y(screen_height),
+        m_fixed_frame_rate(0),
+        m_fixed_frames(0),
+        m_atlases_built(false) {
+
+        m_atlases[0] = 0;
+        m_atlases[1] = 0;
     }
 
     ~GameStateManager();
@@ -212,8 +228,27 @@ class GameStateManager {
     const MouseInfo& Mouse() const { return m_mouse; }
 
     void Update(bool skip_this_update);
+
+    // From now on every Update() is 1/frames_per_second later than the
+    // last one, whatever the clock says (see exportVideo)
+    void SetFixedFrameRate(unsigned int frames_per_second);
+
+    // Records the frame into the renderer's DrawList, which doesn't need
+    // the thread with the OpenGL context (see DrawThread).  Nothing is
+    // recorded while there is no state.
     void Draw(Renderer& renderer);
 
+    // Whatever Draw() would otherwise do with OpenGL the first time:
+    // uploads every texture and asks what the graphics card can do.  Also
+    // looks up the default font, so Draw() never reads the settings.
+    // Once, on the thread with the OpenGL context, before the first Draw().
+    // GetTexture() with a texture's usual smoothing doesn't need OpenGL
+    // from then on.
+    void PrepareDrawing();
+
+    // See GameState::IsAnimating()
+    bool IsAnimating() const;
+
     void ChangeState(GameState *new_state);
 
     Tga *GetTexture(Texture tex_name, bool smooth) const;
@@ -236,11 +271,30 @@ class GameStateManager {
 
     FrameCounter m_fps;
     bool m_show_fps;
+    bool m_show_midi_stats;
+    std::string m_midi_summary;
 
     int m_screen_x;
     int m_screen_y;
 
+    // Zero when the clock is used
+    unsigned int m_fixed_frame_rate;
+    unsigned long long m_fixed_frames;
+
+    // Packs every texture into two atlases (sharp and smooth ones), see
+    // TextureAtlas.  Done on the first GetTexture(), from PrepareDrawing().
+    // The files are decoded on a few threads at once, only the uploads
+    // need the thread with the context.
+    void BuildAtlases() const;
+
+    // Textures loaded on their own (when they don't fit an atlas or are
+    // asked for with other smoothing), owned
     mutable std::map<Texture, Tga *> m_textures;
+
+    // Parts of m_atlases, owned by them
+    mutable std::map<Texture, Tga *> m_atlas_textures;
+    mutable TextureAtlas *m_atlases[2];
+    mutable bool m_atlases_built;
 };
 
 #endif // __GAMESTATE_H
@@ -0,0 +1,119 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __GLYPH_CACHE_H
+#define __GLYPH_CACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <pango/pangocairo.h>
+
+#include "Renderer.h"
+
+// A glyph of some font, rasterised into the atlas.  Both images are
+// placed relative to the pen position on the baseline.
+struct CachedGlyph {
+
+    // Null for glyphs with nothing to draw (spaces)
+    Tga *image;
+
+    // The same, grown by a pixel all around, for outlines and shadows.
+    // Only made when first asked for.
+    Tga *halo;
+
+    int left;
+    int top;
+
+    // To rasterise the halo with
+    PangoFont *font;
+    PangoGlyph index;
+};
+
+struct PlacedGlyph {
+
+    CachedGlyph *glyph;
+    int x;
+    int y;
+};
+
+// A string shaped and measured once, ready to draw
+struct TextLayout {
+
+    int width;
+    int height;
+
+    std::vector<PlacedGlyph> glyphs;
+};
+
+// Shapes text with Pango and keeps the glyphs in a single texture, so a
+// string is drawn as a handful of quads in the Renderer's batch instead
+// of a Pango layout and a round of display lists per write.  New glyphs
+// go into the texture as commands of the renderer's DrawList.
+class GlyphCache {
+  public:
+
+    GlyphCache();
+    ~GlyphCache();
+
+    // The texture, on the thread with the OpenGL context and before
+    // anything is drawn (see GameStateManager::PrepareDrawing())
+    void CreateTexture();
+
+    // font is a Pango font family ("sans", "serif bold", ...), size in
+    // points.  With halos, the glyphs also have theirs.  The reference is
+    // good until the next call.
+    const TextLayout& Layout(Renderer& renderer, const std::string& font, int size,
+                             const std::string& text, bool halos);
+
+  private:
+    GlyphCache(const GlyphCache&);
+    GlyphCache& operator=(const GlyphCache&);
+
+    struct TextKey {
+
+        std::string font;
+        int size;
+        std::string text;
+
+        bool operator<(const TextKey& rhs) const;
+    };
+
+    typedef std::pair<PangoFont *, PangoGlyph> GlyphKey;
+
+    void Shape(Renderer& renderer, const TextKey& key, TextLayout& layout);
+    CachedGlyph *Glyph(Renderer& renderer, PangoFont *font, PangoGlyph glyph);
+    void AddHalo(Renderer& renderer, CachedGlyph *glyph);
+
+    // Copies coverage (top-down rows of width bytes) into the atlas
+    Tga *Store(Renderer& renderer, const std::vector<unsigned char>& coverage,
+               unsigned int width, unsigned int height);
+
+    // Forgets every glyph and layout, once the atlas is full
+    void Clear();
+
+    PangoContext *m_context;
+    PangoLayout *m_layout;
+    std::map<std::pair<std::string, int>, PangoFontDescription *> m_fonts;
+
+    std::map<TextKey, TextLayout> m_layouts;
+    std::map<GlyphKey, CachedGlyph> m_glyphs;
+
+    // Shelf packing, filled as glyphs come
+    TextureId m_texture_id;
+    unsigned int m_shelf_x;
+    unsigned int m_shelf_y;
+    unsigned int m_shelf_height;
+    bool m_full;
+};
+
+// The one instance, used by TextWriter
+GlyphCache& glyphCache();
+
+#endif // __GLYPH_CACHE_H
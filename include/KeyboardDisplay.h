@@ -9,12 +9,13 @@
 #ifndef __KEYBOARDDISPLAY_H
 #define __KEYBOARDDISPLAY_H
 
-#include <map>
 #include <vector>
 #include <string>
 
 #include "TrackTile.h"
 #include "TrackProperties.h"
+#include "LayerCache.h"
+#include "NoteBuffer.h"
 
 #include "libmidi/Note.h"
 #include "libmidi/MidiTypes.h"
@@ -28,7 +29,23 @@ enum KeyboardSize {
     KeyboardSize88
 };
 
-typedef std::map<std::string, Track::TrackColor> KeyNames;
+// What lit a key up
+enum KeyLitBy {
+
+    KeyLitBySong,
+    KeyLitByHit,
+    KeyLitByStray
+};
+
+struct KeyState {
+
+    bool active;
+    Track::TrackColor color;
+    KeyLitBy lit_by;
+
+    // Song time of the last change, for effects
+    microseconds_t changed;
+};
 
 class KeyboardDisplay {
   public:
@@ -38,14 +55,27 @@ class KeyboardDisplay {
     KeyboardDisplay(KeyboardSize size, int pixelWidth, int pixelHeight);
 
     void Draw(Renderer& renderer, const Tga *key_tex[3], const Tga *note_tex[4],
-              int x, int y, const TranslatedNoteSet& notes, microseconds_t show_duration,
-              microseconds_t current_time, const std::vector<Track::Properties>& track_properties,
+              int x, int y, const TranslatedNoteSet& notes, microseconds_t longest_note,
+              microseconds_t show_duration, microseconds_t current_time, const std::vector<Track::Properties>& track_properties,
               const MidiEventMicrosecondList& bar_line_usecs);
 
-    void SetKeyActive(const std::string& key_name, bool active, Track::TrackColor color);
+    void SetKeyActive(NoteId note, bool active, Track::TrackColor color,
+                      KeyLitBy lit_by, microseconds_t when);
 
-    void ResetActiveKeys() {
-        m_active_keys.clear();
+    void ResetActiveKeys();
+
+    const KeyState& GetKeyState(NoteId note) const {
+        return m_keys[note];
+    }
+
+    // A note of notes changed its state (see NoteBuffer)
+    void NoteChanged(const TranslatedNote& note) {
+        m_note_buffer.NoteChanged(note);
+    }
+
+    // The notes were set up again, after a jump in the song
+    void ResetNotes() {
+        m_notes_reset = true;
     }
 
   private:
@@ -82,10 +112,19 @@ class KeyboardDisplay {
 
     const static KeyTexDimensions BlackKeyDimensions;
 
-    void DrawWhiteKeys(Renderer& renderer, bool active_only, int key_count, int key_width,
+    // Which keys DrawWhiteKeys() and DrawBlackKeys() draw, and how
+    enum KeyFilter {
+
+        // All of them, as if nothing was pressed
+        KeysAtRest,
+        KeysActiveOnly,
+        KeysAll
+    };
+
+    void DrawWhiteKeys(Renderer& renderer, KeyFilter filter, int key_count, int key_width,
                        int key_height, int key_space, int x_offset, int y_offset) const;
 
-    void DrawBlackKeys(Renderer& renderer, const Tga *tex, bool active_only, int white_key_count,
+    void DrawBlackKeys(Renderer& renderer, const Tga *tex, KeyFilter filter, int white_key_count,
                        int white_width, int black_width, int black_height, int key_space,
                        int x_offset, int y_offset, int black_offset) const;
 
@@ -99,11 +138,28 @@ class KeyboardDisplay {
                   microseconds_t show_duration, microseconds_t current_time,
                   const MidiEventMicrosecondList& bar_line_usecs) const;
 
+    // Finds the notes on screen (and shown) for this frame, longest_note
+    // being the longest of notes.  Both note passes draw from these.
+    void GatherVisibleNotes(const TranslatedNoteSet& notes, microseconds_t longest_note,
+                            microseconds_t show_duration, microseconds_t current_time,
+                            const std::vector<Track::Properties>& track_properties);
+
     void DrawNotePass(Renderer& renderer, const Tga *tex_white, const Tga *tex_black,
                       int white_width, int key_space, int black_width, int black_offset,
                       int x_offset, int y, int y_offset, int y_roll_under,
-                      const TranslatedNoteSet& notes, microseconds_t show_duration,
-                      microseconds_t current_time, const std::vector<Track::Properties>& track_properties) const;
+                      microseconds_t show_duration, microseconds_t current_time,
+                      const std::vector<Track::Properties>& track_properties) const;
+
+    // Where the notes of a pitch fall, the left edge of their rectangle
+    int GetNoteLeft(NoteId note, int starting_octave, int keyboard_type_offset, int white_width,
+                    int key_space, int black_offset, int x_offset) const;
+
+    // How DrawNote() stretches the texture over a note w pixels wide
+    static NoteShape GetNoteShape(const NoteTexDimensions& d, int w);
+
+    // (Re)builds m_note_buffer when the notes were reset or the keys moved
+    void UpdateNoteBuffer(Renderer& renderer, const TranslatedNoteSet& notes,
+                          const std::vector<Track::Properties>& track_properties, int white_width, int key_space, int black_width, int black_offset, int x_offset);
 
     // This takes the rectangle where the actual note block should appear and transforms
     // it to the multi-quad (with relatively complicated texture coordinates) using the
@@ -119,6 +175,10 @@ class KeyboardDisplay {
     // will start with on the far left side
     char GetStartingNote() const;
 
+    // Retrieves how many white keys off 'C' of its first octave a piano
+    // with the given key count starts, minus an octave
+    int GetKeyboardTypeOffset() const;
+
     // Retrieves which octave a piano with the given key count
     // will start with on the far left side
     int GetStartingOctave() const;
@@ -128,10 +188,29 @@ class KeyboardDisplay {
     int GetWhiteKeyCount() const;
 
     KeyboardSize m_size;
-    KeyNames m_active_keys;
+
+    // Indexed by note, no strings in sight
+    const static NoteId KeyCount = 128;
+    KeyState m_keys[KeyCount];
+    int m_active_count;
+    int m_active_white_count;
+
+    // Filled by GatherVisibleNotes(), kept to reuse the memory
+    std::vector<const TranslatedNote *> m_visible_white;
+    std::vector<const TranslatedNote *> m_visible_black;
+
+    // The note field background and the keys at rest
+    LayerCache m_guides_layer;
+    LayerCache m_keys_layer;
 
     int m_width;
     int m_height;
+
+    // Every note of the song, when shaders are around.  The notes are
+    // placed where m_note_lanes says.
+    NoteBuffer m_note_buffer;
+    NoteLane m_note_lanes[KeyCount];
+    bool m_notes_reset;
 };
 
 #endif // __KEYBOARDDISPLAY_H
@@ -0,0 +1,76 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __LAYER_CACHE_H
+#define __LAYER_CACHE_H
+
+#include <memory>
+
+#include "Renderer.h"
+
+// The framebuffer and texture of a layer, on the graphics card
+struct LayerTarget;
+
+// Something that looks the same frame after frame, drawn once into a
+// texture (through a framebuffer object) and then drawn from there as a
+// single quad.  Layers are opaque: the rectangle has to be covered by what
+// is drawn into it.
+//
+// Used like this:
+//
+//    if (layer.Begin(renderer, x, y, w, h)) {
+//        ... draw the layer's content ...
+//        layer.End(renderer);
+//    }
+//    layer.Draw(renderer);
+//
+// Without framebuffer objects Begin() is always true and Draw() does
+// nothing, so the content is drawn every frame as before.
+//
+// The framebuffer work is recorded along with the quads (see DrawList),
+// the framebuffer itself is made when the first frame using it is
+// submitted.
+class LayerCache {
+  public:
+
+    LayerCache();
+    ~LayerCache();
+
+    // The first call needs the OpenGL context, it is made by
+    // GameStateManager::PrepareDrawing().  False from then on if a
+    // framebuffer turned out not to work.
+    static bool Available();
+
+    // True if the content has to be drawn now: it is the first time or
+    // the rectangle changed (a resize).  The rectangle is in the
+    // coordinates the quads end up at (offset included).  Nothing else is
+    // checked: what is drawn into it may only depend on the rectangle and
+    // on what never changes (the textures, the colors).
+    bool Begin(Renderer& renderer, int x, int y, int w, int h);
+    void End(Renderer& renderer);
+
+    void Draw(Renderer& renderer) const;
+
+  private:
+    LayerCache(const LayerCache&);
+    LayerCache& operator=(const LayerCache&);
+
+    int m_x;
+    int m_y;
+    int m_width;
+    int m_height;
+    bool m_valid;
+
+    // Begin() was true and the content goes into the framebuffer
+    bool m_capturing;
+
+    // Shared with the commands drawing into it and from it
+    std::shared_ptr<LayerTarget> m_target;
+};
+
+#endif // __LAYER_CACHE_H
@@ -0,0 +1,100 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __LOOPBACK_BACKEND_H
+#define __LOOPBACK_BACKEND_H
+
+#include <deque>
+
+#include "MidiBackend.h"
+
+// An event written to the loopback output, with the time it was due
+struct LoopbackOutputEvent {
+
+    MidiEvent event;
+    microseconds_t due;
+};
+
+typedef std::vector<LoopbackOutputEvent> LoopbackOutputEventList;
+
+// MIDI without any hardware or sequencer.  Input is scripted with Inject()
+// and output is kept for Output().  Its clock is the system one until
+// SetNow() is called, and from then on only moves when told to, so a run
+// can be replayed exactly.
+class LoopbackBackend : public MidiBackend {
+  public:
+
+    LoopbackBackend();
+    ~LoopbackBackend();
+
+    std::string Open();
+    void Close();
+
+    MidiCommDescriptionList InputDevices() const;
+    MidiCommDescriptionList OutputDevices() const;
+    void Rescan();
+
+    bool IsKeyboard(const MidiCommDescription& device) const;
+
+    std::string ConnectInput(const MidiCommDescription& device);
+    void DisconnectInput(const MidiCommDescription& device);
+    std::string ConnectOutput(const MidiCommDescription& device);
+    void DisconnectOutput(const MidiCommDescription& device);
+
+    unsigned int ReadBatch(MidiBackendEventList& events);
+    void DropInput();
+
+    void Write(const MidiEvent& out, microseconds_t delay_microseconds);
+    void Drain();
+    void DropScheduled();
+
+    void KeyboardNote(unsigned char note, bool on, unsigned char velocity);
+
+    std::vector<pollfd> PollDescriptors() const;
+    microseconds_t Now() const;
+
+    // Makes the clock manual and sets it
+    void SetNow(microseconds_t now);
+
+    // Queues ev to arrive at the given time.  ReadBatch() hands it out
+    // once Now() reached it; the poll descriptor only turns readable on
+    // Inject() and SetNow().  Events have to be injected in order.
+    void Inject(const MidiEventSimple& ev, microseconds_t arrival);
+
+    // Everything written (and drained) so far, in order
+    const LoopbackOutputEventList& Output() const {
+        return m_output;
+    }
+
+    void ClearOutput() {
+        m_output.clear();
+    }
+
+  private:
+    LoopbackBackend(const LoopbackBackend&);
+    LoopbackBackend& operator=(const LoopbackBackend&);
+
+    void Signal();
+
+    bool m_manual_clock;
+    microseconds_t m_now;
+
+    bool m_input_connected;
+    bool m_output_connected;
+
+    std::deque<MidiBackendEvent> m_pending_input;
+
+    // Written but not drained yet
+    LoopbackOutputEventList m_buffered;
+    LoopbackOutputEventList m_output;
+
+    // Readable while m_pending_input is not empty, for the main loop
+    int m_event_fd;
+};
+
+#endif // __LOOPBACK_BACKEND_H
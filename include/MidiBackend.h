@@ -0,0 +1,118 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __MIDI_BACKEND_H
+#define __MIDI_BACKEND_H
+
+#include <string>
+#include <vector>
+#include <poll.h>
+
+#include "libmidi/MidiEvent.h"
+#include "libmidi/MidiTypes.h"
+
+struct MidiCommDescription {
+
+    unsigned int id;
+    std::string name;
+
+    // Where the device is, as the backend understands it
+    int client;
+    int port;
+
+    // Which part of a CombinedBackend it belongs to, 0 otherwise
+    int backend;
+};
+
+typedef std::vector<MidiCommDescription> MidiCommDescriptionList;
+
+// An input event, with the time (as in MidiBackend::Now()) it reached us
+struct MidiBackendEvent {
+
+    MidiEventSimple event;
+    microseconds_t arrival;
+};
+
+typedef std::vector<MidiBackendEvent> MidiBackendEventList;
+
+// What MidiBackend::ReadBatch() came across, or-ed together
+enum MidiReadResult {
+
+    MidiReadNothing = 0,
+
+    // Anything at all, worth waking up for
+    MidiReadSomething = 1,
+
+    // InputDevices() or OutputDevices() changed
+    MidiReadDevicesChanged = 2,
+
+    // A device was plugged in, the open input may have to reconnect
+    MidiReadDeviceStarted = 4
+};
+
+// Everything MidiComm needs from the system's MIDI layer.  All of it is
+// used from one thread at a time (Open() and the first device lists from
+// the midiInitAsync() worker, the rest from the main loop).
+class MidiBackend {
+  public:
+
+    virtual ~MidiBackend() {
+    }
+
+    // Returns why MIDI is unavailable, or an empty string if it is fine
+    virtual std::string Open() = 0;
+    virtual void Close() = 0;
+
+    // Kept up to date by ReadBatch(), Rescan() enumerates everything again
+    virtual MidiCommDescriptionList InputDevices() const = 0;
+    virtual MidiCommDescriptionList OutputDevices() const = 0;
+    virtual void Rescan() = 0;
+
+    // Whether device is the PC keyboard input, which is fed by sendNote()
+    // rather than by the backend
+    virtual bool IsKeyboard(const MidiCommDescription& device) const = 0;
+
+    // Return why it failed, or an empty string
+    virtual std::string ConnectInput(const MidiCommDescription& device) = 0;
+    virtual void DisconnectInput(const MidiCommDescription& device) = 0;
+    virtual std::string ConnectOutput(const MidiCommDescription& device) = 0;
+    virtual void DisconnectOutput(const MidiCommDescription& device) = 0;
+
+    // Appends the note and program change events received since the last
+    // call to events.  Returns a combination of MidiReadResult.
+    virtual unsigned int ReadBatch(MidiBackendEventList& events) = 0;
+    virtual void DropInput() = 0;
+
+    // Buffers out for delivery delay_microseconds from now (right away if
+    // not positive).  Drain() sends what is buffered, and the backend
+    // delivers it on time by itself (the sequencer's queue, or a thread of
+    // its own), not on some later Drain().
+    virtual void Write(const MidiEvent& out, microseconds_t delay_microseconds) = 0;
+    virtual void Drain() = 0;
+
+    // Drops whatever was scheduled and not delivered yet, except Note-Offs
+    // (a late one is far less noticeable than a stuck note)
+    virtual void DropScheduled() = 0;
+
+    // Lets other applications see what is played on the PC keyboard
+    virtual void KeyboardNote(unsigned char note, bool on, unsigned char velocity) = 0;
+
+    // Readable when ReadBatch() has something
+    virtual std::vector<pollfd> PollDescriptors() const = 0;
+
+    // Clock of the arrival times
+    virtual microseconds_t Now() const = 0;
+};
+
+// The backend for this run, picked by LINTHESIA_MIDI_BACKEND:
+// "sequencer" (ALSA sequencer only), "rawmidi" (ALSA raw devices only),
+// "loopback" (in-process, see LoopbackBackend) or, by default, the
+// sequencer and the raw devices side by side
+MidiBackend *createMidiBackend();
+
+#endif // __MIDI_BACKEND_H
@@ -11,31 +11,75 @@
 
 #include <string>
 #include <vector>
-#include <queue>
-#include <alsa/asoundlib.h>
+#include <bitset>
 
 #include "libmidi/MidiEvent.h"
+#include "MidiBackend.h"
+#include "VoiceManager.h"
 
-struct MidiCommDescription {
+// Start/Stop midi services (i.e. open/close sequencer).  midiStop() also
+// deletes the backend, the next midiInit() starts over with a new one.
+void midiInit();
+void midiStop();
 
-    unsigned int id;
-    std::string name;
+// Replaces the backend createMidiBackend() would give, before midiInit().
+// MidiComm owns it from then on.
+void midiUseBackend(MidiBackend *backend);
 
-    int client;
-    int port;
-};
+// The clock of the arrival times, as in MidiCommIn::Read()
+microseconds_t midiNow();
 
-typedef std::vector<MidiCommDescription> MidiCommDescriptionList;
+// Opens the sequencer and enumerates the devices on a thread of its own,
+// so startup doesn't wait on ALSA.  on_ready is called from that thread
+// once done.  Until midiReady(), the device lists are empty and nothing
+// else here does anything.
+void midiInitAsync(void (*on_ready)());
+bool midiReady();
 
-// Start/Stop midi services (i.e. open/close sequencer)
-void midiInit();
-void midiStop();
+// Why MIDI is unavailable, or an empty string if it is fine
+std::string midiInitError();
+
+// MidiCommOut only buffers events, this sends everything written or
+// scheduled so far in one go.  Call it once per frame.
+void midiDrainOutput();
+
+// Poll descriptors of the sequencer, so the main loop can wake up as
+// soon as input arrives
+std::vector<pollfd> midiPollDescriptors();
+
+// Moves everything the sequencer received into the MidiCommIn buffer,
+// stamped with its arrival time.  Returns whether anything was read.
+bool midiReadInput();
 
-// Emulate MIDI keyboard using PC keyboard
-void sendNote(const unsigned char note, bool on);
+// Changes whenever a device list does (devices plugged in or removed,
+// as announced by the sequencer).  Cheap enough to poll every frame.
+unsigned long midiDeviceListSerial();
+
+// Emulate MIDI keyboard using PC keyboard.  When "Linthesia Keyboard" is
+// the input device, the note goes straight to MidiCommIn, as if it had
+// arrived at pressed_microseconds (as in Compatible::GetMicroseconds()).
+void sendNote(const unsigned char note, bool on, microseconds_t pressed_microseconds);
+
+class MidiCommOut;
+
+// Where a key of the input device is sent on to, see midiSetThru()
+struct MidiThruRoute {
+
+    bool enabled;
+    unsigned char channel;
+    unsigned char note;
+    unsigned char velocity;
+};
+
+// Sends the notes played on the input device on to out as soon as they
+// arrive (in midiReadInput() and sendNote()), instead of waiting for the
+// next frame.  Each input pitch is routed by its entry of routes, which
+// holds 128 of them.  A null out turns this off.
+void midiSetThru(MidiCommOut *out);
+void midiSetThruRoutes(const MidiThruRoute *routes);
 
 // Once you create a MidiCommIn object.  Use the Read() function
-// to grab one event at a time from the buffer.
+// to grab one event at a time from the buffer (filled by midiReadInput()).
 class MidiCommIn {
   public:
 
@@ -46,14 +90,15 @@ class MidiCommIn {
     MidiCommIn(unsigned int device_id);
     ~MidiCommIn();
 
-    MidiCommDescription GetDeviceDescription() const {
-        return m_description;
-    }
+    // The id is that of the device in the current GetDeviceList()
+    MidiCommDescription GetDeviceDescription() const;
 
     // Returns the next buffered input event.  Use KeepReading() (usually in
     // a while loop) to see if you should call this function.  If called when
-    // KeepReading() is false, this will throw MidiError_NoInputAvailable.
-    MidiEvent Read();
+    // KeepReading() is false, this returns a null event.  When given,
+    // arrival_microseconds is set to the time (as in midiNow()) the event
+    // reached us.
+    MidiEvent Read(microseconds_t *arrival_microseconds = 0);
 
     // Discard events from the input buffer
     void Reset();
@@ -63,9 +108,17 @@ class MidiCommIn {
     bool ShouldReconnect() const;
     void Reconnect();
 
+    // Time from a key press (as seen on screen) until its event reaches
+    // us.  Measured by CalibrationState and stored per device.
+    microseconds_t GetLatency() const {
+        return m_latency;
+    }
+
+    void SetLatency(microseconds_t latency);
+
   private:
     MidiCommDescription m_description;
-    bool m_should_reconnect;
+    microseconds_t m_latency;
 };
 
 class MidiCommOut {
@@ -78,23 +131,65 @@ class MidiCommOut {
     MidiCommOut(unsigned int device_id);
     ~MidiCommOut();
 
-    MidiCommDescription GetDeviceDescription() const {
-        return m_description;
-    }
+    // The id is that of the device in the current GetDeviceList()
+    MidiCommDescription GetDeviceDescription() const;
 
-    // Send a single event out to the device.
+    // Send a single event out to the device (on the next
+    // midiDrainOutput() call).
     void Write(const MidiEvent& out);
 
-    // Turns all notes off and resets all controllers
+    // Queue a single event to be sent out delay_microseconds from now.
+    // The sequencer delivers it on time, whatever our frame rate is.
+    // Song notes go through a VoiceManager, so a flood of them is thinned
+    // out (see the "max_polyphony", "max_channel_polyphony" and
+    // "overload_velocity_floor" settings).
+    void Schedule(const MidiEvent& out, microseconds_t delay_microseconds);
+
+    // Events scheduled between two calls are one batch for the
+    // VoiceManager
+    void StartBatch();
+
+    // Drops every scheduled event that didn't reach the device yet,
+    // except note-offs (so nothing is left hanging).
+    void Flush();
+
+    // Turns all notes off and resets all controllers.  Synths that ignore
+    // All Notes Off also get a Note-Off per sounding note when the
+    // "per_note_reset" setting is "true".
     void Reset();
 
     void Reconnect();
 
+    // Time from sending an event until it is heard.  Measured by
+    // CalibrationState and stored per device.
+    microseconds_t GetLatency() const {
+        return m_latency;
+    }
+
+    void SetLatency(microseconds_t latency);
+
   private:
     void Release();
 
+    // Keeps track of the channels and notes out uses, for Reset()
+    void TrackEvent(const MidiEvent& out);
+
+    void NoteStarted(int channel, int note);
+    void NoteStopped(int channel, int note);
+
     MidiCommDescription m_description;
-    std::vector<std::pair<int, int>> notes_on;
+    microseconds_t m_latency;
+
+    // Notes sounding on each channel, for Reset()
+    std::bitset<128> m_notes_on[16];
+    int m_notes_on_count[16];
+
+    // Channels that got anything since the last Reset()
+    std::bitset<16> m_channels_used;
+    bool m_per_note_reset;
+
+    VoiceManager m_voices;
+    MidiEventList m_admitted;
 };
 
 #endif // __MIDI_COMM_H
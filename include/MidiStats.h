@@ -0,0 +1,122 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __MIDI_STATS_H
+#define __MIDI_STATS_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "libmidi/MidiTypes.h"
+
+// Counts the MIDI traffic, to tell a slow synth or sequencer from a slow
+// frame loop.  Everything is gathered over one second and published when
+// it is over.  Shown with F7 (see GameStateManager), and appended to the
+// CSV file named by LINTHESIA_MIDI_STATS_CSV when it is set.
+class MidiStats {
+  public:
+
+    MidiStats();
+
+    // Fed by MidiComm
+    void EventIn() {
+        m_events_in++;
+    }
+
+    void EventOut() {
+        m_events_out++;
+        m_frame_events_out++;
+    }
+
+    void Drain() {
+        m_drains++;
+    }
+
+    void InputDepth(size_t depth);
+
+    // Fed by whoever scores the input: time from the arrival of a note
+    // until it was scored
+    void ScoringLatency(microseconds_t latency);
+
+    // Call once per frame, with midiNow()
+    void Frame(microseconds_t now);
+
+    // Over the last full second
+    double EventsInPerSecond() const {
+        return m_shown_events_in;
+    }
+
+    double EventsOutPerSecond() const {
+        return m_shown_events_out;
+    }
+
+    double DrainsPerFrame() const {
+        return m_shown_drains_per_frame;
+    }
+
+    int LargestOutputBurst() const {
+        return m_shown_largest_burst;
+    }
+
+    size_t LargestInputDepth() const {
+        return m_shown_input_depth;
+    }
+
+    size_t LatencySamples() const {
+        return m_shown_latency_samples;
+    }
+
+    microseconds_t LatencyMedian() const {
+        return m_shown_latency_median;
+    }
+
+    microseconds_t LatencyP95() const {
+        return m_shown_latency_p95;
+    }
+
+    microseconds_t LatencyMax() const {
+        return m_shown_latency_max;
+    }
+
+    // One line, for the overlay
+    std::string Summary() const;
+
+  private:
+    void Publish(microseconds_t elapsed);
+    void WriteCsv();
+
+    microseconds_t m_window_start;
+    microseconds_t m_started;
+
+    int m_events_in;
+    int m_events_out;
+    int m_drains;
+    int m_frames;
+    int m_frame_events_out;
+    int m_largest_burst;
+    size_t m_input_depth;
+    std::vector<microseconds_t> m_latencies;
+
+    double m_shown_events_in;
+    double m_shown_events_out;
+    double m_shown_drains_per_frame;
+    int m_shown_largest_burst;
+    size_t m_shown_input_depth;
+    size_t m_shown_latency_samples;
+    microseconds_t m_shown_latency_median;
+    microseconds_t m_shown_latency_p95;
+    microseconds_t m_shown_latency_max;
+
+    std::ofstream m_csv;
+};
+
+// The one instance, fed by MidiComm
+MidiStats& midiStats();
+
+#endif // __MIDI_STATS_H
@@ -0,0 +1,135 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __NOTE_BUFFER_H
+#define __NOTE_BUFFER_H
+
+#include <vector>
+#include <memory>
+
+#include "Renderer.h"
+#include "TrackProperties.h"
+
+#include "libmidi/Note.h"
+#include "libmidi/MidiTypes.h"
+
+// How a note texture is stretched over a note (see KeyboardDisplay::DrawNote).
+// Everything but the height of the note is known from its width alone.
+struct NoteShape {
+
+    // Where the texture starts, left of the note, and how wide it is
+    double left_offset;
+    int width;
+
+    // Pixels, from the top of the note
+    double crown_start;
+    double crown_end;
+
+    // Pixels, from the bottom of the note
+    double heel_height;
+    double bottom_height;
+
+    // Shorter notes are stretched to this
+    double min_height;
+
+    // Texels of one color of the texture
+    int tex_width;
+    int tex_height;
+    int tex_crown_end;
+    int tex_heel_start;
+};
+
+// Where the notes of each pitch fall
+struct NoteLane {
+
+    int left;
+    bool black;
+};
+
+// The buffers on the graphics card, and what a Draw() hands over to them
+struct NoteBufferObjects;
+struct NoteDrawing;
+
+// Every note of the song in a vertex buffer on the graphics card, moved
+// into place by a vertex shader from the song time.  Drawing a frame
+// costs the same few calls however many notes there are.  Whether a note
+// was missed is kept apart and updated one note at a time.
+//
+// Building and drawing are recorded (see DrawList), the buffers are
+// filled when the first frame using them is submitted.
+//
+// Needs GLSL 1.20, KeyboardDisplay draws the notes itself otherwise.
+class NoteBuffer {
+  public:
+
+    NoteBuffer();
+    ~NoteBuffer();
+
+    // The first call needs the OpenGL context and builds the shader, it
+    // is made by GameStateManager::PrepareDrawing().  False also when
+    // turned off with LINTHESIA_NOTE_RENDERER=cpu.
+    static bool Available();
+
+    bool IsBuilt() const {
+        return m_objects != 0;
+    }
+
+    // Notes of tracks that aren't shown are left out.  lanes has one
+    // entry per NoteId.  Called again after a jump in the song, when the
+    // notes are set up again.
+    void Build(Renderer& renderer, const TranslatedNoteSet& notes,
+               const std::vector<Track::Properties>& track_properties,
+               const NoteLane lanes[128], const NoteShape& white, const NoteShape& black);
+
+    // A note of the song got (or lost) the missed color.  It goes out
+    // with the next Draw().
+    void NoteChanged(const TranslatedNote& note);
+
+    // One pass of notes (shadows or colors), white notes then black
+    // ones.  bottom is where a note starting right now ends, and
+    // scaling_factor is in pixels per microsecond.
+    void Draw(Renderer& renderer, const Tga *tex_white, const Tga *tex_black,
+              microseconds_t current_time, microseconds_t longest_note, microseconds_t show_duration,
+              double scaling_factor, long long roll_under, int bottom);
+
+  private:
+    NoteBuffer(const NoteBuffer&);
+    NoteBuffer& operator=(const NoteBuffer&);
+
+    // White notes come first in the buffers, then black ones.  Each
+    // part is in TranslatedNoteSet order.
+    struct Part {
+
+        const NoteShape *shape;
+        size_t first;
+        std::vector<TranslatedNote> notes;
+    };
+
+    // The notes of part that can be on screen go into drawing
+    static void DrawPart(NoteDrawing *drawing, const Part& part, const Tga *tex, microseconds_t current_time,
+                         microseconds_t longest_note, microseconds_t show_duration);
+
+    // Index of note in the buffers, or -1
+    long Find(const TranslatedNote& note) const;
+
+    Part m_white;
+    Part m_black;
+    NoteShape m_white_shape;
+    NoteShape m_black_shape;
+
+    // Shared with the commands filling and drawing them
+    std::shared_ptr<NoteBufferObjects> m_objects;
+
+    // Mirror of the state buffer, one byte per note
+    std::vector<unsigned char> m_missed;
+
+    // (index, missed) of the notes changed since the last Draw()
+    std::vector<std::pair<size_t, unsigned char> > m_changes;
+};
+
+#endif // __NOTE_BUFFER_H
@@ -19,31 +19,6 @@
 #include "KeyboardDisplay.h"
 #include "MidiComm.h"
 
-struct ActiveNote {
-
-    bool operator()(const ActiveNote& lhs, const ActiveNote& rhs) const {
-        if (lhs.note_id < rhs.note_id)
-            return true;
-
-        if (lhs.note_id > rhs.note_id)
-            return false;
-
-        if (lhs.channel < rhs.channel)
-            return true;
-
-        if (lhs.channel > rhs.channel)
-            return false;
-
-        return false;
-    }
-
-    NoteId note_id;
-    unsigned char channel;
-    int velocity;
-};
-
-typedef std::set<ActiveNote, ActiveNote> ActiveNoteSet;
-
 class PlayingState : public GameState {
   public:
     PlayingState(const SharedState& state);
@@ -54,6 +29,7 @@ class PlayingState : public GameState {
     virtual void Init();
     virtual void Update();
     virtual void Draw(Renderer& renderer) const;
+    virtual bool IsAnimating() const;
 
   private:
 
@@ -73,6 +49,16 @@ class PlayingState : public GameState {
     void Play(microseconds_t delta_microseconds);
     void Listen();
 
+    // Tells midiSetThru() where each key goes right now, so the user
+    // hears their notes without waiting for Listen()
+    void UpdateThruRoutes();
+
+    // Look-ahead output scheduling
+    bool ShouldPlayEvent(size_t track_id, const MidiEvent& ev) const;
+    bool CanScheduleAhead() const;
+    void ScheduleOutput();
+    void RescheduleOutput();
+
     double CalculateScoreMultiplier() const;
 
     bool m_paused;
@@ -82,13 +68,18 @@ class PlayingState : public GameState {
     TranslatedNoteSet m_notes;
     TranslatedNoteSet m_notes_history;
 
+    // No note in m_notes lasts longer, for KeyboardDisplay to find the
+    // notes on screen without going through all of them
+    microseconds_t m_longest_note;
+
     bool m_any_you_play_tracks;
     size_t m_look_ahead_you_play_note_count;
 
-    ActiveNoteSet m_active_notes;
-
     bool m_first_update;
 
+    // Song time up to which file events were handed to the output
+    microseconds_t m_scheduled_until;
+
     SharedState m_state;
     int m_current_combo;
 
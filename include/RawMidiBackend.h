@@ -0,0 +1,103 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __RAW_MIDI_BACKEND_H
+#define __RAW_MIDI_BACKEND_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <alsa/asoundlib.h>
+
+#include "MidiBackend.h"
+#include "libmidi/MidiByteParser.h"
+
+// MIDI straight from the ALSA raw devices (hw:card,device,subdevice),
+// without the sequencer in between.  It is the shortest way to a USB
+// piano, but there is no queue: scheduled output is held here and sent
+// by an output thread of its own as soon as it is due, whatever the frame
+// rate is.  Devices are only found again on Rescan().
+class RawMidiBackend : public MidiBackend {
+  public:
+
+    RawMidiBackend();
+    ~RawMidiBackend();
+
+    std::string Open();
+    void Close();
+
+    MidiCommDescriptionList InputDevices() const;
+    MidiCommDescriptionList OutputDevices() const;
+    void Rescan();
+
+    bool IsKeyboard(const MidiCommDescription& device) const;
+
+    std::string ConnectInput(const MidiCommDescription& device);
+    void DisconnectInput(const MidiCommDescription& device);
+    std::string ConnectOutput(const MidiCommDescription& device);
+    void DisconnectOutput(const MidiCommDescription& device);
+
+    unsigned int ReadBatch(MidiBackendEventList& events);
+    void DropInput();
+
+    void Write(const MidiEvent& out, microseconds_t delay_microseconds);
+    void Drain();
+    void DropScheduled();
+
+    void KeyboardNote(unsigned char note, bool on, unsigned char velocity);
+
+    std::vector<pollfd> PollDescriptors() const;
+    microseconds_t Now() const;
+
+  private:
+    RawMidiBackend(const RawMidiBackend&);
+    RawMidiBackend& operator=(const RawMidiBackend&);
+
+    struct ScheduledEvent {
+
+        MidiEvent event;
+        microseconds_t due;
+    };
+
+    void Enumerate(int card, snd_rawmidi_stream_t stream, MidiCommDescriptionList& devices) const;
+    void CloseInput();
+
+    // With m_out_mutex held
+    void Encode(const MidiEvent& out);
+    void SendDue();
+
+    // The output thread
+    void runOutput();
+
+    snd_rawmidi_t *m_in;
+    snd_rawmidi_t *m_out;
+
+    // The poll descriptors of the open input are added to it, so the main
+    // loop has a single descriptor to watch whatever device is open
+    int m_epoll_fd;
+    std::vector<pollfd> m_in_fds;
+
+    MidiByteParser m_parser;
+    MidiEventList m_parsed;
+
+    // Bytes not taken by the device yet, and events not due yet (in order)
+    std::string m_out_bytes;
+    std::vector<ScheduledEvent> m_scheduled;
+
+    // Around m_out and the two above, shared with the output thread.  It
+    // is woken up when something is scheduled earlier than it waits for.
+    std::mutex m_out_mutex;
+    std::condition_variable m_out_changed;
+    bool m_should_exit;
+    std::thread m_output_thread;
+
+    MidiCommDescriptionList m_inputs;
+    MidiCommDescriptionList m_outputs;
+};
+
+#endif // __RAW_MIDI_BACKEND_H
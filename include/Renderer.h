@@ -9,8 +9,11 @@
 #ifndef __RENDERER_H
 #define __RENDERER_H
 
+#include <memory>
+
 #include "OSGraphics.h"
 #include "Tga.h"
+#include "DrawList.h"
 
 typedef Glib::RefPtr<Gdk::GL::Context> GLContext;
 typedef Glib::RefPtr<Pango::Context> PGContext;
@@ -19,14 +22,18 @@ struct Color {
     int r, g, b, a;
 };
 
+// Records what is drawn into a DrawList, drawing makes no OpenGL calls
+// (SetupView() aside).  Copies record into the same list.
 class Renderer {
   public:
 
-    Renderer(GLContext glcontext, PGContext pangocontext);
+    Renderer(GLContext glcontext, PGContext pangocontext, DrawList& list);
 
     static Color ToColor(int r, int g, int b, int a = 0xFF);
 
-    void SwapBuffers();
+    // The OpenGL state everything is drawn with, for a drawable of this
+    // size.  Called when it is created or resized.
+    static void SetupView(int width, int height);
 
     // 0 will disable vsync, 1 will enable.
     void SetVSyncInterval(int interval = 1);
@@ -40,7 +47,16 @@ class Renderer {
         SetOffset(0, 0);
     }
 
-    void ForceTexture(unsigned int texture_id);
+    // OpenGL work of anything drawn outside of the quads goes through
+    // these, see DrawList
+    void AddCommand(DrawCommand *command);
+    void Hold(std::shared_ptr<void> resource);
+
+    // (u, v) of texture_id is white, DrawQuad() uses it instead of
+    // switching textures when that texture is selected.  Set before
+    // anything is drawn with it.
+    static void SetSolidTexel(unsigned int texture_id, double u, double v);
+    static void RemoveSolidTexel(unsigned int texture_id);
 
     void SetColor(Color c);
     void SetColor(int r, int g, int b, int a = 0xFF);
@@ -56,17 +72,23 @@ class Renderer {
 
   private:
 
-    // NOTE: These are used externally by the friend
-    // class TextWriter (along with the context)
+    // NOTE: These are used externally by the friend classes TextWriter,
+    // LayerCache and NoteBuffer
     int m_xoffset;
     int m_yoffset;
 
     GLContext m_glcontext;
     PGContext m_pangocontext;
 
+    DrawList *m_list;
+
     friend class Text;
 
     friend class TextWriter;
+
+    friend class LayerCache;
+
+    friend class NoteBuffer;
 };
 
 #endif // __RENDERER_H
@@ -24,6 +24,7 @@ class StatsState : public GameState {
     virtual void Init();
     virtual void Update();
     virtual void Draw(Renderer& renderer) const;
+    virtual bool IsAnimating() const;
 
   private:
     ButtonState m_continue_button;
@@ -20,6 +20,8 @@
 #include "StringUtil.h"
 #include "TrackProperties.h"
 
+struct TextLayout;
+
 // A nice ostream-like class for drawing OS-specific (or OpenGL) text to the
 // screen in varying colors, fonts, and sizes.
 class TextWriter {
@@ -35,6 +37,12 @@ class TextWriter {
     // is greater (so that you can skip down past a multiline write)
     TextWriter& next_line();
 
+    // The font of writers made without one: the user's setting, or the
+    // platform's (saved as the setting) if there is none.  The first call
+    // reads the settings and the X display, it is made on the main thread
+    // by GameStateManager::PrepareDrawing().
+    static const std::string& DefaultFont();
+
     // Allow manipulators
     TextWriter& operator<<(TextWriter& (__cdecl *_Pfn)(TextWriter&)) {
         (*_Pfn)(*(TextWriter *) this);
@@ -51,6 +59,7 @@ class TextWriter {
     int x, y, size, original_x;
     int last_line_height;
     bool centered;
+    std::string font;
     Renderer renderer;
 
     friend class Text;
@@ -77,25 +86,53 @@ const static Color Orange = {0x20, 0x80, 0xFF, 0xFF};
 const static Color Pink = {0xA0, 0x80, 0xFF, 0xFF};
 const static Color CheatYellow = {0x00, 0xCC, 0xFF, 0xFF};
 
+enum TextEffect {
+    TextPlain,
+    TextOutline,
+    TextShadow
+};
+
 // A class to use TextWriter, and write to the screen
 class Text {
   public:
 
     Text(std::string t, Color color) :
         m_color(color),
+        m_effect(TextPlain),
+        m_effect_color(Black),
         m_text(t) {
     }
 
     Text(int i, Color color) :
         m_color(color),
+        m_effect(TextPlain),
+        m_effect_color(Black),
         m_text(STRING(i)) {
     }
 
     Text(double d, int prec, Color color) :
         m_color(color),
+        m_effect(TextPlain),
+        m_effect_color(Black),
         m_text(STRING(std::setprecision(prec) << d)) {
     }
 
+    // A one pixel border all around, in color
+    Text Outlined(Color color) const {
+        Text t(*this);
+        t.m_effect = TextOutline;
+        t.m_effect_color = color;
+        return t;
+    }
+
+    // Down and to the right, in color
+    Text Shadowed(Color color) const {
+        Text t(*this);
+        t.m_effect = TextShadow;
+        t.m_effect_color = color;
+        return t;
+    }
+
     TextWriter& operator<<(TextWriter& tw) const;
 
   private:
@@ -104,10 +141,12 @@ class Text {
     // the screen (determined in an OS dependent way) and
     // advance the TextWriter's position by the width and/or
     // height of the text.
-    void calculate_position_and_advance_cursor(TextWriter& tw, int *out_x,
-                                               int *out_y) const;
+    void calculate_position_and_advance_cursor(TextWriter& tw, const TextLayout& layout,
+                                               int *out_x, int *out_y) const;
 
     Color m_color;
+    TextEffect m_effect;
+    Color m_effect_color;
     std::string m_text;
 };
 
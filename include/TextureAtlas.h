@@ -0,0 +1,57 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __TEXTURE_ATLAS_H
+#define __TEXTURE_ATLAS_H
+
+#include <vector>
+
+#include "Tga.h"
+
+// Many images packed into one texture, so drawing them one after the
+// other doesn't have to switch textures (and the Renderer can keep them
+// in one batch).  It also holds a patch of white for untextured quads.
+class TextureAtlas {
+  public:
+
+    TextureAtlas();
+    ~TextureAtlas();
+
+    // Returns what to Get() the image with, once built
+    size_t Add(const TgaImage& image);
+
+    // Packs everything added into a single texture.  False if it can't
+    // (too big for the graphics card), nothing is usable then.
+    bool Build(bool smooth);
+
+    // Owned by the atlas
+    Tga *Get(size_t index) const {
+        return m_regions[index];
+    }
+
+  private:
+    TextureAtlas(const TextureAtlas&);
+    TextureAtlas& operator=(const TextureAtlas&);
+
+    struct Placement {
+
+        unsigned int x;
+        unsigned int y;
+    };
+
+    // Shelf packing, tallest first.  Returns the height used, or 0 if
+    // something is wider than width.
+    unsigned int Pack(unsigned int width, std::vector<Placement>& placements) const;
+
+    std::vector<TgaImage> m_images;
+    std::vector<Tga *> m_regions;
+
+    TextureId m_texture_id;
+};
+
+#endif // __TEXTURE_ATLAS_H
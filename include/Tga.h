@@ -10,15 +10,38 @@
 #define __TGA_H
 
 #include <string>
+#include <vector>
 
 typedef unsigned int TextureId;
 
+// A decoded TGA, not on the graphics card yet.  Rows go bottom-up, as in
+// the file (and as OpenGL wants them).  Decoding doesn't need an OpenGL
+// context, uploading does.
+struct TgaImage {
+
+    unsigned int width;
+    unsigned int height;
+
+    // 24 (RGB) or 32 (RGBA)
+    unsigned int bpp;
+
+    std::vector<unsigned char> pixels;
+};
+
 class Tga {
   public:
 
     static Tga *Load(const std::string& resource_name);
     static void Release(Tga *tga);
 
+    static TgaImage Decode(const std::string& resource_name);
+    static Tga *Upload(const TgaImage& image);
+
+    // A part of a texture owned by someone else (see TextureAtlas).
+    // Release() leaves the texture alone.
+    static Tga *Region(TextureId texture_id, unsigned int texture_width, unsigned int texture_height,
+                       unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+
     TextureId GetId() const {
         return m_texture_id;
     }
@@ -31,6 +54,18 @@ class Tga {
         return m_height;
     }
 
+    // Texture coordinates of a point of the image, x and y counted from
+    // its top left corner
+    double TexU(int x) const {
+        return static_cast<double>(m_x + x) / static_cast<double>(m_texture_width);
+    }
+
+    double TexV(int y) const {
+        return static_cast<double>(m_y + static_cast<int>(m_height) - y) / static_cast<double>(m_texture_height);
+    }
+
+    // Sets the filtering of the whole texture.  Only the first call and
+    // changes need OpenGL.
     void SetSmooth(bool smooth);
 
   private:
@@ -39,6 +74,17 @@ class Tga {
     unsigned int m_width;
     unsigned int m_height;
 
+    // Where the image is in its texture
+    unsigned int m_x;
+    unsigned int m_y;
+    unsigned int m_texture_width;
+    unsigned int m_texture_height;
+    bool m_owns_texture;
+
+    // What SetSmooth() last set, if it was called
+    bool m_smooth;
+    bool m_smooth_set;
+
     Tga() {}
 
     ~Tga() {}
@@ -46,17 +92,10 @@ class Tga {
     Tga(const Tga& rhs);
     Tga& operator=(const Tga& rhs);
 
-    static Tga *LoadFromData(const unsigned char *bytes);
-
-    static Tga *LoadCompressed(const unsigned char *src, unsigned char *dest,
-                               unsigned int width, unsigned int height, unsigned int bpp);
-
-    static Tga *LoadUncompressed(const unsigned char *src, unsigned char *dest,
-                                 unsigned int size, unsigned int width, unsigned int height,
-                                 unsigned int bpp);
+    static void DecodeData(const unsigned char *bytes, size_t size, TgaImage *image);
 
-    static Tga *BuildFromParameters(const unsigned char *data, unsigned int width,
-                                    unsigned int height, unsigned int bpp);
+    static void DecodeCompressed(const unsigned char *src, const unsigned char *end, TgaImage *image);
+    static void DecodeUncompressed(const unsigned char *src, const unsigned char *end, TgaImage *image);
 };
 
 #endif // __TGA_H
@@ -30,6 +30,8 @@ class TitleState : public GameState {
         m_output_tile(0),
         m_input_tile(0),
         m_file_tile(0),
+        m_device_list_serial(0),
+        m_midi_ready(false),
         m_skip_next_mouse_up(false) {
     }
 
@@ -39,8 +41,12 @@ class TitleState : public GameState {
     virtual void Init();
     virtual void Update();
     virtual void Draw(Renderer& renderer) const;
+    virtual bool IsAnimating() const;
 
   private:
+    void SelectDevices();
+    void CreateDeviceTiles();
+
     void PlayDevicePreview(microseconds_t delta_microseconds);
 
     ButtonState m_continue_button;
@@ -55,6 +61,12 @@ class TitleState : public GameState {
     DeviceTile *m_input_tile;
     StringTile *m_file_tile;
 
+    // midiDeviceListSerial() the tiles were last given lists for
+    unsigned long m_device_list_serial;
+
+    // Whether devices were selected yet (see midiInitAsync())
+    bool m_midi_ready;
+
     bool m_skip_next_mouse_up;
 };
 
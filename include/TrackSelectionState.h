@@ -13,6 +13,7 @@
 #include "GameState.h"
 #include "TrackTile.h"
 #include "libmidi/MidiTypes.h"
+#include "libmidi/MidiTrackCursor.h"
 #include "MidiComm.h"
 
 #include <vector>
@@ -26,9 +27,10 @@ class TrackSelectionState : public GameState {
     virtual void Init();
     virtual void Update();
     virtual void Draw(Renderer& renderer) const;
+    virtual bool IsAnimating() const;
 
   private:
-    void PlayTrackPreview(microseconds_t additional_time);
+    void PlayTrackPreview(microseconds_t delta_microseconds);
     std::vector<Track::Properties> BuildTrackProperties() const;
 
     int m_page_count;
@@ -36,8 +38,7 @@ class TrackSelectionState : public GameState {
     int m_tiles_per_page;
 
     bool m_preview_on;
-    bool m_first_update_after_seek;
-    size_t m_preview_track_id;
+    MidiTrackCursor m_preview;
 
     ButtonState m_continue_button;
     ButtonState m_back_button;
@@ -21,6 +21,10 @@ std::string Get(const std::string& setting,
 
 void Set(const std::string& setting,
          const std::string& value);
+
+// Set() does nothing from then on: the run only reads the settings (a
+// video export, which has no say in them)
+void MakeReadOnly();
 };
 
 #endif // __USER_SETTINGS_H
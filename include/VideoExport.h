@@ -0,0 +1,42 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __VIDEO_EXPORT_H
+#define __VIDEO_EXPORT_H
+
+#include <string>
+
+struct VideoExportOptions {
+
+    VideoExportOptions() :
+        width(1280),
+        height(720),
+        frame_rate(60) {
+    }
+
+    std::string midi_file;
+
+    // A .y4m file ("-" for standard output), or else a directory the
+    // frames go into as PNG files
+    std::string output;
+
+    int width;
+    int height;
+    unsigned int frame_rate;
+};
+
+// Plays the whole song the way PlayingState shows it with every track
+// played automatically, with no window and no MIDI devices, and writes
+// every frame out.  Time moves a fixed 1/frame_rate each frame, so the
+// same song always gives the same frames, as fast as they can be drawn.
+//
+// Needs Gtk::Main and Gtk::GL::init() first.  Problems go to standard
+// error, the return value is the exit status.
+int exportVideo(const VideoExportOptions& options);
+
+#endif // __VIDEO_EXPORT_H
@@ -0,0 +1,93 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __VOICE_MANAGER_H
+#define __VOICE_MANAGER_H
+
+#include <vector>
+
+#include "libmidi/MidiEvent.h"
+#include "libmidi/MidiTrack.h"
+
+// Keeps dense songs (black MIDI, heavily layered scores) from flooding the
+// synth.  Every scheduled song event goes through Admit(), which decides
+// what actually goes out:
+//
+//  - No more than a set number of voices sound per channel and overall.
+//    A new note takes the place of the quietest (then oldest) voice, or is
+//    dropped if every voice is louder than it.
+//  - Once a limit is reached, notes below a velocity floor are dropped
+//    right away instead of taking anybody's place.
+//  - A note struck again while it still sounds from the same batch is
+//    not sent again; it just keeps sounding until its last Note-Off.
+//
+// Note-Offs of dropped or stolen notes are eaten, so nothing ends early.
+class VoiceManager {
+  public:
+
+    VoiceManager(int max_voices, int max_channel_voices, int velocity_floor);
+
+    // Called before each group of events handed out together
+    void StartBatch();
+
+    // Appends to out what should be sent for ev (nothing, ev itself, or
+    // the Note-Off of a stolen voice followed by ev)
+    void Admit(const MidiEvent& ev, MidiEventList& out);
+
+    // Forgets every voice, after the output was flushed or reset
+    void Reset();
+
+    int SoundingVoices() const {
+        return static_cast<int>(m_sounding.size());
+    }
+
+  private:
+
+    struct Voice {
+
+        unsigned char velocity;
+        unsigned long started;
+        unsigned long batch;
+
+        // Note-Ons merged into this voice still waiting for their Note-Off
+        int depth;
+
+        // Index in m_sounding, or -1 when silent
+        int sounding_index;
+    };
+
+    static int Key(int channel, int note) {
+        return channel * 128 + note;
+    }
+
+    void NoteOn(const MidiEvent& ev, MidiEventList& out);
+    void NoteOff(const MidiEvent& ev, MidiEventList& out);
+
+    // The voice to give up for a new note, among every voice or (with
+    // channel >= 0) just those of one channel.  -1 if there is none.
+    int PickVictim(int channel) const;
+    void Silence(int key);
+
+    int m_max_voices;
+    int m_max_channel_voices;
+    int m_velocity_floor;
+
+    unsigned long m_clock;
+    unsigned long m_batch;
+
+    Voice m_voices[16 * 128];
+    int m_channel_voices[16];
+
+    // Note-Offs still to come for notes that were dropped or stolen
+    int m_swallow[16 * 128];
+
+    // Keys of the sounding voices, to look for a victim quickly
+    std::vector<int> m_sounding;
+};
+
+#endif // __VOICE_MANAGER_H
@@ -25,6 +25,15 @@ typedef std::vector<MidiTrack> MidiTrackList;
 typedef std::vector<MidiEvent> MidiEventList;
 typedef std::vector<std::pair<size_t, MidiEvent>> MidiEventListWithTrackId;
 
+struct TimedMidiEvent {
+
+    microseconds_t usecs;
+    size_t track_id;
+    MidiEvent event;
+};
+
+typedef std::vector<TimedMidiEvent> TimedMidiEventList;
+
 // NOTE: This library's MIDI loading and handling is destructive.  Perfect
 //       1:1 serialization routines will not be possible without quite a
 //       bit of additional work.
@@ -45,6 +54,11 @@ class Midi {
     MidiEventListWithTrackId Update(microseconds_t delta_microseconds);
     void GoTo(microseconds_t microsecond_song_position);
 
+    // Returns every event with a song time in (after, up_to], ordered by
+    // time.  Unlike Update(), this doesn't move the song position, so it
+    // can be used to look ahead of the current playback point.
+    TimedMidiEventList EventsInRange(microseconds_t after, microseconds_t up_to) const;
+
     void Reset(microseconds_t lead_in_microseconds,
                microseconds_t lead_out_microseconds);
 
@@ -0,0 +1,48 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __MIDI_BYTE_PARSER_H
+#define __MIDI_BYTE_PARSER_H
+
+#include <string>
+
+#include "MidiTrack.h"
+
+// Turns the byte stream of a MIDI wire (a raw device) into events.  Bytes
+// may come in any chunks.  It follows running status, lets realtime bytes
+// (clock, active sensing...) through anywhere, even in the middle of a
+// message, and collects SysEx up to its 0xF7.  Realtime and the other
+// system common messages are read past, but not returned.
+class MidiByteParser {
+  public:
+
+    MidiByteParser();
+
+    // Appends the messages completed by these bytes to events
+    void Feed(const unsigned char *data, size_t length, MidiEventList& events);
+
+    // Forgets any partial message, e.g. after a device was reopened
+    void Reset();
+
+  private:
+    void Status(unsigned char status);
+    void Data(unsigned char data, MidiEventList& events);
+
+    // Of the message being read (and of the following ones, for running
+    // status).  0 when data bytes are meaningless.
+    unsigned char m_status;
+
+    unsigned char m_data[2];
+    int m_data_count;
+    int m_data_needed;
+
+    bool m_in_sysex;
+    std::string m_sysex;
+};
+
+#endif // __MIDI_BYTE_PARSER_H
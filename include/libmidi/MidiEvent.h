@@ -38,6 +38,9 @@ class MidiEvent {
                                     bool contains_delta_pulses = true);
 
     static MidiEvent Build(const MidiEventSimple& simple);
+
+    // data is the whole message, from 0xF0 to 0xF7
+    static MidiEvent BuildSysEx(const std::string& data);
     static MidiEvent NullEvent();
 
     // NOTE: There is a VERY good chance you don't want to use this directly.
@@ -111,6 +114,13 @@ class MidiEvent {
         return m_status;
     }
 
+    // Returns the bytes to send for a SysEx event, starting with the
+    // 0xF0 status byte (or the raw bytes of an 0xF7 "escape" event).
+    // Empty for other event types.
+    const std::string& SysExData() const {
+        return m_sysex;
+    }
+
   private:
     void ReadMeta(std::istream& stream);
     void ReadSysEx(std::istream& stream);
@@ -125,6 +135,7 @@ class MidiEvent {
 
     unsigned long m_tempo_uspqn;
     std::string m_text;
+    std::string m_sysex;
 };
 
 #endif // __MIDI_EVENT_H
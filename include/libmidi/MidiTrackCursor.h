@@ -0,0 +1,41 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#ifndef __MIDI_TRACK_CURSOR_H
+#define __MIDI_TRACK_CURSOR_H
+
+#include "MidiTrack.h"
+
+// Plays back a single track without touching its own (or the song's)
+// playback position, for previews.  The track has to outlive the cursor.
+class MidiTrackCursor {
+  public:
+
+    MidiTrackCursor();
+    MidiTrackCursor(const MidiTrack& track);
+
+    // Moves to lead_in microseconds before the first note of the track.
+    // The non-note events on the way there (program changes, controllers,
+    // etc.) are returned, so the instrument sounds right from the start.
+    MidiEventList SeekToFirstNote(microseconds_t lead_in);
+
+    // Returns the events that became due over the given time
+    MidiEventList Update(microseconds_t delta_microseconds);
+
+    bool IsFinished() const {
+        return !m_track || m_next_event >= m_track->Events().size();
+    }
+
+  private:
+    const MidiTrack *m_track;
+
+    size_t m_next_event;
+    microseconds_t m_position;
+};
+
+#endif // __MIDI_TRACK_CURSOR_H
@@ -0,0 +1,600 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#include "AlsaSeqBackend.h"
+#include "CompatibleSystem.h"
+
+using namespace std;
+
+const static unsigned int InputPerms = SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+const static unsigned int OutputPerms = SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE;
+
+// Room for a whole frame of events (dense passages, controller sweeps,
+// sysex) in user space, and for the look-ahead in the kernel queue
+const static size_t OutputBufferSize = 65536;
+const static size_t OutputPoolSize = 2000;
+const static size_t InputBufferSize = 16384;
+
+// Keeps the lists in the order a full enumeration gives (client, then
+// port), with ids matching positions
+static void insertDevice(MidiCommDescriptionList& devices, const MidiCommDescription& d) {
+
+    MidiCommDescriptionList::iterator i = devices.begin();
+    while (i != devices.end() && (i->client < d.client || (i->client == d.client && i->port < d.port)))
+        ++i;
+
+    devices.insert(i, d);
+}
+
+static bool removeDevice(MidiCommDescriptionList& devices, int client, int port) {
+
+    bool removed = false;
+    MidiCommDescriptionList::iterator i = devices.begin();
+    while (i != devices.end()) {
+        if (i->client == client && (port < 0 || i->port == port)) {
+            i = devices.erase(i);
+            removed = true;
+        } else
+            ++i;
+    }
+
+    return removed;
+}
+
+static void renumberDevices(MidiCommDescriptionList& devices) {
+
+    for (size_t i = 0; i < devices.size(); ++i)
+        devices[i].id = static_cast<unsigned int>(i);
+}
+
+AlsaSeqBackend::AlsaSeqBackend(bool list_hardware) :
+    m_seq(NULL),
+    m_list_hardware(list_hardware),
+    m_local_out(-1),
+    m_local_in(-1),
+    m_anon_in(-1),
+    m_keybd_out(-1),
+    m_queue(-1) {
+}
+
+AlsaSeqBackend::~AlsaSeqBackend() {
+
+    Close();
+}
+
+string AlsaSeqBackend::Open() {
+
+    int err = snd_seq_open(&m_seq, "default", SND_SEQ_OPEN_DUPLEX, 0);
+
+    // Could not open sequencer, no out devices
+    if (err < 0) {
+        m_seq = NULL;
+        cout << "[WARNING] Cannot open MIDI sequencer: " << snd_strerror(err) << endl;
+        return "Could not open MIDI sequencer. No MIDI available";
+    }
+
+    int ownid = snd_seq_client_id(m_seq);
+    snd_seq_set_client_name(m_seq, "Linthesia");
+
+    snd_seq_set_output_buffer_size(m_seq, OutputBufferSize);
+    snd_seq_set_client_pool_output(m_seq, OutputPoolSize);
+    snd_seq_set_input_buffer_size(m_seq, InputBufferSize);
+
+    // Let the kernel drop what we don't use (active sensing, clock,
+    // aftertouch...) instead of waking us up for it
+    const static int InputEventTypes[] = {
+        SND_SEQ_EVENT_NOTEON, SND_SEQ_EVENT_NOTEOFF, SND_SEQ_EVENT_PGMCHANGE,
+        SND_SEQ_EVENT_CLIENT_START, SND_SEQ_EVENT_CLIENT_EXIT, SND_SEQ_EVENT_CLIENT_CHANGE,
+        SND_SEQ_EVENT_PORT_START, SND_SEQ_EVENT_PORT_EXIT, SND_SEQ_EVENT_PORT_CHANGE
+    };
+
+    for (size_t i = 0; i < sizeof(InputEventTypes) / sizeof(InputEventTypes[0]); ++i)
+        snd_seq_set_client_event_filter(m_seq, InputEventTypes[i]);
+
+    // READ: port allows to send events to other ports
+    m_local_out = snd_seq_create_simple_port(m_seq, "Linthesia Output",
+                                             SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+                                             SND_SEQ_PORT_TYPE_MIDI_GENERIC);
+
+    m_keybd_out = snd_seq_create_simple_port(m_seq, "Linthesia Keyboard",
+                                             SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+                                             SND_SEQ_PORT_TYPE_MIDI_GENERIC);
+
+    // WRITE: port allows to receive events from other ports
+    m_local_in = snd_seq_create_simple_port(m_seq, "Linthesia Input",
+                                            SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+                                            SND_SEQ_PORT_TYPE_MIDI_GENERIC);
+
+    m_anon_in = snd_seq_create_simple_port(m_seq, "Linthesia Annonce Listener",
+                                           SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT,
+                                           SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+
+    m_queue = snd_seq_alloc_named_queue(m_seq, "Linthesia Output Queue");
+    if (m_queue < 0)
+        cout << "[WARNING] Cannot create output queue: " << snd_strerror(m_queue) << endl;
+    else {
+        snd_seq_start_queue(m_seq, m_queue, NULL);
+        snd_seq_drain_output(m_seq);
+    }
+
+    if (m_anon_in >= 0) {
+
+        // Subscribe on port opening
+        snd_seq_port_subscribe_t *sub;
+        snd_seq_addr_t sender, dest;
+
+        snd_seq_port_subscribe_alloca(&sub);
+        // Receive events from annoncer's port
+        sender.client = SND_SEQ_CLIENT_SYSTEM;
+        sender.port = SND_SEQ_PORT_SYSTEM_ANNOUNCE;
+        snd_seq_port_subscribe_set_sender(sub, &sender);
+        // Forward them to our port
+        dest.client = ownid;
+        dest.port = m_anon_in;
+        snd_seq_port_subscribe_set_dest(sub, &dest);
+        err = snd_seq_subscribe_port(m_seq, sub);
+        if (err < 0)
+            fprintf(stderr, "Cannot subscribe announce port: %s\n", snd_strerror(err));
+    }
+
+    Rescan();
+    return "";
+}
+
+void AlsaSeqBackend::Close() {
+
+    if (m_seq == NULL)
+        return;
+
+    snd_seq_drain_output(m_seq);
+    if (m_queue >= 0)
+        snd_seq_free_queue(m_seq, m_queue);
+    snd_seq_close(m_seq);
+    m_seq = NULL;
+}
+
+MidiCommDescriptionList AlsaSeqBackend::InputDevices() const {
+
+    return m_inputs;
+}
+
+MidiCommDescriptionList AlsaSeqBackend::OutputDevices() const {
+
+    return m_outputs;
+}
+
+void AlsaSeqBackend::Rescan() {
+
+    m_inputs.clear();
+    m_outputs.clear();
+
+    Enumerate(InputPerms, m_inputs);
+    Enumerate(OutputPerms, m_outputs);
+}
+
+bool AlsaSeqBackend::IsOwnPort(int client, int port) const {
+
+    return client == snd_seq_client_id(m_seq) && (port == m_local_in || port == m_local_out);
+}
+
+bool AlsaSeqBackend::IsListed(int client) const {
+
+    if (m_list_hardware)
+        return true;
+
+    snd_seq_client_info_t *cinfo;
+    snd_seq_client_info_alloca(&cinfo);
+    if (snd_seq_get_any_client_info(m_seq, client, cinfo) < 0)
+        return true;
+
+    return snd_seq_client_info_get_card(cinfo) < 0;
+}
+
+void AlsaSeqBackend::Enumerate(unsigned int perms, MidiCommDescriptionList& devices) const {
+
+    if (m_seq == NULL)
+        return;
+
+    snd_seq_client_info_t *cinfo;
+    snd_seq_port_info_t *pinfo;
+    int count = 0;
+
+    snd_seq_client_info_alloca(&cinfo);
+    snd_seq_port_info_alloca(&pinfo);
+    snd_seq_client_info_set_client(cinfo, -1);
+
+    while (snd_seq_query_next_client(m_seq, cinfo) >= 0) {
+
+        if (!IsListed(snd_seq_client_info_get_client(cinfo)))
+            continue;
+
+        // reset query info
+        snd_seq_port_info_set_client(pinfo, snd_seq_client_info_get_client(cinfo));
+        snd_seq_port_info_set_port(pinfo, -1);
+
+        while (snd_seq_query_next_port(m_seq, pinfo) >= 0) {
+            if ((snd_seq_port_info_get_capability(pinfo) & perms) == perms) {
+
+                int client = snd_seq_client_info_get_client(cinfo);
+                int port = snd_seq_port_info_get_port(pinfo);
+
+                // filter own ports
+                if (IsOwnPort(client, port))
+                    continue;
+
+                MidiCommDescription d;
+                d.id = count++;
+                d.name = snd_seq_port_info_get_name(pinfo);
+                d.client = client;
+                d.port = port;
+                d.backend = 0;
+
+                devices.push_back(d);
+            }
+        }
+    }
+}
+
+bool AlsaSeqBackend::PortGone(int client, int port) {
+
+    bool changed = removeDevice(m_inputs, client, port);
+    changed |= removeDevice(m_outputs, client, port);
+
+    if (!changed)
+        return false;
+
+    renumberDevices(m_inputs);
+    renumberDevices(m_outputs);
+    return true;
+}
+
+bool AlsaSeqBackend::PortChanged(int client, int port) {
+
+    // Our own ports are not devices
+    if (IsOwnPort(client, port))
+        return false;
+
+    bool changed = removeDevice(m_inputs, client, port);
+    changed |= removeDevice(m_outputs, client, port);
+
+    if (!IsListed(client))
+        return changed;
+
+    snd_seq_port_info_t *pinfo;
+    snd_seq_port_info_alloca(&pinfo);
+
+    if (snd_seq_get_any_port_info(m_seq, client, port, pinfo) >= 0) {
+        const unsigned int caps = snd_seq_port_info_get_capability(pinfo);
+
+        MidiCommDescription d;
+        d.id = 0;
+        d.name = snd_seq_port_info_get_name(pinfo);
+        d.client = client;
+        d.port = port;
+        d.backend = 0;
+
+        if ((caps & InputPerms) == InputPerms) {
+            insertDevice(m_inputs, d);
+            changed = true;
+        }
+
+        if ((caps & OutputPerms) == OutputPerms) {
+            insertDevice(m_outputs, d);
+            changed = true;
+        }
+    }
+
+    if (!changed)
+        return false;
+
+    renumberDevices(m_inputs);
+    renumberDevices(m_outputs);
+    return true;
+}
+
+bool AlsaSeqBackend::IsKeyboard(const MidiCommDescription& device) const {
+
+    return m_seq != NULL && device.client == snd_seq_client_id(m_seq) && device.port == m_keybd_out;
+}
+
+string AlsaSeqBackend::ConnectInput(const MidiCommDescription& device) {
+
+    if (m_seq == NULL)
+        return "MIDI is not available";
+
+    // Connect local in to selected port
+    int res = snd_seq_connect_from(m_seq, m_local_in, device.client, device.port);
+    if (res < 0)
+        return snd_strerror(res);
+
+    return "";
+}
+
+void AlsaSeqBackend::DisconnectInput(const MidiCommDescription& device) {
+
+    if (m_seq == NULL)
+        return;
+
+    snd_seq_disconnect_from(m_seq, m_local_in, device.client, device.port);
+}
+
+string AlsaSeqBackend::ConnectOutput(const MidiCommDescription& device) {
+
+    if (m_seq == NULL)
+        return "MIDI is not available";
+
+    // Connect local out to selected port
+    int res = snd_seq_connect_to(m_seq, m_local_out, device.client, device.port);
+    if (res < 0)
+        return snd_strerror(res);
+
+    return "";
+}
+
+void AlsaSeqBackend::DisconnectOutput(const MidiCommDescription& device) {
+
+    if (m_seq == NULL)
+        return;
+
+    snd_seq_disconnect_to(m_seq, m_local_out, device.client, device.port);
+}
+
+bool AlsaSeqBackend::Decode(const snd_seq_event_t *ev, MidiEventSimple *simple, unsigned int *result) {
+
+    switch (ev->type) {
+        case SND_SEQ_EVENT_NOTEON:simple->status = 0x90 | (ev->data.note.channel & 0x0F); // Type and Channel
+            simple->byte1 = ev->data.note.note;                     // Note number
+            simple->byte2 = ev->data.note.velocity;                 // Velocity
+            return true;
+
+        case SND_SEQ_EVENT_NOTEOFF:simple->status = 0x80 | (ev->data.note.channel & 0x0F); // Type and Channel
+            simple->byte1 = ev->data.note.note;                     // Note number
+            simple->byte2 = 0;                                      // Velocity
+            return true;
+
+        case SND_SEQ_EVENT_PGMCHANGE:simple->status = 0xC0 | (ev->data.note.channel & 0x0F); // Type and Channel
+            simple->byte1 = ev->data.control.value;                 // Program number
+            return true;
+
+        case SND_SEQ_EVENT_PORT_EXIT:
+            // USB device is disconnected - the input client is closed
+        {
+            cout << "MIDI device is lost" << endl;
+            // TODO add better error reporting
+            if (PortGone(ev->data.addr.client, ev->data.addr.port))
+                *result |= MidiReadDevicesChanged;
+        }
+            return false;
+
+        case SND_SEQ_EVENT_CLIENT_EXIT:
+            if (PortGone(ev->data.addr.client, -1))
+                *result |= MidiReadDevicesChanged;
+            return false;
+
+        case SND_SEQ_EVENT_PORT_CHANGE:
+            if (PortChanged(ev->data.addr.client, ev->data.addr.port))
+                *result |= MidiReadDevicesChanged;
+            return false;
+
+        case SND_SEQ_EVENT_PORT_START: {
+            int new_client = ev->data.addr.client;
+            int new_port = ev->data.addr.port;
+            snd_seq_port_info_t *pinfo;
+            snd_seq_port_info_alloca(&pinfo);
+
+            cout << "New MIDI device client=" << new_client << ", port=" << new_port << endl;
+            int err = snd_seq_get_any_port_info(m_seq, new_client, new_port, pinfo);
+
+            if (err < 0)
+                return false; // error
+
+            int port = snd_seq_port_info_get_port(pinfo);
+            int client = snd_seq_port_info_get_client(pinfo);
+            cout << "Port info client=" << client << ", port=" << port << endl;
+
+            std::string new_name = snd_seq_port_info_get_name(pinfo);
+            cout << "New MIDI device " << new_name << endl;
+
+            if (PortChanged(new_client, new_port))
+                *result |= MidiReadDevicesChanged;
+            *result |= MidiReadDeviceStarted;
+        }
+            return false;
+
+            // unknown type, do nothing
+        default:return false;
+    }
+}
+
+unsigned int AlsaSeqBackend::ReadBatch(MidiBackendEventList& events) {
+
+    if (m_seq == NULL)
+        return MidiReadNothing;
+
+    // Only this first check reads from the sequencer.  It fetches as much
+    // as is available, the rest of the batch comes from ALSA's buffer.
+    if (snd_seq_event_input_pending(m_seq, 1) <= 0)
+        return MidiReadNothing;
+
+    // Everything in the batch arrived by now
+    const microseconds_t arrival = Now();
+    unsigned int result = MidiReadSomething;
+
+    do {
+        snd_seq_event_t *ev;
+        if (snd_seq_event_input(m_seq, &ev) < 0)
+            break;
+
+        MidiBackendEvent in;
+        if (!Decode(ev, &in.event, &result))
+            continue;
+
+        in.arrival = arrival;
+        events.push_back(in);
+
+    } while (snd_seq_event_input_pending(m_seq, 0) > 0);
+
+    return result;
+}
+
+void AlsaSeqBackend::DropInput() {
+
+    if (m_seq != NULL)
+        snd_seq_drop_input(m_seq);
+}
+
+bool AlsaSeqBackend::Encode(const MidiEvent& out, snd_seq_event_t *ev) const {
+
+    // Set my source, to all subscribers
+    snd_seq_ev_set_source(ev, m_local_out);
+    snd_seq_ev_set_subs(ev);
+
+    // SysEx carries its own payload, everything else fits a simple event
+    if (out.Type() == MidiEventType_SysEx) {
+        const string& data = out.SysExData();
+        if (data.empty())
+            return false;
+
+        // ALSA copies the data while the event is being output
+        snd_seq_ev_set_sysex(ev, static_cast<unsigned int>(data.length()),
+                             const_cast<char *>(data.data()));
+        return true;
+    }
+
+    MidiEventSimple simple;
+    if (!out.GetSimpleEvent(&simple))
+        return false;
+
+    const int ch = out.Channel();
+
+    // set event type
+    switch (out.Type()) {
+        case MidiEventType_NoteOn:snd_seq_ev_set_noteon(ev, ch, out.NoteNumber(), out.NoteVelocity());
+            break;
+
+        case MidiEventType_NoteOff:snd_seq_ev_set_noteoff(ev, ch, out.NoteNumber(), simple.byte2);
+            break;
+
+        case MidiEventType_Aftertouch:snd_seq_ev_set_keypress(ev, ch, simple.byte1, simple.byte2);
+            break;
+
+        case MidiEventType_Controller:snd_seq_ev_set_controller(ev, ch, simple.byte1, simple.byte2);
+            break;
+
+        case MidiEventType_ProgramChange:snd_seq_ev_set_pgmchange(ev, ch, simple.byte1);
+            break;
+
+        case MidiEventType_ChannelPressure:snd_seq_ev_set_chanpress(ev, ch, simple.byte1);
+            break;
+
+        case MidiEventType_PitchWheel: {
+            // 14 bits, LSB first, centered on zero for ALSA
+            int value = ((simple.byte2 & 0x7F) << 7) | (simple.byte1 & 0x7F);
+            snd_seq_ev_set_pitchbend(ev, ch, value - 0x2000);
+            break;
+        }
+
+            // Unknown type, do nothing
+        default:return false;
+    }
+
+    return true;
+}
+
+void AlsaSeqBackend::Write(const MidiEvent& out, microseconds_t delay_microseconds) {
+
+    if (m_seq == NULL)
+        return;
+
+    snd_seq_event_t ev;
+    snd_seq_ev_clear(&ev);
+
+    if (!Encode(out, &ev))
+        return;
+
+    // Without a queue there is nothing to schedule on, send it right away
+    if (m_queue < 0 || delay_microseconds <= 0)
+        snd_seq_ev_set_direct(&ev);
+
+    else {
+        // delivery relative to the current queue time
+        snd_seq_real_time_t delay;
+        delay.tv_sec = static_cast<unsigned int>(delay_microseconds / 1000000);
+        delay.tv_nsec = static_cast<unsigned int>((delay_microseconds % 1000000) * 1000);
+        snd_seq_ev_schedule_real(&ev, m_queue, 1, &delay);
+    }
+
+    snd_seq_event_output(m_seq, &ev);
+}
+
+void AlsaSeqBackend::Drain() {
+
+    if (m_seq != NULL)
+        snd_seq_drain_output(m_seq);
+}
+
+void AlsaSeqBackend::DropScheduled() {
+
+    if (m_seq == NULL || m_queue < 0)
+        return;
+
+    // Events still in our buffer have to reach the queue to be removed
+    snd_seq_drain_output(m_seq);
+
+    snd_seq_remove_events_t *rm;
+    snd_seq_remove_events_alloca(&rm);
+    snd_seq_remove_events_set_queue(rm, m_queue);
+    snd_seq_remove_events_set_condition(rm, SND_SEQ_REMOVE_OUTPUT | SND_SEQ_REMOVE_IGNORE_OFF);
+    snd_seq_remove_events(m_seq, rm);
+}
+
+void AlsaSeqBackend::KeyboardNote(unsigned char note, bool on, unsigned char velocity) {
+
+    if (m_seq == NULL)
+        return;
+
+    snd_seq_event_t ev;
+    snd_seq_ev_clear(&ev);
+
+    snd_seq_ev_set_source(&ev, m_keybd_out);
+    snd_seq_ev_set_subs(&ev);
+    snd_seq_ev_set_direct(&ev);
+
+    if (on)
+        snd_seq_ev_set_noteon(&ev, 0, note, velocity);
+    else
+        snd_seq_ev_set_noteoff(&ev, 0, note, 0);
+
+    snd_seq_event_output(m_seq, &ev);
+}
+
+vector<pollfd> AlsaSeqBackend::PollDescriptors() const {
+
+    vector<pollfd> fds;
+    if (m_seq == NULL)
+        return fds;
+
+    int count = snd_seq_poll_descriptors_count(m_seq, POLLIN);
+    if (count <= 0)
+        return fds;
+
+    fds.resize(count);
+    count = snd_seq_poll_descriptors(m_seq, &fds[0], count, POLLIN);
+    fds.resize(max(count, 0));
+
+    return fds;
+}
+
+microseconds_t AlsaSeqBackend::Now() const {
+
+    return Compatible::GetMicroseconds();
+}
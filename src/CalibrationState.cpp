@@ -0,0 +1,300 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include <algorithm>
+
+#include "CalibrationState.h"
+#include "TitleState.h"
+#include "TextWriter.h"
+#include "StringUtil.h"
+
+using namespace std;
+
+// 100 BPM, slow enough to not rush, fast enough to keep a steady pulse
+const static microseconds_t BeatPeriod = 600000;
+const static microseconds_t FirstBeat = 1500000;
+const static microseconds_t FlashLength = 120000;
+
+// The first beats are only there to catch the tempo
+const static int CountInBeats = 4;
+const static int MeasuredBeats = 16;
+
+// Fewer taps than this are not worth a measurement
+const static int MinimumTaps = 10;
+
+// Anything larger is a mistake rather than a latency
+const static microseconds_t MaxLatency = 500000;
+
+// Percussion channel, hi wood block
+const static unsigned char ClickChannel = 9;
+const static unsigned char ClickNote = 76;
+const static unsigned char ClickVelocity = 110;
+const static microseconds_t ClickLength = 50000;
+
+static microseconds_t median(vector<microseconds_t> values) {
+
+    if (values.empty())
+        return 0;
+
+    sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+void CalibrationState::Init() {
+
+    m_back_button = ButtonState(
+        Layout::ScreenMarginX,
+        GetStateHeight() - Layout::ScreenMarginY / 2 - Layout::ButtonHeight / 2,
+        Layout::ButtonWidth, Layout::ButtonHeight);
+
+    if (m_state.midi_in)
+        m_state.midi_in->Reset();
+
+    StartPhase(PhaseVisual);
+}
+
+void CalibrationState::StartPhase(Phase phase) {
+
+    m_phase = phase;
+    m_phase_start = GetStateMilliseconds();
+    m_clicks_scheduled = 0;
+    m_offsets.clear();
+}
+
+microseconds_t CalibrationState::PhaseTime() const {
+
+    return static_cast<microseconds_t>(GetStateMilliseconds() - m_phase_start) * 1000;
+}
+
+microseconds_t CalibrationState::BeatTime(int beat) const {
+
+    return FirstBeat + beat * BeatPeriod;
+}
+
+bool CalibrationState::IsBeatFlashing() const {
+
+    const microseconds_t now = PhaseTime();
+    if (now < FirstBeat)
+        return false;
+
+    const int beat = static_cast<int>((now - FirstBeat) / BeatPeriod);
+
+    // The audio phase only flashes during the count-in, the taps
+    // have to follow the clicks
+    if (m_phase == PhaseAudio && beat >= CountInBeats)
+        return false;
+
+    return beat < CountInBeats + MeasuredBeats && now - BeatTime(beat) < FlashLength;
+}
+
+void CalibrationState::ReadTaps() {
+
+    if (!m_state.midi_in)
+        return;
+
+    if (m_state.midi_in->ShouldReconnect())
+        m_state.midi_in->Reconnect();
+
+    const microseconds_t read_time = midiNow();
+
+    while (m_state.midi_in->KeepReading()) {
+        microseconds_t arrival = read_time;
+        MidiEvent ev = m_state.midi_in->Read(&arrival);
+
+        if (m_phase == PhaseDone)
+            continue;
+
+        if (ev.Type() != MidiEventType_NoteOn || ev.NoteVelocity() == 0)
+            continue;
+
+        // Match the tap (as of its arrival) with the closest beat
+        const microseconds_t now = PhaseTime() - max(static_cast<microseconds_t>(0), read_time - arrival);
+        const int beat = static_cast<int>((now - FirstBeat + BeatPeriod / 2) / BeatPeriod);
+        if (now < FirstBeat - BeatPeriod / 2 || beat < CountInBeats ||
+            beat >= CountInBeats + MeasuredBeats)
+            continue;
+
+        m_offsets.push_back(now - BeatTime(beat));
+    }
+}
+
+void CalibrationState::ScheduleClicks() {
+
+    if (!m_state.midi_out || m_phase != PhaseAudio)
+        return;
+
+    // Hand the clicks to the output queue a bit ahead, so they are not
+    // tied to our frame rate
+    const static microseconds_t LookAhead = 100000;
+    const microseconds_t now = PhaseTime();
+
+    while (m_clicks_scheduled < CountInBeats + MeasuredBeats &&
+           BeatTime(m_clicks_scheduled) <= now + LookAhead) {
+
+        const microseconds_t delay = BeatTime(m_clicks_scheduled) - now;
+
+        MidiEvent on = MidiEvent::Build(MidiEventSimple(0x90 | ClickChannel, ClickNote, ClickVelocity));
+        MidiEvent off = MidiEvent::Build(MidiEventSimple(0x80 | ClickChannel, ClickNote, 0));
+
+        m_state.midi_out->Schedule(on, delay);
+        m_state.midi_out->Schedule(off, delay + ClickLength);
+
+        m_clicks_scheduled++;
+    }
+}
+
+void CalibrationState::FinishPhase() {
+
+    if (static_cast<int>(m_offsets.size()) < MinimumTaps) {
+        m_retrying = true;
+        StartPhase(m_phase);
+        return;
+    }
+
+    m_retrying = false;
+    const microseconds_t offset = median(m_offsets);
+
+    if (m_phase == PhaseVisual) {
+        m_visual_offset = offset;
+
+        // Without an output device there is nothing else to measure
+        if (!m_state.midi_out) {
+            m_input_latency = max(-MaxLatency, min(MaxLatency, m_visual_offset));
+            StartPhase(PhaseDone);
+            return;
+        }
+
+        StartPhase(PhaseAudio);
+        return;
+    }
+
+    // The audio taps are late by both the input and the output latency
+    m_input_latency = max(-MaxLatency, min(MaxLatency, m_visual_offset));
+    m_output_latency = max(static_cast<microseconds_t>(0), min(MaxLatency, offset - m_visual_offset));
+    StartPhase(PhaseDone);
+}
+
+bool CalibrationState::IsAnimating() const {
+
+    return m_phase != PhaseDone;
+}
+
+void CalibrationState::Update() {
+
+    MouseInfo mouse = Mouse();
+    m_back_button.Update(mouse);
+
+    if (IsKeyPressed(KeyEscape) || m_back_button.hit) {
+        if (m_state.midi_out)
+            m_state.midi_out->Reset();
+
+        ChangeState(new TitleState(m_state));
+        return;
+    }
+
+    ReadTaps();
+
+    if (m_phase == PhaseDone) {
+        if (IsKeyPressed(KeyEnter)) {
+            m_state.midi_in->SetLatency(m_input_latency);
+            if (m_state.midi_out)
+                m_state.midi_out->SetLatency(m_output_latency);
+
+            ChangeState(new TitleState(m_state));
+            return;
+        }
+
+        if (IsKeyPressed(KeySpace))
+            StartPhase(PhaseVisual);
+    } else {
+        ScheduleClicks();
+
+        const microseconds_t last_beat = BeatTime(CountInBeats + MeasuredBeats - 1);
+        if (PhaseTime() > last_beat + BeatPeriod)
+            FinishPhase();
+    }
+
+    m_tooltip = "";
+    if (m_back_button.hovering)
+        m_tooltip = "Return to the title screen without saving.";
+}
+
+void CalibrationState::Draw(Renderer& renderer) const {
+
+    Layout::DrawTitle(renderer, "Latency Calibration");
+    Layout::DrawHorizontalRule(renderer, GetStateWidth(), Layout::ScreenMarginY);
+    Layout::DrawHorizontalRule(renderer, GetStateWidth(), GetStateHeight() - Layout::ScreenMarginY);
+
+    Layout::DrawButton(renderer, m_back_button, GetTexture(ButtonBackToTitle));
+
+    const int center_x = GetStateWidth() / 2;
+    int text_y = Layout::ScreenMarginY + 40;
+
+    if (!m_state.midi_in) {
+        TextWriter error(center_x, text_y, renderer, true, Layout::TitleFontSize);
+        error << Text("Choose a MIDI input device on the title screen first.", Gray);
+        return;
+    }
+
+    string instructions;
+    switch (m_phase) {
+        case PhaseVisual:
+            instructions = "Play any key on your keyboard each time the light flashes.";
+            break;
+
+        case PhaseAudio:
+            instructions = "Now play along with the clicks.  The light only shows the first few.";
+            break;
+
+        case PhaseDone:
+            instructions = "Press Enter to save these values, or Space to measure again.";
+            break;
+    }
+
+    TextWriter title(center_x, text_y, renderer, true, Layout::TitleFontSize);
+    title << instructions;
+
+    if (m_retrying) {
+        TextWriter retry(center_x, text_y + 30, renderer, true, Layout::ButtonFontSize);
+        retry << Text("Not enough taps were heard, let's try that again.", Renderer::ToColor(0xCE, 0x5C, 0x00));
+    }
+
+    if (m_phase == PhaseDone) {
+        const Color c = Renderer::ToColor(114, 159, 207);
+
+        TextWriter input(center_x, text_y + 80, renderer, true, Layout::TitleFontSize);
+        input << Text(STRING("Input latency: " << m_input_latency / 1000 << " ms"), c);
+
+        if (m_state.midi_out) {
+            TextWriter output(center_x, text_y + 110, renderer, true, Layout::TitleFontSize);
+            output << Text(STRING("Output latency: " << m_output_latency / 1000 << " ms"), c);
+        }
+    } else {
+        const static int LightSize = 120;
+        const int light_y = GetStateHeight() / 2 - LightSize / 2;
+
+        renderer.SetColor(0xFF, 0xFF, 0xFF);
+        renderer.DrawQuad(center_x - LightSize / 2, light_y, LightSize, LightSize);
+
+        if (IsBeatFlashing())
+            renderer.SetColor(0xFC, 0xAF, 0x3E);
+        else
+            renderer.SetColor(0, 0, 0);
+        renderer.DrawQuad(center_x - LightSize / 2 + 1, light_y + 1, LightSize - 2, LightSize - 2);
+
+        const int taps = static_cast<int>(m_offsets.size());
+        TextWriter progress(center_x, light_y + LightSize + 30, renderer, true, Layout::ButtonFontSize);
+        progress << Text(STRING(taps << " / " << MeasuredBeats << " taps"), Gray);
+    }
+
+    TextWriter tooltip(center_x,
+                       GetStateHeight() - Layout::ScreenMarginY / 2 - Layout::TitleFontSize / 2,
+                       renderer, true, Layout::TitleFontSize);
+
+    tooltip << m_tooltip;
+}
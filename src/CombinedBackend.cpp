@@ -0,0 +1,250 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include <string>
+#include <iostream>
+
+#include "CombinedBackend.h"
+
+using namespace std;
+
+CombinedBackend::CombinedBackend(const vector<MidiBackend *>& parts) :
+    m_parts(parts),
+    m_open(parts.size(), false),
+    m_output_part(0) {
+}
+
+CombinedBackend::~CombinedBackend() {
+
+    Close();
+
+    for (size_t i = 0; i < m_parts.size(); ++i)
+        delete m_parts[i];
+}
+
+string CombinedBackend::Open() {
+
+    // Fine as long as any part is
+    string error;
+    bool any_open = false;
+
+    for (size_t i = 0; i < m_parts.size(); ++i) {
+        const string msg = m_parts[i]->Open();
+        m_open[i] = msg.empty();
+
+        if (m_open[i])
+            any_open = true;
+        else {
+            cout << "[WARNING] " << msg << endl;
+            if (error.empty())
+                error = msg;
+        }
+    }
+
+    Merge();
+
+    if (any_open)
+        return "";
+
+    return error;
+}
+
+void CombinedBackend::Close() {
+
+    for (size_t i = 0; i < m_parts.size(); ++i) {
+        if (m_open[i])
+            m_parts[i]->Close();
+        m_open[i] = false;
+    }
+
+    m_output_part = 0;
+}
+
+MidiCommDescriptionList CombinedBackend::InputDevices() const {
+
+    return m_inputs;
+}
+
+MidiCommDescriptionList CombinedBackend::OutputDevices() const {
+
+    return m_outputs;
+}
+
+void CombinedBackend::Rescan() {
+
+    for (size_t i = 0; i < m_parts.size(); ++i) {
+        if (m_open[i])
+            m_parts[i]->Rescan();
+    }
+
+    Merge();
+}
+
+void CombinedBackend::Merge() {
+
+    m_inputs.clear();
+    m_outputs.clear();
+
+    for (size_t i = 0; i < m_parts.size(); ++i) {
+        if (!m_open[i])
+            continue;
+
+        const MidiCommDescriptionList inputs = m_parts[i]->InputDevices();
+        for (size_t j = 0; j < inputs.size(); ++j) {
+
+            // One PC keyboard is plenty
+            if (i > 0 && m_parts[i]->IsKeyboard(inputs[j]))
+                continue;
+
+            MidiCommDescription d = inputs[j];
+            d.id = static_cast<unsigned int>(m_inputs.size());
+            d.backend = static_cast<int>(i);
+            m_inputs.push_back(d);
+        }
+
+        const MidiCommDescriptionList outputs = m_parts[i]->OutputDevices();
+        for (size_t j = 0; j < outputs.size(); ++j) {
+            MidiCommDescription d = outputs[j];
+            d.id = static_cast<unsigned int>(m_outputs.size());
+            d.backend = static_cast<int>(i);
+            m_outputs.push_back(d);
+        }
+    }
+}
+
+MidiBackend *CombinedBackend::PartOf(const MidiCommDescription& device) const {
+
+    if (device.backend < 0 || device.backend >= static_cast<int>(m_parts.size()))
+        return 0;
+
+    if (!m_open[device.backend])
+        return 0;
+
+    return m_parts[device.backend];
+}
+
+bool CombinedBackend::IsKeyboard(const MidiCommDescription& device) const {
+
+    MidiBackend *part = PartOf(device);
+    return part && part->IsKeyboard(device);
+}
+
+string CombinedBackend::ConnectInput(const MidiCommDescription& device) {
+
+    MidiBackend *part = PartOf(device);
+    if (!part)
+        return "MIDI is not available";
+
+    return part->ConnectInput(device);
+}
+
+void CombinedBackend::DisconnectInput(const MidiCommDescription& device) {
+
+    MidiBackend *part = PartOf(device);
+    if (part)
+        part->DisconnectInput(device);
+}
+
+string CombinedBackend::ConnectOutput(const MidiCommDescription& device) {
+
+    MidiBackend *part = PartOf(device);
+    if (!part)
+        return "MIDI is not available";
+
+    const string error = part->ConnectOutput(device);
+    if (error.empty())
+        m_output_part = part;
+
+    return error;
+}
+
+void CombinedBackend::DisconnectOutput(const MidiCommDescription& device) {
+
+    MidiBackend *part = PartOf(device);
+    if (!part)
+        return;
+
+    part->DisconnectOutput(device);
+    if (part == m_output_part)
+        m_output_part = 0;
+}
+
+unsigned int CombinedBackend::ReadBatch(MidiBackendEventList& events) {
+
+    unsigned int result = MidiReadNothing;
+    for (size_t i = 0; i < m_parts.size(); ++i) {
+        if (m_open[i])
+            result |= m_parts[i]->ReadBatch(events);
+    }
+
+    // Only the sequencer announces devices.  A new USB piano shows up
+    // there and as a raw device, so look again everywhere.
+    if (result & (MidiReadDevicesChanged | MidiReadDeviceStarted)) {
+        Rescan();
+        result |= MidiReadDevicesChanged;
+    }
+
+    return result;
+}
+
+void CombinedBackend::DropInput() {
+
+    for (size_t i = 0; i < m_parts.size(); ++i) {
+        if (m_open[i])
+            m_parts[i]->DropInput();
+    }
+}
+
+void CombinedBackend::Write(const MidiEvent& out, microseconds_t delay_microseconds) {
+
+    if (m_output_part)
+        m_output_part->Write(out, delay_microseconds);
+}
+
+void CombinedBackend::Drain() {
+
+    for (size_t i = 0; i < m_parts.size(); ++i) {
+        if (m_open[i])
+            m_parts[i]->Drain();
+    }
+}
+
+void CombinedBackend::DropScheduled() {
+
+    for (size_t i = 0; i < m_parts.size(); ++i) {
+        if (m_open[i])
+            m_parts[i]->DropScheduled();
+    }
+}
+
+void CombinedBackend::KeyboardNote(unsigned char note, bool on, unsigned char velocity) {
+
+    for (size_t i = 0; i < m_parts.size(); ++i) {
+        if (m_open[i])
+            m_parts[i]->KeyboardNote(note, on, velocity);
+    }
+}
+
+vector<pollfd> CombinedBackend::PollDescriptors() const {
+
+    vector<pollfd> fds;
+    for (size_t i = 0; i < m_parts.size(); ++i) {
+        if (!m_open[i])
+            continue;
+
+        const vector<pollfd> part = m_parts[i]->PollDescriptors();
+        fds.insert(fds.end(), part.begin(), part.end());
+    }
+
+    return fds;
+}
+
+microseconds_t CombinedBackend::Now() const {
+
+    return m_parts.empty() ? 0 : m_parts[0]->Now();
+}
@@ -7,6 +7,7 @@
 // See COPYING for license information
 
 #include <sys/time.h>
+#include <time.h>
 #include <gtkmm.h>
 
 #include "MidiComm.h"
@@ -22,6 +23,12 @@ unsigned long GetMilliseconds() {
     return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
 }
 
+microseconds_t GetMicroseconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<microseconds_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
 void ShowError(const string& err) {
     Gtk::MessageDialog dialog(err, false, Gtk::MESSAGE_ERROR);
     dialog.run();
@@ -111,7 +111,10 @@ void DeviceTile::Draw(Renderer& renderer) const {
 
     // Draw mode text
     TextWriter mode(44, 49, renderer, false, 14);
-    if (m_device_list.size() == 0)
+    if (m_device_list.size() == 0 && !midiReady())
+        mode << "[Searching for devices...]";
+
+    else if (m_device_list.size() == 0)
         mode << "[No Devices Found]";
 
     else {
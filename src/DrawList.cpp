@@ -0,0 +1,129 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include "DrawList.h"
+#include "OSGraphics.h"
+
+using namespace std;
+
+DrawList::DrawList() :
+    m_texture(0) {
+
+    m_color[0] = m_color[1] = m_color[2] = m_color[3] = 0xFF;
+}
+
+DrawList::~DrawList() {
+
+    Clear();
+}
+
+void DrawList::SetColor(unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
+
+    m_color[0] = r;
+    m_color[1] = g;
+    m_color[2] = b;
+    m_color[3] = a;
+}
+
+void DrawList::SetTexture(unsigned int texture_id) {
+
+    m_texture = texture_id;
+}
+
+void DrawList::AddVertex(int x, int y, double u, double v) {
+
+    Vertex vertex;
+    vertex.x = x;
+    vertex.y = y;
+    vertex.u = static_cast<float>(u);
+    vertex.v = static_cast<float>(v);
+    vertex.r = m_color[0];
+    vertex.g = m_color[1];
+    vertex.b = m_color[2];
+    vertex.a = m_color[3];
+
+    m_vertices.push_back(vertex);
+}
+
+void DrawList::AddQuad(int x, int y, int w, int h, double tx, double ty, double tw, double th) {
+
+    // A quad with the texture of the last run goes on with it
+    if (m_runs.empty() || m_runs.back().command || m_runs.back().texture != m_texture) {
+        Run run;
+        run.texture = m_texture;
+        run.first = m_vertices.size();
+        run.count = 0;
+        run.command = 0;
+        m_runs.push_back(run);
+    }
+
+    // Corners in the order glBegin(GL_QUADS) got them
+    AddVertex(x, y, tx, ty);
+    AddVertex(x, y + h, tx, ty + th);
+    AddVertex(x + w, y + h, tx + tw, ty + th);
+    AddVertex(x + w, y, tx + tw, ty);
+
+    m_runs.back().count += 4;
+}
+
+void DrawList::AddCommand(DrawCommand *command) {
+
+    Run run;
+    run.texture = 0;
+    run.first = 0;
+    run.count = 0;
+    run.command = command;
+    m_runs.push_back(run);
+}
+
+void DrawList::Hold(shared_ptr<void> resource) {
+
+    m_held.push_back(resource);
+}
+
+void DrawList::Submit() const {
+
+    for (vector<Run>::const_iterator i = m_runs.begin(); i != m_runs.end(); ++i) {
+        if (i->command) {
+            i->command->Submit();
+            continue;
+        }
+
+        // Commands bind textures and buffers of their own, so nothing is
+        // left enabled in between
+        glBindTexture(GL_TEXTURE_2D, i->texture);
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+
+        glVertexPointer(2, GL_INT, sizeof(Vertex), &m_vertices[0].x);
+        glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), &m_vertices[0].u);
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), &m_vertices[0].r);
+
+        glDrawArrays(GL_QUADS, static_cast<GLint>(i->first), static_cast<GLsizei>(i->count));
+
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+}
+
+void DrawList::Clear() {
+
+    for (vector<Run>::iterator i = m_runs.begin(); i != m_runs.end(); ++i)
+        delete i->command;
+
+    // The memory stays for the next frame
+    m_runs.clear();
+    m_vertices.clear();
+    m_held.clear();
+
+    m_texture = 0;
+    m_color[0] = m_color[1] = m_color[2] = m_color[3] = 0xFF;
+}
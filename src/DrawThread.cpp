@@ -0,0 +1,94 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include "DrawThread.h"
+#include "GameState.h"
+
+using namespace std;
+
+DrawThread::DrawThread() :
+    m_manager(0),
+    m_renderer(0),
+    m_recording(false),
+    m_should_exit(false),
+    m_thread(&DrawThread::run, this) {
+}
+
+DrawThread::~DrawThread() {
+
+    {
+        unique_lock<mutex> lock(m_mutex);
+        while (m_recording)
+            m_changed.wait(lock);
+
+        m_should_exit = true;
+    }
+
+    m_changed.notify_all();
+    m_thread.join();
+}
+
+void DrawThread::Record(GameStateManager *manager, const Renderer& renderer) {
+
+    Wait();
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_manager = manager;
+        m_renderer = new Renderer(renderer);
+        m_recording = true;
+    }
+
+    m_changed.notify_all();
+}
+
+void DrawThread::Wait() {
+
+    unique_lock<mutex> lock(m_mutex);
+    while (m_recording)
+        m_changed.wait(lock);
+
+    if (m_error) {
+        exception_ptr error = m_error;
+        m_error = exception_ptr();
+        rethrow_exception(error);
+    }
+}
+
+void DrawThread::run() {
+
+    unique_lock<mutex> lock(m_mutex);
+    while (true) {
+        while (!m_recording && !m_should_exit)
+            m_changed.wait(lock);
+
+        if (m_should_exit)
+            return;
+
+        // Nobody else touches these until m_recording is cleared
+        GameStateManager *manager = m_manager;
+        Renderer *renderer = m_renderer;
+        lock.unlock();
+
+        exception_ptr error;
+        try {
+            manager->Draw(*renderer);
+        }
+        catch (...) {
+            error = current_exception();
+        }
+
+        delete renderer;
+
+        lock.lock();
+        m_renderer = 0;
+        m_error = error;
+        m_recording = false;
+        m_changed.notify_all();
+    }
+}
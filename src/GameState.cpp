@@ -6,10 +6,20 @@
 // Adaptation to GNU/Linux by Oscar Aceña
 // See COPYING for license information
 
+#include <thread>
+#include <vector>
+#include <algorithm>
+
 #include "GameState.h"
 
-// For FPS display
+// For FPS and MIDI statistics display
 #include "TextWriter.h"
+#include "MidiStats.h"
+
+// Set up by PrepareDrawing()
+#include "GlyphCache.h"
+#include "LayerCache.h"
+#include "NoteBuffer.h"
 
 using namespace std;
 
@@ -48,6 +58,82 @@ const static char *TextureResourceNames[_TextureEnumCount] = {
     "play_KeysBlack"
 };
 
+// Whether a texture is drawn with smoothing (it is stretched), which picks
+// its atlas.  Same order again.
+const static bool TextureSmooth[_TextureEnumCount] = {
+
+    false, false, false,
+    false, false, false, false, false,
+    false, false, false,
+    false,
+    false,
+    false, false, false,
+
+    true, true, true, true,
+
+    false, false, true
+};
+
+// Every step-th texture from first on.  What is thrown goes to error, for
+// the main thread to throw again.
+static void decodeEvery(size_t first, size_t step, vector<TgaImage> *images, exception_ptr *error) {
+
+    try {
+        for (size_t i = first; i < images->size(); i += step)
+            (*images)[i] = Tga::Decode(TextureResourceNames[i]);
+    }
+    catch (...) {
+        *error = current_exception();
+    }
+}
+
+// Decoding doesn't need the OpenGL context, so every texture file is read
+// and decoded on a few threads at once.  images is in Texture order.
+static void decodeTextures(vector<TgaImage>& images) {
+
+    images.assign(_TextureEnumCount, TgaImage());
+
+    const unsigned int thread_count = max(1u, min(thread::hardware_concurrency(),
+                                                  static_cast<unsigned int>(_TextureEnumCount)));
+
+    vector<exception_ptr> errors(thread_count);
+    vector<thread> threads;
+    for (unsigned int t = 0; t < thread_count; ++t)
+        threads.push_back(thread(decodeEvery, t, thread_count, &images, &errors[t]));
+
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+
+    for (size_t t = 0; t < errors.size(); ++t)
+        if (errors[t])
+            rethrow_exception(errors[t]);
+}
+
+// The screen, cleared, with (0, 0) at its top left corner
+class StartFrame : public DrawCommand {
+  public:
+
+    StartFrame(int height) :
+        m_height(height) {
+    }
+
+    void Submit() {
+
+        const static float gray = 64.0f / 255.0f;
+        glClearColor(gray, gray, gray, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glMatrixMode(GL_MODELVIEW);
+        glLoadIdentity();
+        glTranslatef(0., static_cast<GLfloat>(m_height), 0.);
+        glScalef(1., -1., 1.);
+        glTranslatef(0.375, 0.375, 0.);
+    }
+
+  private:
+    int m_height;
+};
+
 Tga *GameState::GetTexture(Texture tex_name, bool smooth) const {
 
     if (!m_manager)
@@ -107,19 +193,87 @@ void GameState::SetManager(GameStateManager *manager) {
 
 GameStateManager::~GameStateManager() {
 
+    // E.g. the StatsState a song ends with, when nobody updates any more
+    delete m_next_state;
+    delete m_current_state;
+
     for (map<Texture, Tga *>::iterator i = m_textures.begin();
          i != m_textures.end(); ++i) {
 
         if (i->second) Tga::Release(i->second);
         i->second = 0;
     }
+
+    delete m_atlases[0];
+    delete m_atlases[1];
+}
+
+void GameStateManager::BuildAtlases() const {
+
+    m_atlases_built = true;
+
+    // Only the uploads are left for this thread
+    vector<TgaImage> images;
+    decodeTextures(images);
+
+    for (int smooth = 0; smooth < 2; ++smooth) {
+
+        TextureAtlas *atlas = new TextureAtlas();
+        map<Texture, size_t> indices;
+
+        for (int i = 0; i < _TextureEnumCount; ++i) {
+            if (TextureSmooth[i] != (smooth == 1))
+                continue;
+
+            indices[static_cast<Texture>(i)] = atlas->Add(images[i]);
+        }
+
+        // Those textures are uploaded on their own, filtered once here.
+        // If that fails too, GetTexture() tries again and tells.
+        if (!atlas->Build(smooth == 1)) {
+            delete atlas;
+
+            for (map<Texture, size_t>::const_iterator i = indices.begin(); i != indices.end(); ++i) {
+                Tga *texture = Tga::Upload(images[i->first]);
+                if (!texture)
+                    continue;
+
+                texture->SetSmooth(smooth == 1);
+                m_textures[i->first] = texture;
+            }
+
+            continue;
+        }
+
+        m_atlases[smooth] = atlas;
+        for (map<Texture, size_t>::const_iterator i = indices.begin(); i != indices.end(); ++i)
+            m_atlas_textures[i->first] = atlas->Get(i->second);
+    }
+}
+
+void GameStateManager::PrepareDrawing() {
+
+    for (int i = 0; i < _TextureEnumCount; ++i)
+        GetTexture(static_cast<Texture>(i), TextureSmooth[i]);
+
+    glyphCache().CreateTexture();
+    TextWriter::DefaultFont();
+    LayerCache::Available();
+    NoteBuffer::Available();
 }
 
 Tga *GameStateManager::GetTexture(Texture tex_name, bool smooth) const {
 
+    if (!m_atlases_built)
+        BuildAtlases();
+
+    if (smooth == TextureSmooth[tex_name] && m_atlas_textures[tex_name])
+        return m_atlas_textures[tex_name];
+
     if (!m_textures[tex_name])
         m_textures[tex_name] = Tga::Load(TextureResourceNames[tex_name]);
 
+    // Only touches OpenGL when the filtering changes
     m_textures[tex_name]->SetSmooth(smooth);
     return m_textures[tex_name];
 }
@@ -202,10 +356,23 @@ void GameStateManager::ChangeState(GameState *new_state) {
     m_next_state = new_state;
 }
 
+void GameStateManager::SetFixedFrameRate(unsigned int frames_per_second) {
+
+    m_fixed_frame_rate = frames_per_second;
+    m_fixed_frames = 0;
+    m_last_milliseconds = 0;
+}
+
 void GameStateManager::Update(bool skip_this_update) {
 
     // Manager's timer grows constantly
-    const unsigned long now = Compatible::GetMilliseconds();
+    unsigned long now = Compatible::GetMilliseconds();
+
+    // Frame n is at n / rate seconds, rounded down to a millisecond so
+    // the rounding doesn't add up
+    if (m_fixed_frame_rate > 0)
+        now = static_cast<unsigned long>(m_fixed_frames++ * 1000 / m_fixed_frame_rate);
+
     const unsigned long delta = now - m_last_milliseconds;
     m_last_milliseconds = now;
 
@@ -218,6 +385,13 @@ void GameStateManager::Update(bool skip_this_update) {
     if (IsKeyReleased(KeyF6))
         m_show_fps = !m_show_fps;
 
+    if (IsKeyReleased(KeyF7))
+        m_show_midi_stats = !m_show_midi_stats;
+
+    // MIDI input goes on while Draw() runs, this is what it shows
+    if (m_show_midi_stats)
+        m_midi_summary = midiStats().Summary();
+
     if (m_next_state && m_current_state) {
 
         delete m_current_state;
@@ -257,6 +431,15 @@ void GameStateManager::Update(bool skip_this_update) {
     m_mouse.released = MouseButtons();
 }
 
+bool GameStateManager::IsAnimating() const {
+
+    // A state change or the FPS and MIDI displays need to keep going
+    if (m_next_state || !m_current_state || m_show_fps || m_show_midi_stats)
+        return true;
+
+    return m_current_state->IsAnimating();
+}
+
 void GameStateManager::Draw(Renderer& renderer) {
 
     if (!m_current_state)
@@ -266,16 +449,7 @@ void GameStateManager::Draw(Renderer& renderer) {
     // the previous state *and* the current state during some transition
     // would be really easy.
 
-    const static float gray = 64.0f / 255.0f;
-    glClearColor(gray, gray, gray, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    glTranslatef(0., static_cast<GLfloat>(GetStateHeight()), 0.);
-    glScalef(1., -1., 1.);
-    glTranslatef(0.375, 0.375, 0.);
-
+    renderer.AddCommand(new StartFrame(GetStateHeight()));
     m_current_state->Draw(renderer);
 
     if (m_show_fps) {
@@ -284,7 +458,9 @@ void GameStateManager::Draw(Renderer& renderer) {
                    Text(STRING(setprecision(6) << m_fps.GetFramesPerSecond()), White);
     }
 
-    glFlush();
-    renderer.SwapBuffers();
+    if (m_show_midi_stats) {
+        TextWriter midi_writer(0, 16, renderer);
+        midi_writer << Text(m_midi_summary, White);
+    }
 }
 
@@ -0,0 +1,377 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include <algorithm>
+
+#include "GlyphCache.h"
+
+using namespace std;
+
+// Glyphs are drawn 1:1, this is plenty for a few fonts and sizes
+const static unsigned int AtlasSize = 1024;
+
+// Around every glyph, room for its halo
+const static int GlyphPadding = 1;
+
+// Between glyphs in the atlas
+const static unsigned int GlyphGap = 1;
+
+// Where DrawQuad() finds some white (see Renderer::SetSolidTexel)
+const static unsigned int SolidSize = 4;
+
+// Changing text (a score, a clock) makes a new layout each frame, so the
+// layouts are dropped once there are this many
+const static size_t MaxLayouts = 2048;
+
+bool GlyphCache::TextKey::operator<(const TextKey& rhs) const {
+
+    if (size != rhs.size)
+        return size < rhs.size;
+    if (font != rhs.font)
+        return font < rhs.font;
+    return text < rhs.text;
+}
+
+// Coverage of one glyph, width x height bytes from the top left corner at
+// (left, top) of the pen position
+static vector<unsigned char> rasterise(PangoFont *font, PangoGlyph index, unsigned int width,
+                                       unsigned int height, int left, int top) {
+
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_A8, width, height);
+    cairo_t *cr = cairo_create(surface);
+
+    cairo_set_scaled_font(cr, pango_cairo_font_get_scaled_font(PANGO_CAIRO_FONT(font)));
+
+    cairo_glyph_t glyph;
+    glyph.index = index;
+    glyph.x = -left;
+    glyph.y = -top;
+    cairo_show_glyphs(cr, &glyph, 1);
+
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+
+    const unsigned char *data = cairo_image_surface_get_data(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+
+    vector<unsigned char> coverage(width * height);
+    for (unsigned int row = 0; row < height; ++row)
+        copy(data + row * stride, data + row * stride + width, coverage.begin() + row * width);
+
+    cairo_surface_destroy(surface);
+    return coverage;
+}
+
+// Every pixel takes the strongest of its neighbours, which is what drawing
+// the glyph one pixel off in every direction used to do
+static vector<unsigned char> dilate(const vector<unsigned char>& coverage,
+                                    unsigned int width, unsigned int height) {
+
+    vector<unsigned char> halo(coverage.size(), 0);
+    for (unsigned int y = 0; y < height; ++y) {
+        for (unsigned int x = 0; x < width; ++x) {
+
+            unsigned char strongest = 0;
+            for (unsigned int ny = (y > 0 ? y - 1 : 0); ny <= min(y + 1, height - 1); ++ny)
+                for (unsigned int nx = (x > 0 ? x - 1 : 0); nx <= min(x + 1, width - 1); ++nx)
+                    strongest = max(strongest, coverage[ny * width + nx]);
+
+            halo[y * width + x] = strongest;
+        }
+    }
+
+    return halo;
+}
+
+// A new glyph, copied into the atlas in order with the quads around it
+class UploadGlyph : public DrawCommand {
+  public:
+
+    // Takes the contents of rows
+    UploadGlyph(TextureId texture_id, unsigned int x, unsigned int y, unsigned int width,
+                unsigned int height, vector<unsigned char>& rows) :
+        m_texture_id(texture_id),
+        m_x(x),
+        m_y(y),
+        m_width(width),
+        m_height(height) {
+
+        m_rows.swap(rows);
+    }
+
+    void Submit() {
+
+        glBindTexture(GL_TEXTURE_2D, m_texture_id);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, m_x, m_y, m_width, m_height,
+                        GL_ALPHA, GL_UNSIGNED_BYTE, &m_rows[0]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+  private:
+    TextureId m_texture_id;
+    unsigned int m_x;
+    unsigned int m_y;
+    unsigned int m_width;
+    unsigned int m_height;
+    vector<unsigned char> m_rows;
+};
+
+GlyphCache::GlyphCache() :
+    m_context(0),
+    m_layout(0),
+    m_texture_id(0),
+    m_shelf_x(0),
+    m_shelf_y(0),
+    m_shelf_height(0),
+    m_full(false) {
+}
+
+GlyphCache::~GlyphCache() {
+
+    Clear();
+
+    for (map<pair<string, int>, PangoFontDescription *>::iterator i = m_fonts.begin();
+         i != m_fonts.end(); ++i)
+        pango_font_description_free(i->second);
+
+    if (m_layout)
+        g_object_unref(m_layout);
+    if (m_context)
+        g_object_unref(m_context);
+
+    // There may be no OpenGL context anymore, the texture goes with it
+}
+
+void GlyphCache::CreateTexture() {
+
+    if (m_texture_id)
+        return;
+
+    glGenTextures(1, &m_texture_id);
+    glBindTexture(GL_TEXTURE_2D, m_texture_id);
+
+    // Only coverage, the color comes with the quads
+    vector<unsigned char> empty(AtlasSize * AtlasSize, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, AtlasSize, AtlasSize, 0,
+                 GL_ALPHA, GL_UNSIGNED_BYTE, &empty[0]);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Text and the boxes behind it stay in one batch
+    vector<unsigned char> solid(SolidSize * SolidSize, 0xFF);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, SolidSize, SolidSize,
+                    GL_ALPHA, GL_UNSIGNED_BYTE, &solid[0]);
+    Renderer::SetSolidTexel(m_texture_id, (SolidSize / 2.0) / AtlasSize, (SolidSize / 2.0) / AtlasSize);
+
+    m_shelf_x = SolidSize + GlyphGap;
+    m_shelf_height = SolidSize;
+}
+
+const TextLayout& GlyphCache::Layout(Renderer& renderer, const string& font, int size,
+                                     const string& text, bool halos) {
+
+    TextKey key;
+    key.font = font;
+    key.size = size;
+    key.text = text;
+
+    for (int attempt = 0; ; ++attempt) {
+
+        map<TextKey, TextLayout>::iterator found = m_layouts.find(key);
+        if (found == m_layouts.end()) {
+            if (m_layouts.size() >= MaxLayouts)
+                m_layouts.clear();
+
+            found = m_layouts.insert(make_pair(key, TextLayout())).first;
+            Shape(renderer, key, found->second);
+        }
+
+        TextLayout& layout = found->second;
+        if (halos) {
+            for (size_t i = 0; i < layout.glyphs.size(); ++i)
+                AddHalo(renderer, layout.glyphs[i].glyph);
+        }
+
+        // With an empty atlas, whatever still doesn't fit is left out.
+        // Quads recorded so far are submitted before the glyphs replacing
+        // theirs are uploaded.
+        if (!m_full || attempt > 0)
+            return layout;
+
+        Clear();
+    }
+}
+
+void GlyphCache::Shape(Renderer& renderer, const TextKey& key, TextLayout& layout) {
+
+    if (!m_context) {
+        m_context = pango_font_map_create_context(pango_cairo_font_map_get_default());
+        m_layout = pango_layout_new(m_context);
+    }
+
+    PangoFontDescription *&description = m_fonts[make_pair(key.font, key.size)];
+    if (!description) {
+        description = pango_font_description_from_string(key.font.c_str());
+        pango_font_description_set_size(description, key.size * PANGO_SCALE);
+    }
+
+    pango_layout_set_font_description(m_layout, description);
+    pango_layout_set_text(m_layout, key.text.c_str(), -1);
+
+    PangoRectangle logical;
+    pango_layout_get_pixel_extents(m_layout, 0, &logical);
+    layout.width = logical.width;
+    layout.height = logical.height;
+    layout.glyphs.clear();
+
+    PangoLayoutIter *iter = pango_layout_get_iter(m_layout);
+    do {
+        PangoLayoutRun *run = pango_layout_iter_get_run_readonly(iter);
+
+        // The end of a line
+        if (!run)
+            continue;
+
+        PangoRectangle run_logical;
+        pango_layout_iter_get_run_extents(iter, 0, &run_logical);
+        const int baseline = pango_layout_iter_get_baseline(iter);
+
+        int pen_x = run_logical.x;
+        for (int i = 0; i < run->glyphs->num_glyphs; ++i) {
+            const PangoGlyphInfo& info = run->glyphs->glyphs[i];
+
+            // Missing from every font, Pango would draw a box
+            if (info.glyph != PANGO_GLYPH_EMPTY && !(info.glyph & PANGO_GLYPH_UNKNOWN_FLAG)) {
+                PlacedGlyph placed;
+                placed.glyph = Glyph(renderer, run->item->analysis.font, info.glyph);
+                placed.x = PANGO_PIXELS(pen_x + info.geometry.x_offset);
+                placed.y = PANGO_PIXELS(baseline + info.geometry.y_offset);
+
+                if (placed.glyph->image)
+                    layout.glyphs.push_back(placed);
+            }
+
+            pen_x += info.geometry.width;
+        }
+    } while (pango_layout_iter_next_run(iter));
+
+    pango_layout_iter_free(iter);
+}
+
+CachedGlyph *GlyphCache::Glyph(Renderer& renderer, PangoFont *font, PangoGlyph index) {
+
+    GlyphKey key(font, index);
+    map<GlyphKey, CachedGlyph>::iterator found = m_glyphs.find(key);
+    if (found != m_glyphs.end())
+        return &found->second;
+
+    CachedGlyph& glyph = m_glyphs[key];
+    glyph.image = 0;
+    glyph.halo = 0;
+    glyph.left = 0;
+    glyph.top = 0;
+    glyph.font = font;
+    glyph.index = index;
+
+    // The key holds on to the font
+    g_object_ref(font);
+
+    PangoRectangle ink;
+    pango_font_get_glyph_extents(font, index, &ink, 0);
+    pango_extents_to_pixels(&ink, 0);
+
+    if (ink.width <= 0 || ink.height <= 0)
+        return &glyph;
+
+    glyph.left = ink.x - GlyphPadding;
+    glyph.top = ink.y - GlyphPadding;
+
+    const unsigned int width = ink.width + 2 * GlyphPadding;
+    const unsigned int height = ink.height + 2 * GlyphPadding;
+    glyph.image = Store(renderer, rasterise(font, index, width, height, glyph.left, glyph.top), width, height);
+
+    return &glyph;
+}
+
+void GlyphCache::AddHalo(Renderer& renderer, CachedGlyph *glyph) {
+
+    if (glyph->halo || !glyph->image)
+        return;
+
+    const unsigned int width = glyph->image->GetWidth();
+    const unsigned int height = glyph->image->GetHeight();
+
+    vector<unsigned char> coverage = rasterise(glyph->font, glyph->index, width, height,
+                                               glyph->left, glyph->top);
+    glyph->halo = Store(renderer, dilate(coverage, width, height), width, height);
+}
+
+Tga *GlyphCache::Store(Renderer& renderer, const vector<unsigned char>& coverage,
+                       unsigned int width, unsigned int height) {
+
+    // No texture to put it in, see CreateTexture()
+    if (!m_texture_id)
+        return 0;
+
+    if (m_shelf_x + width > AtlasSize) {
+        m_shelf_x = 0;
+        m_shelf_y += m_shelf_height + GlyphGap;
+        m_shelf_height = 0;
+    }
+
+    if (width > AtlasSize || m_shelf_y + height > AtlasSize) {
+        m_full = true;
+        return 0;
+    }
+
+    // Rows go bottom-up in the atlas, as in a Tga
+    vector<unsigned char> rows(coverage.size());
+    for (unsigned int row = 0; row < height; ++row)
+        copy(coverage.begin() + row * width, coverage.begin() + (row + 1) * width,
+             rows.begin() + (height - 1 - row) * width);
+
+    renderer.AddCommand(new UploadGlyph(m_texture_id, m_shelf_x, m_shelf_y, width, height, rows));
+
+    Tga *region = Tga::Region(m_texture_id, AtlasSize, AtlasSize, m_shelf_x, m_shelf_y, width, height);
+
+    m_shelf_x += width + GlyphGap;
+    m_shelf_height = max(m_shelf_height, height);
+
+    return region;
+}
+
+void GlyphCache::Clear() {
+
+    m_layouts.clear();
+
+    for (map<GlyphKey, CachedGlyph>::iterator i = m_glyphs.begin(); i != m_glyphs.end(); ++i) {
+        if (i->second.image)
+            Tga::Release(i->second.image);
+        if (i->second.halo)
+            Tga::Release(i->second.halo);
+
+        g_object_unref(i->first.first);
+    }
+    m_glyphs.clear();
+
+    // The solid patch stays where it is
+    m_shelf_x = SolidSize + GlyphGap;
+    m_shelf_y = 0;
+    m_shelf_height = SolidSize;
+    m_full = false;
+}
+
+GlyphCache& glyphCache() {
+
+    static GlyphCache cache;
+    return cache;
+}
@@ -6,11 +6,31 @@
 // Adaptation to GNU/Linux by Oscar Aceña
 // See COPYING for license information
 
+#include <algorithm>
+#include <limits>
+
 #include "KeyboardDisplay.h"
 #include "LinthesiaError.h"
 
 using namespace std;
 
+// Shiny music domain knowledge
+const static unsigned int NotesPerOctave = 12;
+const static unsigned int WhiteNotesPerOctave = 7;
+const static bool IsBlackNote[12] = {false, true, false, true, false, false,
+                                     true, false, true, false, true, false};
+
+// The note of a white key, from its name ('A' to 'G') and octave as
+// MidiEvent::NoteName() has them
+static NoteId keyNoteId(char white, int octave) {
+
+    const static int WhiteNoteOffsets[7] = {9, 11, 0, 2, 4, 5, 7};
+    return static_cast<NoteId>(octave * NotesPerOctave + WhiteNoteOffsets[white - 'A']);
+}
+
+// Between the note field and the keys
+const static int PixelsOffKeyboard = 2;
+
 const KeyboardDisplay::NoteTexDimensions KeyboardDisplay::WhiteNoteDimensions = {32, 128, 4, 25, 22, 28, 93, 100};
 const KeyboardDisplay::NoteTexDimensions KeyboardDisplay::BlackNoteDimensions = {32, 64, 8, 20, 3, 8, 49, 55};
 
@@ -30,11 +50,20 @@ const KeyboardDisplay::KeyTexDimensions KeyboardDisplay::BlackKeyDimensions = {3
 KeyboardDisplay::KeyboardDisplay(KeyboardSize size, int pixelWidth, int pixelHeight) :
     m_size(size),
     m_width(pixelWidth),
-    m_height(pixelHeight) {
+    m_height(pixelHeight),
+    m_notes_reset(true) {
+
+    for (NoteId note = 0; note < KeyCount; ++note) {
+        m_note_lanes[note].left = 0;
+        m_note_lanes[note].black = IsBlackNote[note % NotesPerOctave];
+    }
+
+    ResetActiveKeys();
 }
 
 void KeyboardDisplay::Draw(Renderer& renderer, const Tga *key_tex[3], const Tga *note_tex[4], int x, int y,
-                           const TranslatedNoteSet& notes, microseconds_t show_duration, microseconds_t current_time,
+                           const TranslatedNoteSet& notes, microseconds_t longest_note,
+                           microseconds_t show_duration, microseconds_t current_time,
                            const vector<Track::Properties>& track_properties,
                            const MidiEventMicrosecondList& bar_line_usecs) {
 
@@ -72,35 +101,71 @@ void KeyboardDisplay::Draw(Renderer& renderer, const Tga *key_tex[3], const Tga
     // Symbolic names for the arbitrary array passed in here
     enum { Rail, Shadow, BlackKey };
 
-    // Draw background for falling notes
-    DrawGuides(renderer, white_key_count, white_width, white_space, x + x_offset, y, y_offset);
+    const int ActualKeyboardWidth = white_width * white_key_count + white_space * (white_key_count - 1);
+
+    // Draw background for falling notes.  It only changes with the size.
+    if (m_guides_layer.Begin(renderer, x + x_offset, y, ActualKeyboardWidth, y_offset - PixelsOffKeyboard)) {
+        DrawGuides(renderer, white_key_count, white_width, white_space, x + x_offset, y, y_offset);
+        m_guides_layer.End(renderer);
+    }
+    m_guides_layer.Draw(renderer);
 
     // Draw tempo bars
     DrawBars(renderer, x + x_offset, y, y_offset, y_roll_under, final_width,
              show_duration, current_time, bar_line_usecs);
 
+    if (NoteBuffer::Available())
+        UpdateNoteBuffer(renderer, notes, track_properties, white_width, white_space, black_width,
+                         black_offset, x + x_offset);
+
     // Do two passes on the notes, the first for note shadows and the second
     // for the note blocks themselves.  This is to avoid shadows being drawn
     // on top of notes.
     renderer.SetColor(Renderer::ToColor(255, 255, 255));
-    DrawNotePass(renderer, note_tex[0], note_tex[1], white_width, white_space, black_width,
-                 black_offset, x + x_offset, y, y_offset, y_roll_under, notes, show_duration,
-                 current_time, track_properties);
+    if (m_note_buffer.IsBuilt()) {
+        const double scaling_factor = static_cast<double>(y_offset) / static_cast<double>(show_duration);
+        const long long roll_under = static_cast<int>(y_roll_under / scaling_factor);
 
-    DrawNotePass(renderer, note_tex[2], note_tex[3], white_width, white_space, black_width,
-                 black_offset, x + x_offset, y, y_offset, y_roll_under, notes, show_duration,
-                 current_time, track_properties);
+        m_note_buffer.Draw(renderer, note_tex[0], note_tex[1], current_time, longest_note, show_duration,
+                           scaling_factor, roll_under, y + y_offset);
+        m_note_buffer.Draw(renderer, note_tex[2], note_tex[3], current_time, longest_note, show_duration,
+                           scaling_factor, roll_under, y + y_offset);
+    } else {
+        GatherVisibleNotes(notes, longest_note, show_duration, current_time, track_properties);
 
-    const int ActualKeyboardWidth = white_width * white_key_count + white_space * (white_key_count - 1);
+        DrawNotePass(renderer, note_tex[0], note_tex[1], white_width, white_space, black_width,
+                     black_offset, x + x_offset, y, y_offset, y_roll_under, show_duration,
+                     current_time, track_properties);
 
-    // Black out the background of where the keys are about to appear
-    renderer.SetColor(Renderer::ToColor(0, 0, 0));
-    renderer.DrawQuad(x + x_offset, y + y_offset, ActualKeyboardWidth, white_height);
+        DrawNotePass(renderer, note_tex[2], note_tex[3], white_width, white_space, black_width,
+                     black_offset, x + x_offset, y, y_offset, y_roll_under, show_duration,
+                     current_time, track_properties);
+    }
+
+    // The keys at rest are cached, the ones lit up are drawn over them
+    if (m_keys_layer.Begin(renderer, x + x_offset, y + y_offset, ActualKeyboardWidth, white_height)) {
+        // Black out the background of where the keys are about to appear
+        renderer.SetColor(Renderer::ToColor(0, 0, 0));
+        renderer.DrawQuad(x + x_offset, y + y_offset, ActualKeyboardWidth, white_height);
+
+        DrawWhiteKeys(renderer, KeysAtRest, white_key_count, white_width, white_height, white_space, x + x_offset, y + y_offset);
+        DrawBlackKeys(renderer, key_tex[BlackKey], KeysAtRest, white_key_count, white_width,
+                      black_width, black_height, white_space, x + x_offset, y + y_offset, black_offset);
+
+        m_keys_layer.End(renderer);
+    }
+    m_keys_layer.Draw(renderer);
+
+    if (m_active_count > 0) {
+        DrawWhiteKeys(renderer, KeysActiveOnly, white_key_count, white_width, white_height, white_space, x + x_offset, y + y_offset);
+
+        // A lit white key covers the black ones next to it
+        DrawBlackKeys(renderer, key_tex[BlackKey], (m_active_white_count > 0 ? KeysAll : KeysActiveOnly),
+                      white_key_count, white_width, black_width, black_height, white_space,
+                      x + x_offset, y + y_offset, black_offset);
+    }
 
     DrawShadow(renderer, key_tex[Shadow], x + x_offset, y + y_offset + white_height - 10, ActualKeyboardWidth);
-    DrawWhiteKeys(renderer, false, white_key_count, white_width, white_height, white_space, x + x_offset, y + y_offset);
-    DrawBlackKeys(renderer, key_tex[BlackKey], false, white_key_count, white_width,
-                  black_width, black_height, white_space, x + x_offset, y + y_offset, black_offset);
     DrawShadow(renderer, key_tex[Shadow], x + x_offset, y + y_offset, ActualKeyboardWidth);
     DrawRail(renderer, key_tex[Rail], x + x_offset, y + y_offset, ActualKeyboardWidth);
 
@@ -166,7 +231,7 @@ int KeyboardDisplay::GetWhiteKeyCount() const {
     }
 }
 
-void KeyboardDisplay::DrawWhiteKeys(Renderer& renderer, bool active_only, int key_count, int key_width, int key_height,
+void KeyboardDisplay::DrawWhiteKeys(Renderer& renderer, KeyFilter filter, int key_count, int key_width, int key_height,
                                     int key_space, int x_offset, int y_offset) const {
     Color white = Renderer::ToColor(255, 255, 255);
 
@@ -175,16 +240,14 @@ void KeyboardDisplay::DrawWhiteKeys(Renderer& renderer, bool active_only, int ke
     for (int i = 0; i < key_count; ++i) {
 
         // Check to see if this is one of the active notes
-        const string note_name = STRING(current_white << current_octave);
-
-        KeyNames::const_iterator find_result = m_active_keys.find(note_name);
-        bool active = (find_result != m_active_keys.end());
+        const KeyState& key = m_keys[keyNoteId(current_white, current_octave)];
+        bool active = (key.active && filter != KeysAtRest);
 
         Color c = white;
         if (active)
-            c = Track::ColorNoteWhite[find_result->second];
+            c = Track::ColorNoteWhite[key.color];
 
-        if ((active_only && active) || !active_only) {
+        if (active || filter != KeysActiveOnly) {
             renderer.SetColor(c);
 
             const int key_x = i * (key_width + key_space) + x_offset;
@@ -228,7 +291,7 @@ void KeyboardDisplay::DrawBlackKey(Renderer& renderer, const Tga *tex, const Key
     renderer.DrawStretchedTga(tex, dest_x, dest_y, dest_w, dest_h, src_x, 0, d.tex_width, d.tex_height);
 }
 
-void KeyboardDisplay::DrawBlackKeys(Renderer& renderer, const Tga *tex, bool active_only, int white_key_count,
+void KeyboardDisplay::DrawBlackKeys(Renderer& renderer, const Tga *tex, KeyFilter filter, int white_key_count,
                                     int white_width, int black_width, int black_height, int key_space,
                                     int x_offset, int y_offset, int black_offset) const {
 
@@ -246,19 +309,17 @@ void KeyboardDisplay::DrawBlackKeys(Renderer& renderer, const Tga *tex, bool act
             case 'F':
             case 'G': {
                 // Check to see if this is one of the active notes
-                const string note_name = STRING(current_white << '#' << current_octave);
-
-                KeyNames::const_iterator find_result = m_active_keys.find(note_name);
-                bool active = (find_result != m_active_keys.end());
+                const KeyState& key = m_keys[keyNoteId(current_white, current_octave) + 1];
+                bool active = (key.active && filter != KeysAtRest);
 
                 // In this case, MissedNote isn't actually MissedNote.  In the black key
                 // texture we use this value (which doesn't make any sense in this context)
                 // as the default "Black" color.
                 Track::TrackColor c = Track::MissedNote;
                 if (active)
-                    c = find_result->second;
+                    c = key.color;
 
-                if (!active_only || (active_only && active)) {
+                if (active || filter != KeysActiveOnly) {
                     const int start_x = i * (white_width + key_space) + x_offset + black_offset;
                     DrawBlackKey(renderer, tex, BlackKeyDimensions, start_x, y_offset, black_width, black_height, c);
                 }
@@ -294,11 +355,9 @@ void KeyboardDisplay::DrawShadow(Renderer& renderer, const Tga *tex, int x, int
 void KeyboardDisplay::DrawGuides(Renderer& renderer, int key_count, int key_width, int key_space,
                                  int x_offset, int y, int y_offset) const {
 
-    const static int PixelsOffKeyboard = 2;
     int keyboard_width = key_width * key_count + key_space * (key_count - 1);
 
     // Fill the background of the note-falling area
-    renderer.ForceTexture(0);
     renderer.SetColor(0x60, 0x60, 0x60);
     renderer.DrawQuad(x_offset, y, keyboard_width, y_offset - PixelsOffKeyboard);
 
@@ -378,68 +437,67 @@ void KeyboardDisplay::DrawBars(Renderer& renderer, int x, int y, int y_offset,
         renderer.DrawQuad(x, y_bar_offset, final_width, 2);
 
         // Add a label with a bar number
-        // Background text
-        TextWriter bar_writer2(x + 3, y_bar_offset - 13, renderer, false, 11);
-        bar_writer2 << Text(STRING(i + 1), text_color1);
+        TextWriter bar_writer(x + 4, y_bar_offset - 14, renderer, false, 11);
+        bar_writer << Text(STRING(i + 1), text_color2).Outlined(text_color1);
+    }
+}
+
+NoteShape KeyboardDisplay::GetNoteShape(const NoteTexDimensions& d, int w) {
+
+    // Width is super-easy
+    const int tex_note_w = d.right - d.left;
 
-        TextWriter bar_writer3(x + 5, y_bar_offset - 15, renderer, false, 11);
-        bar_writer3 << Text(STRING(i + 1), text_color1);
+    const double width_scale = double(w) / double(tex_note_w);
 
-        TextWriter bar_writer4(x + 3, y_bar_offset - 15, renderer, false, 11);
-        bar_writer4 << Text(STRING(i + 1), text_color1);
+    NoteShape shape;
+    shape.left_offset = d.left * width_scale;
+    shape.width = int(d.tex_width * width_scale);
 
-        TextWriter bar_writer5(x + 5, y_bar_offset - 13, renderer, false, 11);
-        bar_writer5 << Text(STRING(i + 1), text_color1);
+    // Force the note to be at least as large as the crown + heel height
+    const double crown_h = (d.crown_end - d.crown_start) * width_scale;
+    const double heel_h = (d.heel_end - d.heel_start) * width_scale;
+    shape.min_height = crown_h + heel_h + 1.0;
 
-        // Foreground text
-        TextWriter bar_writer(x + 4, y_bar_offset - 14, renderer, false, 11);
-        bar_writer << Text(STRING(i + 1), text_color2);
-    }
+    // We actually use the width scale in height calculations
+    // to keep the proportions fixed.
+    shape.crown_start = d.crown_start * width_scale;
+    shape.crown_end = d.crown_end * width_scale;
+    shape.heel_height = double(d.heel_end - d.heel_start) * width_scale;
+    shape.bottom_height = double(d.tex_height - d.heel_end) * width_scale;
+
+    shape.tex_width = d.tex_width;
+    shape.tex_height = d.tex_height;
+    shape.tex_crown_end = d.crown_end;
+    shape.tex_heel_start = d.heel_start;
+
+    return shape;
 }
 
 void KeyboardDisplay::DrawNote(Renderer& renderer, const Tga *tex, const NoteTexDimensions& tex_dimensions,
                                int x, int y, int w, int h, int color_id) const {
 
     const NoteTexDimensions& d = tex_dimensions;
-
-    // Width is super-easy
-    const int tex_note_w = d.right - d.left;
-
-    const double width_scale = double(w) / double(tex_note_w);
-    const double full_tex_width = d.tex_width * width_scale;
-    const double left_offset = d.left * width_scale;
+    const NoteShape shape = GetNoteShape(d, w);
 
     const int src_x = (color_id * d.tex_width);
-    const int dest_x = int(x - left_offset);
-    const int dest_w = int(full_tex_width);
+    const int dest_x = int(x - shape.left_offset);
+    const int dest_w = shape.width;
 
     // Now we draw the note in three sections:
     // - Crown (fixed (relative) height)
     // - Middle (variable height)
     // - Heel (fixed (relative) height)
 
-    // Force the note to be at least as large as the crown + heel height
-    const double crown_h = (d.crown_end - d.crown_start) * width_scale;
-    const double heel_h = (d.heel_end - d.heel_start) * width_scale;
-    const double min_height = crown_h + heel_h + 1.0;
-
-    if (h < min_height) {
-        const int diff = int(min_height - h);
+    if (h < shape.min_height) {
+        const int diff = int(shape.min_height - h);
         h += diff;
         y -= diff;
     }
 
-    // We actually use the width scale in height calculations
-    // to keep the proportions fixed.
-    const double crown_start_offset = d.crown_start * width_scale;
-    const double crown_end_offset = d.crown_end * width_scale;
-    const double heel_height = double(d.heel_end - d.heel_start) * width_scale;
-    const double bottom_height = double(d.tex_height - d.heel_end) * width_scale;
-
-    const int dest_y1 = int(y - crown_start_offset);
-    const int dest_y2 = int(dest_y1 + crown_end_offset);
-    const int dest_y3 = int((y + h) - heel_height);
-    const int dest_y4 = int(dest_y3 + bottom_height);
+    const int dest_y1 = int(y - shape.crown_start);
+    const int dest_y2 = int(dest_y1 + shape.crown_end);
+    const int dest_y3 = int((y + h) - shape.heel_height);
+    const int dest_y4 = int(dest_y3 + shape.bottom_height);
 
     renderer.DrawStretchedTga(tex, dest_x, dest_y1, dest_w, dest_y2 - dest_y1, src_x, 0, d.tex_width, d.crown_end);
     renderer.DrawStretchedTga(tex, dest_x, dest_y2, dest_w, dest_y3 - dest_y2, src_x, d.crown_end,
@@ -449,70 +507,66 @@ void KeyboardDisplay::DrawNote(Renderer& renderer, const Tga *tex, const NoteTex
                               d.tex_width, d.tex_height - d.heel_start);
 }
 
-void KeyboardDisplay::DrawNotePass(Renderer& renderer, const Tga *tex_white, const Tga *tex_black, int white_width,
-                                   int key_space, int black_width, int black_offset, int x_offset, int y,
-                                   int y_offset, int y_roll_under, const TranslatedNoteSet& notes,
-                                   microseconds_t show_duration, microseconds_t current_time,
-                                   const vector<Track::Properties>& track_properties) const {
+void KeyboardDisplay::GatherVisibleNotes(const TranslatedNoteSet& notes, microseconds_t longest_note,
+                                         microseconds_t show_duration, microseconds_t current_time,
+                                         const vector<Track::Properties>& track_properties) {
 
-    // Shiny music domain knowledge
-    const static unsigned int NotesPerOctave = 12;
-    const static unsigned int WhiteNotesPerOctave = 7;
-    const static bool IsBlackNote[12] = {false, true, false, true, false, false,
-                                         true, false, true, false, true, false};
+    m_visible_white.clear();
+    m_visible_black.clear();
 
-    // The constants used in the switch below refer to the number
-    // of white keys off 'C' that type of piano starts on
-    int keyboard_type_offset = 0;
+    // Anything starting before this has ended already, and a note that
+    // has ended is underneath the keys
+    TranslatedNote first;
+    first.start = current_time - longest_note;
+    first.end = numeric_limits<microseconds_t>::min();
+    first.note_id = 0;
+    first.track_id = 0;
 
-    switch (m_size) {
-        case KeyboardSize37: keyboard_type_offset = 4 - WhiteNotesPerOctave;
-            break;
-        case KeyboardSize49: keyboard_type_offset = 0 - WhiteNotesPerOctave;
-            break;
-        case KeyboardSize61: keyboard_type_offset = 7 - WhiteNotesPerOctave;
-            break; // TODO!
-        case KeyboardSize76: keyboard_type_offset = 5 - WhiteNotesPerOctave;
-            break; // TODO!
-        case KeyboardSize88: keyboard_type_offset = 2 - WhiteNotesPerOctave;
+    for (TranslatedNoteSet::const_iterator i = notes.lower_bound(first); i != notes.end(); ++i) {
+        // This list is sorted by note start time.  The moment we encounter
+        // a note scrolled off the window, we're done
+        if (i->start > current_time + show_duration)
             break;
-        default: throw LinthesiaError(Error_BadPianoType);
+
+        if (i->end < current_time)
+            continue;
+
+        const Track::Mode mode = track_properties[i->track_id].mode;
+        if (mode == Track::ModeNotPlayed || mode == Track::ModePlayedButHidden)
+            continue;
+
+        if (IsBlackNote[i->note_id % NotesPerOctave])
+            m_visible_black.push_back(&*i);
+        else
+            m_visible_white.push_back(&*i);
     }
+}
 
-    // This array describes how to "stack" notes in a single place.  The IsBlackNote array
-    // then tells which one should be shifted slightly to the right
-    const static int NoteToWhiteNoteOffset[12] = {0, -1, -1, -2, -2, -2, -3, -3, -4, -4, -5, -5};
+void KeyboardDisplay::DrawNotePass(Renderer& renderer, const Tga *tex_white, const Tga *tex_black, int white_width,
+                                   int key_space, int black_width, int black_offset, int x_offset, int y,
+                                   int y_offset, int y_roll_under, microseconds_t show_duration,
+                                   microseconds_t current_time,
+                                   const vector<Track::Properties>& track_properties) const {
+
+    const int keyboard_type_offset = GetKeyboardTypeOffset();
+    const int starting_octave = GetStartingOctave();
 
     const static int MinNoteHeight = 3;
 
+    const double scaling_factor = static_cast<double>(y_offset) / static_cast<double>(show_duration);
+    const long long roll_under = static_cast<int>(y_roll_under / scaling_factor);
+
     bool drawing_black = false;
     for (int toggle = 0; toggle < 2; ++toggle) {
 
-        for (TranslatedNoteSet::const_iterator i = notes.begin(); i != notes.end(); ++i) {
-            // This list is sorted by note start time.  The moment we encounter
-            // a note scrolled off the window, we're done drawing
-            if (i->start > current_time + show_duration)
-                break;
-
-            const Track::Mode mode = track_properties[i->track_id].mode;
-            if (mode == Track::ModeNotPlayed || mode == Track::ModePlayedButHidden)
-                continue;
+        // Only what GatherVisibleNotes() found, white notes first
+        const vector<const TranslatedNote *>& visible = (drawing_black ? m_visible_black : m_visible_white);
 
-            const int octave = (i->note_id / NotesPerOctave) - GetStartingOctave();
-            const int octave_base = i->note_id % NotesPerOctave;
-            const int stack_offset = NoteToWhiteNoteOffset[octave_base];
-            const bool is_black = IsBlackNote[octave_base];
+        for (size_t n = 0; n < visible.size(); ++n) {
+            const TranslatedNote *i = visible[n];
 
-            if (drawing_black != is_black)
-                continue;
+            const bool is_black = drawing_black;
 
-            const int octave_offset = (max(octave - 1, 0) * WhiteNotesPerOctave);
-            const int inner_octave_offset = (octave_base + stack_offset);
-            const int generalized_black_offset = (is_black ? black_offset : 0);
-
-            const double scaling_factor = static_cast<double>(y_offset) / static_cast<double>(show_duration);
-
-            const long long roll_under = static_cast<int>(y_roll_under / scaling_factor);
             const long long adjusted_start = max(i->start - current_time, -roll_under);
             const long long adjusted_end = max(i->end - current_time, 0LL);
 
@@ -523,10 +577,8 @@ void KeyboardDisplay::DrawNotePass(Renderer& renderer, const Tga *tex_white, con
             const int y_end = y - static_cast<int>(adjusted_start * scaling_factor) + y_offset;
             const int y_start = y - static_cast<int>(adjusted_end * scaling_factor) + y_offset;
 
-            const int start_x = (octave_offset + inner_octave_offset + keyboard_type_offset) * (white_width + key_space)
-                + generalized_black_offset + x_offset;
-
-            const int left = start_x - 1;
+            const int left = GetNoteLeft(i->note_id, starting_octave, keyboard_type_offset, white_width,
+                                         key_space, black_offset, x_offset);
             const int top = y_start;
             const int width = (is_black ? black_width : white_width) + 2;
             int height = y_end - y_start;
@@ -553,10 +605,100 @@ void KeyboardDisplay::DrawNotePass(Renderer& renderer, const Tga *tex_white, con
     }
 }
 
-void KeyboardDisplay::SetKeyActive(const string& key_name, bool active, Track::TrackColor color) {
-    if (active)
-        m_active_keys[key_name] = color;
+int KeyboardDisplay::GetKeyboardTypeOffset() const {
+
+    // The constants used in the switch below refer to the number
+    // of white keys off 'C' that type of piano starts on
+    switch (m_size) {
+        case KeyboardSize37: return 4 - WhiteNotesPerOctave;
+        case KeyboardSize49: return 0 - WhiteNotesPerOctave;
+        case KeyboardSize61: return 7 - WhiteNotesPerOctave; // TODO!
+        case KeyboardSize76: return 5 - WhiteNotesPerOctave; // TODO!
+        case KeyboardSize88: return 2 - WhiteNotesPerOctave;
+        default: throw LinthesiaError(Error_BadPianoType);
+    }
+}
+
+int KeyboardDisplay::GetNoteLeft(NoteId note, int starting_octave, int keyboard_type_offset, int white_width,
+                                 int key_space, int black_offset, int x_offset) const {
+
+    // This array describes how to "stack" notes in a single place.  The IsBlackNote array
+    // then tells which one should be shifted slightly to the right
+    const static int NoteToWhiteNoteOffset[12] = {0, -1, -1, -2, -2, -2, -3, -3, -4, -4, -5, -5};
+
+    const int octave = (note / NotesPerOctave) - starting_octave;
+    const int octave_base = note % NotesPerOctave;
+    const int stack_offset = NoteToWhiteNoteOffset[octave_base];
+
+    const int octave_offset = (max(octave - 1, 0) * WhiteNotesPerOctave);
+    const int inner_octave_offset = (octave_base + stack_offset);
+    const int generalized_black_offset = (IsBlackNote[octave_base] ? black_offset : 0);
+
+    const int start_x = (octave_offset + inner_octave_offset + keyboard_type_offset) * (white_width + key_space)
+        + generalized_black_offset + x_offset;
+
+    return start_x - 1;
+}
+
+void KeyboardDisplay::UpdateNoteBuffer(Renderer& renderer, const TranslatedNoteSet& notes,
+                                       const vector<Track::Properties>& track_properties, int white_width,
+                                       int key_space, int black_width, int black_offset, int x_offset) {
+
+    const int keyboard_type_offset = GetKeyboardTypeOffset();
+    const int starting_octave = GetStartingOctave();
+
+    NoteLane lanes[KeyCount];
+    bool moved = false;
+    for (NoteId note = 0; note < KeyCount; ++note) {
+        lanes[note].left = GetNoteLeft(note, starting_octave, keyboard_type_offset, white_width,
+                                       key_space, black_offset, x_offset);
+        lanes[note].black = IsBlackNote[note % NotesPerOctave];
+
+        moved = moved || lanes[note].left != m_note_lanes[note].left;
+    }
+
+    if (m_note_buffer.IsBuilt() && !m_notes_reset && !moved)
+        return;
+
+    // Notes are as wide as their key, and a pixel more on both sides
+    m_note_buffer.Build(renderer, notes, track_properties, lanes,
+                        GetNoteShape(WhiteNoteDimensions, white_width + 2),
+                        GetNoteShape(BlackNoteDimensions, black_width + 2));
+
+    copy(lanes, lanes + KeyCount, m_note_lanes);
+    m_notes_reset = false;
+}
+
+void KeyboardDisplay::SetKeyActive(NoteId note, bool active, Track::TrackColor color,
+                                   KeyLitBy lit_by, microseconds_t when) {
+
+    // Octave sliding can push notes off the MIDI range
+    if (note >= KeyCount)
+        return;
+
+    KeyState& key = m_keys[note];
+    if (key.active != active) {
+        const int change = (active ? 1 : -1);
+        m_active_count += change;
+        if (!IsBlackNote[note % NotesPerOctave])
+            m_active_white_count += change;
+    }
+
+    key.active = active;
+    key.color = color;
+    key.lit_by = lit_by;
+    key.changed = when;
+}
+
+void KeyboardDisplay::ResetActiveKeys() {
+
+    for (NoteId note = 0; note < KeyCount; ++note) {
+        m_keys[note].active = false;
+        m_keys[note].color = Track::FlatGray;
+        m_keys[note].lit_by = KeyLitBySong;
+        m_keys[note].changed = 0;
+    }
 
-    else
-        m_active_keys.erase(key_name);
+    m_active_count = 0;
+    m_active_white_count = 0;
 }
@@ -0,0 +1,316 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+// The framebuffer object functions are an extension to the OpenGL 1.x
+// headers
+#define GL_GLEXT_PROTOTYPES
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+
+#include "LayerCache.h"
+
+using namespace std;
+
+static bool hasExtension(const char *name) {
+
+    const char *extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+    return extensions && strstr(extensions, name);
+}
+
+// Asked once, on the thread with the context (see LayerCache::Available())
+static bool any_texture_size = false;
+static GLint max_texture_size = 0;
+
+static bool framebuffersSupported() {
+
+    any_texture_size = hasExtension("GL_ARB_texture_non_power_of_two");
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+
+    return hasExtension("GL_EXT_framebuffer_object");
+}
+
+// Cleared when a framebuffer is submitted and doesn't work after all,
+// layers are drawn live from then on
+static atomic<bool> framebuffers_work(true);
+
+static unsigned int textureSize(unsigned int size) {
+
+    if (any_texture_size)
+        return size;
+
+    unsigned int pow2 = 1;
+    while (pow2 < size)
+        pow2 *= 2;
+
+    return pow2;
+}
+
+struct LayerTarget {
+
+    LayerTarget(unsigned int width, unsigned int height) :
+        texture_width(width),
+        texture_height(height),
+        framebuffer(0),
+        texture_id(0),
+        made(false) {
+    }
+
+    ~LayerTarget() {
+
+        if (framebuffer)
+            glDeleteFramebuffersEXT(1, &framebuffer);
+        if (texture_id)
+            glDeleteTextures(1, &texture_id);
+    }
+
+    // Once, when the first frame using it is submitted.  False if it
+    // doesn't work.
+    bool Make();
+
+    const unsigned int texture_width;
+    const unsigned int texture_height;
+
+    unsigned int framebuffer;
+    unsigned int texture_id;
+    bool made;
+
+  private:
+    LayerTarget(const LayerTarget&);
+    LayerTarget& operator=(const LayerTarget&);
+};
+
+bool LayerTarget::Make() {
+
+    if (made)
+        return framebuffer != 0;
+
+    made = true;
+
+    glGenTextures(1, &texture_id);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture_width, texture_height, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+    // Drawn back 1:1
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenFramebuffersEXT(1, &framebuffer);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                              GL_TEXTURE_2D, texture_id, 0);
+
+    const GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+
+    if (status == GL_FRAMEBUFFER_COMPLETE_EXT)
+        return true;
+
+    cout << "[WARNING] Framebuffer objects don't work here (status 0x" << hex << status
+         << dec << "), drawing everything every frame" << endl;
+
+    glDeleteFramebuffersEXT(1, &framebuffer);
+    glDeleteTextures(1, &texture_id);
+    framebuffer = 0;
+    texture_id = 0;
+
+    // The layers of this frame are left out, the next ones are drawn live
+    framebuffers_work = false;
+    return false;
+}
+
+// What goes between the layer's content and the rest of the frame
+class BeginCapture : public DrawCommand {
+  public:
+
+    BeginCapture(shared_ptr<LayerTarget> target, int x, int y) :
+        m_target(target),
+        m_x(x),
+        m_y(y) {
+    }
+
+    void Submit() {
+
+        if (!m_target->Make())
+            return;
+
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_target->framebuffer);
+        glPushAttrib(GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT);
+        glViewport(0, 0, m_target->texture_width, m_target->texture_height);
+
+        // Same as the screen (see GameStateManager::Draw), with (x, y) at the
+        // top left corner of the texture
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho(m_x, m_x + m_target->texture_width, m_y + m_target->texture_height, m_y, -1, 1);
+
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+        glTranslatef(0.375, 0.375, 0.);
+
+        // The alpha stays opaque, whatever is blended in
+        glClearColor(0, 0, 0, 1);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_FALSE);
+    }
+
+  private:
+    shared_ptr<LayerTarget> m_target;
+    int m_x;
+    int m_y;
+};
+
+class EndCapture : public DrawCommand {
+  public:
+
+    EndCapture(shared_ptr<LayerTarget> target) :
+        m_target(target) {
+    }
+
+    void Submit() {
+
+        if (!m_target->framebuffer)
+            return;
+
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+
+        glPopAttrib();
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    }
+
+  private:
+    shared_ptr<LayerTarget> m_target;
+};
+
+// The texture isn't there while recording, so it is drawn from here and
+// not as a quad of the list
+class DrawLayer : public DrawCommand {
+  public:
+
+    DrawLayer(shared_ptr<LayerTarget> target, int x, int y, int w, int h) :
+        m_target(target),
+        m_x(x),
+        m_y(y),
+        m_width(w),
+        m_height(h) {
+    }
+
+    void Submit() {
+
+        if (!m_target->framebuffer)
+            return;
+
+        // The top rows of the texture, see BeginCapture
+        const double right = static_cast<double>(m_width) / m_target->texture_width;
+        const double bottom = 1.0 - static_cast<double>(m_height) / m_target->texture_height;
+
+        glBindTexture(GL_TEXTURE_2D, m_target->texture_id);
+        glColor4ub(0xFF, 0xFF, 0xFF, 0xFF);
+
+        glBegin(GL_QUADS);
+        glTexCoord2d(0, 1);
+        glVertex2i(m_x, m_y);
+        glTexCoord2d(0, bottom);
+        glVertex2i(m_x, m_y + m_height);
+        glTexCoord2d(right, bottom);
+        glVertex2i(m_x + m_width, m_y + m_height);
+        glTexCoord2d(right, 1);
+        glVertex2i(m_x + m_width, m_y);
+        glEnd();
+    }
+
+  private:
+    shared_ptr<LayerTarget> m_target;
+    int m_x;
+    int m_y;
+    int m_width;
+    int m_height;
+};
+
+bool LayerCache::Available() {
+
+    const static bool supported = framebuffersSupported();
+    return supported && framebuffers_work;
+}
+
+LayerCache::LayerCache() :
+    m_x(0),
+    m_y(0),
+    m_width(0),
+    m_height(0),
+    m_valid(false),
+    m_capturing(false) {
+}
+
+LayerCache::~LayerCache() {
+}
+
+bool LayerCache::Begin(Renderer& renderer, int in_x, int in_y, int w, int h) {
+
+    const int x = in_x + renderer.m_xoffset;
+    const int y = in_y + renderer.m_yoffset;
+
+    if (!Available() || w <= 0 || h <= 0)
+        return true;
+
+    if (m_valid && x == m_x && y == m_y && w == m_width && h == m_height)
+        return false;
+
+    const unsigned int texture_width = textureSize(w);
+    const unsigned int texture_height = textureSize(h);
+    if (texture_width > static_cast<unsigned int>(max_texture_size) ||
+        texture_height > static_cast<unsigned int>(max_texture_size))
+        return true;
+
+    if (!m_target || w != m_width || h != m_height) {
+
+        // Frames still to be submitted may draw the old one
+        if (m_target)
+            renderer.Hold(m_target);
+
+        m_target = make_shared<LayerTarget>(texture_width, texture_height);
+    }
+
+    m_x = x;
+    m_y = y;
+    m_width = w;
+    m_height = h;
+
+    renderer.AddCommand(new BeginCapture(m_target, x, y));
+
+    m_capturing = true;
+    return true;
+}
+
+void LayerCache::End(Renderer& renderer) {
+
+    if (!m_capturing)
+        return;
+
+    renderer.AddCommand(new EndCapture(m_target));
+
+    m_capturing = false;
+    m_valid = true;
+}
+
+void LayerCache::Draw(Renderer& renderer) const {
+
+    if (!m_valid || !Available())
+        return;
+
+    renderer.AddCommand(new DrawLayer(m_target, m_x, m_y, m_width, m_height));
+}
@@ -0,0 +1,246 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include <string>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "LoopbackBackend.h"
+#include "CompatibleSystem.h"
+
+using namespace std;
+
+// Fixed devices: one of each, plus the PC keyboard
+const static int LoopbackInputPort = 0;
+const static int LoopbackOutputPort = 1;
+const static int LoopbackKeyboardPort = 2;
+
+LoopbackBackend::LoopbackBackend() :
+    m_manual_clock(false),
+    m_now(0),
+    m_input_connected(false),
+    m_output_connected(false),
+    m_event_fd(-1) {
+}
+
+LoopbackBackend::~LoopbackBackend() {
+
+    Close();
+}
+
+string LoopbackBackend::Open() {
+
+    m_event_fd = eventfd(0, EFD_NONBLOCK);
+    if (m_event_fd < 0)
+        return "Could not set up the MIDI loopback. No MIDI available";
+
+    return "";
+}
+
+void LoopbackBackend::Close() {
+
+    if (m_event_fd < 0)
+        return;
+
+    close(m_event_fd);
+    m_event_fd = -1;
+}
+
+MidiCommDescriptionList LoopbackBackend::InputDevices() const {
+
+    MidiCommDescriptionList devices;
+
+    MidiCommDescription d;
+    d.id = 0;
+    d.name = "Loopback Input";
+    d.client = 0;
+    d.port = LoopbackInputPort;
+    d.backend = 0;
+    devices.push_back(d);
+
+    d.id = 1;
+    d.name = "Linthesia Keyboard";
+    d.port = LoopbackKeyboardPort;
+    devices.push_back(d);
+
+    return devices;
+}
+
+MidiCommDescriptionList LoopbackBackend::OutputDevices() const {
+
+    MidiCommDescriptionList devices;
+
+    MidiCommDescription d;
+    d.id = 0;
+    d.name = "Loopback Output";
+    d.client = 0;
+    d.port = LoopbackOutputPort;
+    d.backend = 0;
+    devices.push_back(d);
+
+    return devices;
+}
+
+void LoopbackBackend::Rescan() {
+}
+
+bool LoopbackBackend::IsKeyboard(const MidiCommDescription& device) const {
+
+    return device.port == LoopbackKeyboardPort;
+}
+
+string LoopbackBackend::ConnectInput(const MidiCommDescription& device) {
+
+    if (device.port != LoopbackInputPort)
+        return "No such loopback device";
+
+    m_input_connected = true;
+    return "";
+}
+
+void LoopbackBackend::DisconnectInput(const MidiCommDescription&) {
+
+    m_input_connected = false;
+}
+
+string LoopbackBackend::ConnectOutput(const MidiCommDescription& device) {
+
+    if (device.port != LoopbackOutputPort)
+        return "No such loopback device";
+
+    m_output_connected = true;
+    return "";
+}
+
+void LoopbackBackend::DisconnectOutput(const MidiCommDescription&) {
+
+    m_output_connected = false;
+}
+
+void LoopbackBackend::Signal() {
+
+    if (m_event_fd < 0)
+        return;
+
+    const uint64_t one = 1;
+    ssize_t written = write(m_event_fd, &one, sizeof(one));
+    (void) written;
+}
+
+void LoopbackBackend::SetNow(microseconds_t now) {
+
+    m_manual_clock = true;
+    m_now = now;
+
+    // Injected input may be due now
+    if (!m_pending_input.empty())
+        Signal();
+}
+
+void LoopbackBackend::Inject(const MidiEventSimple& ev, microseconds_t arrival) {
+
+    MidiBackendEvent in;
+    in.event = ev;
+    in.arrival = arrival;
+    m_pending_input.push_back(in);
+
+    Signal();
+}
+
+unsigned int LoopbackBackend::ReadBatch(MidiBackendEventList& events) {
+
+    if (m_event_fd >= 0) {
+        uint64_t count;
+        ssize_t got = read(m_event_fd, &count, sizeof(count));
+        (void) got;
+    }
+
+    const microseconds_t now = Now();
+    unsigned int result = MidiReadNothing;
+
+    while (!m_pending_input.empty() && m_pending_input.front().arrival <= now) {
+        if (m_input_connected)
+            events.push_back(m_pending_input.front());
+
+        m_pending_input.pop_front();
+        result = MidiReadSomething;
+    }
+
+    return result;
+}
+
+void LoopbackBackend::DropInput() {
+
+    const microseconds_t now = Now();
+    while (!m_pending_input.empty() && m_pending_input.front().arrival <= now)
+        m_pending_input.pop_front();
+}
+
+void LoopbackBackend::Write(const MidiEvent& out, microseconds_t delay_microseconds) {
+
+    if (!m_output_connected)
+        return;
+
+    LoopbackOutputEvent ev;
+    ev.event = out;
+    ev.due = Now() + (delay_microseconds > 0 ? delay_microseconds : 0);
+    m_buffered.push_back(ev);
+}
+
+void LoopbackBackend::Drain() {
+
+    m_output.insert(m_output.end(), m_buffered.begin(), m_buffered.end());
+    m_buffered.clear();
+}
+
+void LoopbackBackend::DropScheduled() {
+
+    Drain();
+
+    const microseconds_t now = Now();
+    LoopbackOutputEventList kept;
+    kept.reserve(m_output.size());
+
+    for (size_t i = 0; i < m_output.size(); ++i) {
+        const MidiEvent& ev = m_output[i].event;
+        const bool note_off = (ev.Type() == MidiEventType_NoteOff ||
+                               (ev.Type() == MidiEventType_NoteOn && ev.NoteVelocity() == 0));
+
+        if (m_output[i].due <= now || note_off)
+            kept.push_back(m_output[i]);
+    }
+
+    m_output.swap(kept);
+}
+
+void LoopbackBackend::KeyboardNote(unsigned char, bool, unsigned char) {
+}
+
+vector<pollfd> LoopbackBackend::PollDescriptors() const {
+
+    vector<pollfd> fds;
+    if (m_event_fd < 0)
+        return fds;
+
+    pollfd fd;
+    fd.fd = m_event_fd;
+    fd.events = POLLIN;
+    fd.revents = 0;
+    fds.push_back(fd);
+
+    return fds;
+}
+
+microseconds_t LoopbackBackend::Now() const {
+
+    if (m_manual_clock)
+        return m_now;
+
+    return Compatible::GetMicroseconds();
+}
@@ -10,6 +10,7 @@
 
 #include <fstream>
 #include <map>
+#include <algorithm>
 
 using namespace std;
 
@@ -429,6 +430,39 @@ void Midi::GoTo(microseconds_t microsecond_song_position) {
     }
 }
 
+static bool TimedMidiEventEarlier(const TimedMidiEvent& a, const TimedMidiEvent& b) {
+    return a.usecs < b.usecs;
+}
+
+TimedMidiEventList Midi::EventsInRange(microseconds_t after, microseconds_t up_to) const {
+    TimedMidiEventList events;
+    if (!m_initialized || up_to <= after)
+        return events;
+
+    const size_t track_count = m_tracks.size();
+    for (size_t i = 0; i < track_count; ++i) {
+        const MidiEventMicrosecondList& usecs = m_tracks[i].EventUsecs();
+        const MidiEventList& track_events = m_tracks[i].Events();
+
+        // Event times are sorted, so the range can be found by bisection
+        MidiEventMicrosecondList::const_iterator first = upper_bound(usecs.begin(), usecs.end(), after);
+        MidiEventMicrosecondList::const_iterator last = upper_bound(first, usecs.end(), up_to);
+
+        for (MidiEventMicrosecondList::const_iterator j = first; j != last; ++j) {
+            TimedMidiEvent ev;
+            ev.usecs = *j;
+            ev.track_id = i;
+            ev.event = track_events[j - usecs.begin()];
+            events.push_back(ev);
+        }
+    }
+
+    // Keep the per-track order for events sharing the same time
+    stable_sort(events.begin(), events.end(), TimedMidiEventEarlier);
+
+    return events;
+}
+
 microseconds_t Midi::GetSongLengthInMicroseconds() const {
     if (!m_initialized)
         return 0;
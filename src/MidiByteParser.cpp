@@ -0,0 +1,129 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include "MidiByteParser.h"
+
+using namespace std;
+
+// A runaway SysEx (missing its 0xF7) shouldn't eat all memory
+const static size_t MaxSysExLength = 65536;
+
+MidiByteParser::MidiByteParser() {
+
+    Reset();
+}
+
+void MidiByteParser::Reset() {
+
+    m_status = 0;
+    m_data[0] = 0;
+    m_data[1] = 0;
+    m_data_count = 0;
+    m_data_needed = 0;
+    m_in_sysex = false;
+    m_sysex.clear();
+}
+
+void MidiByteParser::Feed(const unsigned char *data, size_t length, MidiEventList& events) {
+
+    for (size_t i = 0; i < length; ++i) {
+        const unsigned char b = data[i];
+
+        // Realtime, may show up anywhere and changes nothing
+        if (b >= 0xF8)
+            continue;
+
+        if (b == 0xF7) {
+            if (m_in_sysex) {
+                m_sysex += static_cast<char>(b);
+                events.push_back(MidiEvent::BuildSysEx(m_sysex));
+                m_in_sysex = false;
+                m_sysex.clear();
+            }
+            continue;
+        }
+
+        if (b & 0x80)
+            Status(b);
+        else
+            Data(b, events);
+    }
+}
+
+void MidiByteParser::Status(unsigned char status) {
+
+    // Any other status ends a SysEx, without its 0xF7 it is not sent on
+    m_in_sysex = false;
+    m_sysex.clear();
+
+    m_data_count = 0;
+
+    if (status == 0xF0) {
+        m_status = 0;
+        m_in_sysex = true;
+        m_sysex = string(1, static_cast<char>(status));
+        return;
+    }
+
+    m_status = status;
+    switch (status & 0xF0) {
+        case 0xC0:
+        case 0xD0: m_data_needed = 1;
+            break;
+
+        case 0xF0:
+            // System common, cancels running status
+            switch (status) {
+                case 0xF1:
+                case 0xF3: m_data_needed = 1;
+                    break;
+
+                case 0xF2: m_data_needed = 2;
+                    break;
+
+                default: m_data_needed = 0;
+                    m_status = 0;
+                    break;
+            }
+            break;
+
+        default: m_data_needed = 2;
+            break;
+    }
+}
+
+void MidiByteParser::Data(unsigned char data, MidiEventList& events) {
+
+    if (m_in_sysex) {
+        if (m_sysex.length() < MaxSysExLength)
+            m_sysex += static_cast<char>(data);
+        else {
+            m_in_sysex = false;
+            m_sysex.clear();
+        }
+        return;
+    }
+
+    // Stray data, the status it belongs to was missed
+    if (m_status == 0)
+        return;
+
+    m_data[m_data_count++] = data;
+    if (m_data_count < m_data_needed)
+        return;
+
+    m_data_count = 0;
+
+    if (m_status >= 0xF0) {
+        m_status = 0;
+        return;
+    }
+
+    events.push_back(MidiEvent::Build(MidiEventSimple(m_status, m_data[0],
+                                                      m_data_needed == 2 ? m_data[1] : 0)));
+}
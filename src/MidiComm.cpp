@@ -8,402 +8,665 @@
 
 #include <string>
 #include <sstream>
-#include <alsa/asoundlib.h>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
 
 #include "libmidi/MidiEvent.h"
 
 #include "MidiComm.h"
+#include "MidiStats.h"
+#include "AlsaSeqBackend.h"
+#include "LoopbackBackend.h"
+#include "RawMidiBackend.h"
+#include "CombinedBackend.h"
 #include "CompatibleSystem.h"
 #include "StringUtil.h"
+#include "UserSettings.h"
 
 using namespace std;
 
-// ALSA sequencer descriptor
+// The system's MIDI, see MidiBackend
+static MidiBackend *backend = 0;
 static bool midi_initiated = false;
 static bool emulate_kb = false;
-static snd_seq_t *alsa_seq;
 
-// ALSA ports
-static int local_out, local_in, anon_in, keybd_out = -1;
+// Input read from the backend, waiting for MidiCommIn::Read()
+struct MidiInputEvent {
+
+    MidiEvent event;
+    microseconds_t arrival;
+};
+
+// Preallocated ring buffer, so draining a burst doesn't allocate
+const static size_t InputBufferSize = 1024;
+static MidiInputEvent input_buffer[InputBufferSize];
+static size_t input_first = 0;
+static size_t input_count = 0;
+
+// Reused by midiReadInput()
+static MidiBackendEventList input_batch;
+
+// Thru routing, by input pitch.  Sounding keeps where each key went, so
+// its Note-Off follows even if the routes changed in between.
+static MidiCommOut *thru_out = 0;
+static MidiThruRoute thru_routes[128];
+static MidiThruRoute thru_sounding[128];
+
+static bool input_open = false;
+static bool input_should_reconnect = false;
+
+// Device lists, as the backend last reported them.  The serial changes
+// every time one of them does.
+static MidiCommDescriptionList in_list;
+static MidiCommDescriptionList out_list;
+static unsigned long device_list_serial = 0;
+
+// midiInitAsync() worker.  Until midi_ready is set, everything above
+// belongs to it.
+static std::thread init_thread;
+static std::atomic<bool> midi_ready(false);
+static string init_error;
+
+MidiBackend *createMidiBackend() {
+
+    const char *env = getenv("LINTHESIA_MIDI_BACKEND");
+    const string name = (env ? env : "");
+
+    if (name == "loopback")
+        return new LoopbackBackend();
+
+    if (name == "sequencer")
+        return new AlsaSeqBackend();
+
+    if (name == "rawmidi")
+        return new RawMidiBackend();
+
+    // The sequencer has the PC keyboard and software synths, the raw
+    // devices skip its overhead for hardware (so the sequencer leaves the
+    // sound cards out, they would be listed twice)
+    vector<MidiBackend *> parts;
+    parts.push_back(new AlsaSeqBackend(false));
+    parts.push_back(new RawMidiBackend());
+    return new CombinedBackend(parts);
+}
+
+void midiUseBackend(MidiBackend *b) {
+
+    if (midi_initiated)
+        return;
+
+    delete backend;
+    backend = b;
+}
+
+// private use
+static void drainOutput() {
+
+    midiStats().Drain();
+    backend->Drain();
+}
+
+// private use
+static void refreshDeviceLists() {
+
+    in_list = backend->InputDevices();
+    out_list = backend->OutputDevices();
+    device_list_serial++;
+}
 
 void midiInit() {
 
     if (midi_initiated)
         return;
 
-    int err = snd_seq_open(&alsa_seq, "default", SND_SEQ_OPEN_DUPLEX, 0);
-    int ownid = snd_seq_client_id(alsa_seq);
     midi_initiated = true;
+    if (!backend)
+        backend = createMidiBackend();
 
-    // Could not open sequencer, no out devices
-    if (err < 0) {
-        alsa_seq = NULL;
-        Compatible::ShowError("Could not open MIDI sequencer. No MIDI available");
-        return;
-    }
+    // This may run on the midiInitAsync() thread, the error is shown by
+    // whoever waits for it
+    init_error = backend->Open();
+    refreshDeviceLists();
+}
+
+// private use
+static void midiInitWorker(void (*on_ready)()) {
 
-    snd_seq_set_client_name(alsa_seq, "Linthesia");
-
-    // meanings of READ and WRITE are permissions of the port from the viewpoint of other ports
-    // READ: port allows to send events to other ports
-    local_out = snd_seq_create_simple_port(alsa_seq, "Linthesia Output",
-                                           SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
-                                           SND_SEQ_PORT_TYPE_MIDI_GENERIC);
-
-    keybd_out = snd_seq_create_simple_port(alsa_seq, "Linthesia Keyboard",
-                                           SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
-                                           SND_SEQ_PORT_TYPE_MIDI_GENERIC);
-
-    // WRITE: port allows to receive events from other ports
-    local_in = snd_seq_create_simple_port(alsa_seq, "Linthesia Input",
-                                          SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
-                                          SND_SEQ_PORT_TYPE_MIDI_GENERIC);
-
-    anon_in = snd_seq_create_simple_port(alsa_seq, "Linthesia Annonce Listener",
-                                         SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT,
-                                         SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
-
-    if (anon_in < 0)
-        return; // handle error
-
-    // Subscribe on port opening
-    snd_seq_port_subscribe_t *sub;
-    snd_seq_addr_t sender, dest;
-
-    snd_seq_port_subscribe_alloca(&sub);
-    // Receive events from annoncer's port
-    sender.client = SND_SEQ_CLIENT_SYSTEM;
-    sender.port = SND_SEQ_PORT_SYSTEM_ANNOUNCE;
-    snd_seq_port_subscribe_set_sender(sub, &sender);
-    // Forward them to our port
-    dest.client = ownid;
-    dest.port = anon_in;
-    snd_seq_port_subscribe_set_dest(sub, &dest);
-    err = snd_seq_subscribe_port(alsa_seq, sub);
-    if (err < 0) {
-        fprintf(stderr, "Cannot subscribe announce port: %s\n", snd_strerror(err));
+    midiInit();
+
+    midi_ready.store(true);
+    if (on_ready)
+        on_ready();
+}
+
+void midiInitAsync(void (*on_ready)()) {
+
+    if (midi_ready || init_thread.joinable())
         return;
-    }
+
+    init_thread = std::thread(midiInitWorker, on_ready);
+}
+
+bool midiReady() {
+
+    return midi_ready;
+}
+
+string midiInitError() {
+
+    if (!midi_ready)
+        return "";
+
+    return init_error;
 }
 
 void midiStop() {
 
-    snd_seq_close(alsa_seq);
+    if (init_thread.joinable())
+        init_thread.join();
+
+    if (!midi_ready || !backend)
+        return;
+
+    backend->Close();
+    delete backend;
+    backend = 0;
+
+    // Everything here is back to how midiInit() found it
+    midi_ready.store(false);
+    midi_initiated = false;
 }
 
-void sendNote(const unsigned char note, bool on) {
+void midiDrainOutput() {
 
-    if (emulate_kb) {
-        snd_seq_event_t ev;
-        snd_seq_ev_clear(&ev);
+    if (!midi_ready)
+        return;
+
+    drainOutput();
+}
+
+microseconds_t midiNow() {
 
-        snd_seq_ev_set_source(&ev, keybd_out);
-        snd_seq_ev_set_subs(&ev);
-        snd_seq_ev_set_direct(&ev);
+    if (!midi_ready)
+        return Compatible::GetMicroseconds();
 
-        if (on)
-            // velocity ~ 60 for audio preview
-            snd_seq_ev_set_noteon(&ev, 0, note, 60);
+    return backend->Now();
+}
+
+// private use
+static string latencySettingKey(const string& prefix, const string& device_name) {
+
+    // gconf keys only allow a few characters
+    string key = prefix;
+    for (size_t i = 0; i < device_name.length(); ++i) {
+        char c = device_name[i];
+        if (isalnum(static_cast<unsigned char>(c)))
+            key += c;
         else
-            snd_seq_ev_set_noteoff(&ev, 0, note, 0);
+            key += '_';
+    }
+
+    return key;
+}
 
-        snd_seq_event_output(alsa_seq, &ev);
-        snd_seq_drain_output(alsa_seq);
+static microseconds_t loadLatency(const string& key) {
+
+    istringstream value(UserSetting::Get(key, "0"));
+    microseconds_t latency = 0;
+    value >> latency;
+
+    return latency;
+}
+
+static int loadIntSetting(const string& key, int default_value) {
+
+    istringstream value(UserSetting::Get(key, STRING(default_value)));
+    int result = default_value;
+    value >> result;
+
+    return result;
+}
+
+// Ids move around when devices come and go, the port stays the same
+static MidiCommDescription currentDescription(const MidiCommDescription& d,
+                                              const MidiCommDescriptionList& devices) {
+
+    MidiCommDescription current = d;
+    for (size_t i = 0; i < devices.size(); ++i) {
+        if (devices[i].backend == d.backend && devices[i].client == d.client && devices[i].port == d.port) {
+            current.id = devices[i].id;
+            break;
+        }
     }
+
+    return current;
 }
 
-// private use
-void doRetrieveDevices(unsigned int perms, MidiCommDescriptionList& devices) {
+unsigned long midiDeviceListSerial() {
 
-    midiInit();
-    if (alsa_seq == NULL)
-        return;
+    return device_list_serial;
+}
 
-    snd_seq_client_info_t *cinfo;
-    snd_seq_port_info_t *pinfo;
-    int count = 0, ownid = snd_seq_client_id(alsa_seq);
+vector<pollfd> midiPollDescriptors() {
 
-    snd_seq_client_info_alloca(&cinfo);
-    snd_seq_port_info_alloca(&pinfo);
-    snd_seq_client_info_set_client(cinfo, -1);
+    if (!midi_ready)
+        return vector<pollfd>();
 
-    while (snd_seq_query_next_client(alsa_seq, cinfo) >= 0) {
+    return backend->PollDescriptors();
+}
 
-        // reset query info
-        snd_seq_port_info_set_client(pinfo, snd_seq_client_info_get_client(cinfo));
-        snd_seq_port_info_set_port(pinfo, -1);
+static void clearInput() {
 
-        while (snd_seq_query_next_port(alsa_seq, pinfo) >= 0) {
-            if ((snd_seq_port_info_get_capability(pinfo) & perms) == perms) {
+    input_first = 0;
+    input_count = 0;
+}
 
-                int client = snd_seq_client_info_get_client(cinfo);
-                int port = snd_seq_port_info_get_port(pinfo);
+// private use
+static void pushInput(const MidiEvent& event, microseconds_t arrival) {
 
-                // filter own ports
-                if (client == ownid && (port == local_in || port == local_out))
-                    continue;
+    // Nobody would ever read them
+    if (!input_open)
+        return;
 
-                MidiCommDescription d;
-                d.id = count++;
-                d.name = snd_seq_port_info_get_name(pinfo);
-                d.client = client;
-                d.port = port;
+    // Nobody read them in a long time, the oldest go first
+    if (input_count == InputBufferSize) {
+        input_first = (input_first + 1) % InputBufferSize;
+        input_count--;
+    }
 
-                devices.push_back(d);
-            }
-        }
+    MidiInputEvent& in = input_buffer[(input_first + input_count) % InputBufferSize];
+    in.event = event;
+    in.arrival = arrival;
+    input_count++;
+
+    midiStats().EventIn();
+    midiStats().InputDepth(input_count);
+}
+
+void midiSetThru(MidiCommOut *out) {
+
+    for (int i = 0; i < 128; ++i) {
+        thru_routes[i].enabled = false;
+        thru_sounding[i].enabled = false;
     }
+
+    thru_out = out;
 }
 
-// Midi IN Ports
+void midiSetThruRoutes(const MidiThruRoute *routes) {
 
-static bool built_input_list = false;
-static MidiCommDescriptionList in_list(MidiCommIn::GetDeviceList());
+    copy(routes, routes + 128, thru_routes);
+}
 
-MidiCommIn::MidiCommIn(unsigned int device_id) {
-    m_should_reconnect = false;
+// private use
+// Returns whether anything was written to thru_out
+static bool thruNote(const MidiEventSimple& in) {
 
-    m_description = GetDeviceList()[device_id];
+    if (!thru_out)
+        return false;
 
-    // Connect local in to selected port
-    int res = snd_seq_connect_from(alsa_seq, local_in, m_description.client, m_description.port);
-    if (res < 0) {
-        string msg = snd_strerror(res);
-        cout << "[WARNING] Input, cannot connect from '" << m_description.name << "': " << msg << endl;
+    const unsigned char type = in.status & 0xF0;
+    if (type != 0x80 && type != 0x90)
+        return false;
+
+    const int pitch = in.byte1 & 0x7F;
+    bool written = false;
+
+    // A release, or a press again, ends what the key started before
+    MidiThruRoute& sounding = thru_sounding[pitch];
+    if (sounding.enabled) {
+        thru_out->Write(MidiEvent::Build(MidiEventSimple(0x80 | sounding.channel, sounding.note, 0)));
+        sounding.enabled = false;
+        written = true;
     }
 
-    // enable internal keyboard
-    if (m_description.client == snd_seq_client_id(alsa_seq) and
-        m_description.port == keybd_out)
-        emulate_kb = true;
+    const MidiThruRoute& route = thru_routes[pitch];
+    if (type == 0x80 || in.byte2 == 0 || !route.enabled)
+        return written;
+
+    thru_out->Write(MidiEvent::Build(MidiEventSimple(0x90 | route.channel, route.note, route.velocity)));
+    sounding = route;
+
+    return true;
 }
 
-MidiCommIn::~MidiCommIn() {
+void sendNote(const unsigned char note, bool on, microseconds_t pressed_microseconds) {
+
+    if (!midi_ready || !emulate_kb)
+        return;
+
+    // velocity ~ 60 for audio preview
+    const unsigned char velocity = (on ? 60 : 0);
+    const unsigned char status = (on ? 0x90 : 0x80);
+
+    // Straight into our own input, stamped with the key press.  Going out
+    // and back in through the sequencer would cost a frame.
+    const MidiEventSimple simple(status, note, velocity);
+    pushInput(MidiEvent::Build(simple), pressed_microseconds);
+    const bool thru = thruNote(simple);
+
+    // Other applications may listen to the keyboard too.  This goes out
+    // with the next midiDrainOutput(), unless the thru note needs it now.
+    backend->KeyboardNote(note, on, velocity);
 
-    // Disconnect local in to selected port
-    snd_seq_disconnect_from(alsa_seq, local_in, m_description.client, m_description.port);
+    if (thru)
+        drainOutput();
 }
 
-MidiCommDescriptionList MidiCommIn::GetDeviceList() {
+bool midiReadInput() {
+
+    if (!midi_ready)
+        return false;
+
+    input_batch.clear();
+    const unsigned int result = backend->ReadBatch(input_batch);
 
-    if (built_input_list)
-        return in_list;
+    if (result & MidiReadDevicesChanged)
+        refreshDeviceLists();
 
-    built_input_list = true;
-    MidiCommDescriptionList devices;
+    if (result & MidiReadDeviceStarted)
+        input_should_reconnect = true;
 
-    unsigned int perms = SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
-    doRetrieveDevices(perms, devices);
+    bool thru = false;
+    for (size_t i = 0; i < input_batch.size(); ++i) {
+        pushInput(MidiEvent::Build(input_batch[i].event), input_batch[i].arrival);
+        thru |= thruNote(input_batch[i].event);
+    }
+
+    // The player hears their notes right away
+    if (thru)
+        drainOutput();
 
-    return devices;
+    return result != MidiReadNothing;
 }
 
-void MidiCommIn::UpdateDeviceList() {
-    built_input_list = false;
-    in_list = MidiCommIn::GetDeviceList();
+// Midi IN Ports
+
+MidiCommIn::MidiCommIn(unsigned int device_id) {
+    input_should_reconnect = false;
+    clearInput();
+    input_open = true;
+
+    m_description = GetDeviceList()[device_id];
+    m_latency = loadLatency(latencySettingKey("input_latency_", m_description.name));
+
+    // The internal keyboard is fed to us by sendNote(), no need to
+    // route it through the backend
+    if (backend->IsKeyboard(m_description)) {
+        emulate_kb = true;
+        return;
+    }
+
+    // Connect local in to selected port
+    string msg = backend->ConnectInput(m_description);
+    if (!msg.empty())
+        cout << "[WARNING] Input, cannot connect from '" << m_description.name << "': " << msg << endl;
 }
 
-MidiEvent MidiCommIn::Read() {
+MidiCommIn::~MidiCommIn() {
 
-    if (snd_seq_event_input_pending(alsa_seq, 1) < 1)
-        return MidiEvent::NullEvent();
+    // Disconnect local in to selected port (if MIDI wasn't stopped yet)
+    if (!emulate_kb && midi_ready)
+        backend->DisconnectInput(m_description);
+    emulate_kb = false;
 
-    MidiEventSimple simple;
-    snd_seq_event_t *ev;
-    snd_seq_event_input(alsa_seq, &ev);
+    input_open = false;
+    clearInput();
+}
 
-    switch (ev->type) {
-        case SND_SEQ_EVENT_NOTEON:simple.status = 0x90 | (ev->data.note.channel & 0x0F); // Type and Channel
-            simple.byte1 = ev->data.note.note;                     // Note number
-            simple.byte2 = ev->data.note.velocity;                 // Velocity
-            break;
+MidiCommDescriptionList MidiCommIn::GetDeviceList() {
 
-        case SND_SEQ_EVENT_NOTEOFF:simple.status = 0x80 | (ev->data.note.channel & 0x0F); // Type and Channel
-            simple.byte1 = ev->data.note.note;                     // Note number
-            simple.byte2 = 0;                                      // Velocity
-            break;
+    // Still being built by midiInitAsync()
+    if (!midi_ready)
+        return MidiCommDescriptionList();
 
-        case SND_SEQ_EVENT_PGMCHANGE:simple.status = 0xC0 | (ev->data.note.channel & 0x0F); // Type and Channel
-            simple.byte1 = ev->data.control.value;                 // Program number
-            break;
+    return in_list;
+}
 
-        case SND_SEQ_EVENT_PORT_EXIT:
-            // USB device is disconnected - the input client is closed
-        {
-            cout << "MIDI device is lost" << endl;
-            // TODO add better error reporting
-        }
-            break;
+MidiCommDescription MidiCommIn::GetDeviceDescription() const {
 
-        case SND_SEQ_EVENT_PORT_START: {
-            int new_client = ev->data.addr.client;
-            int new_port = ev->data.addr.port;
-            snd_seq_port_info_t *pinfo;
-            snd_seq_port_info_alloca(&pinfo);
+    return currentDescription(m_description, in_list);
+}
 
-            cout << "New MIDI device client=" << new_client << ", port=" << new_port << endl;
-            int err = snd_seq_get_any_port_info(alsa_seq, new_client, new_port, pinfo);
+void MidiCommIn::UpdateDeviceList() {
 
-            if (err < 0)
-                return MidiEvent::NullEvent(); // error
+    if (!midi_ready)
+        return;
 
-            int port = snd_seq_port_info_get_port(pinfo);
-            int client = snd_seq_port_info_get_client(pinfo);
-            cout << "Port info client=" << client << ", port=" << port << endl;
+    backend->Rescan();
+    refreshDeviceLists();
+}
 
-            std::string new_name = snd_seq_port_info_get_name(pinfo);
-            cout << "New MIDI device " << new_name << endl;
+MidiEvent MidiCommIn::Read(microseconds_t *arrival_microseconds) {
 
-            m_should_reconnect = true;
-        }
-            break;
+    if (input_count == 0)
+        return MidiEvent::NullEvent();
 
-            // unknown type, do nothing
-        default:return MidiEvent::NullEvent();
-    }
+    const MidiInputEvent& in = input_buffer[input_first];
+    if (arrival_microseconds)
+        *arrival_microseconds = in.arrival;
+
+    input_first = (input_first + 1) % InputBufferSize;
+    input_count--;
 
-    return MidiEvent::Build(simple);
+    return in.event;
 }
 
 bool MidiCommIn::KeepReading() const {
 
-    return snd_seq_event_input_pending(alsa_seq, 1);
+    return input_count > 0;
 }
 
 void MidiCommIn::Reset() {
 
-    snd_seq_drop_input(alsa_seq);
+    backend->DropInput();
+    clearInput();
+}
+
+void MidiCommIn::SetLatency(microseconds_t latency) {
+
+    m_latency = latency;
+    UserSetting::Set(latencySettingKey("input_latency_", m_description.name), STRING(latency));
 }
 
 bool MidiCommIn::ShouldReconnect() const {
 
-    return m_should_reconnect;
+    return input_should_reconnect;
 }
 
 void MidiCommIn::Reconnect() {
     // We assume, that the client and the port is the same after device's reconnect
     // Connect local in to selected port
-    snd_seq_connect_from(alsa_seq, local_in, m_description.client, m_description.port);
-    m_should_reconnect = false;
+    if (!emulate_kb)
+        backend->ConnectInput(m_description);
+    input_should_reconnect = false;
 }
 
 
 // Midi OUT Ports
 
-static bool built_output_list = false;
-static MidiCommDescriptionList out_list(MidiCommOut::GetDeviceList());
+// Plenty for any piano piece, and about what software synths manage
+// without underruns
+const static int DefaultMaxPolyphony = 96;
+const static int DefaultMaxChannelPolyphony = 32;
+const static int DefaultOverloadVelocityFloor = 24;
 
-MidiCommOut::MidiCommOut(unsigned int device_id) {
+MidiCommOut::MidiCommOut(unsigned int device_id) :
+    m_voices(loadIntSetting("max_polyphony", DefaultMaxPolyphony),
+             loadIntSetting("max_channel_polyphony", DefaultMaxChannelPolyphony),
+             loadIntSetting("overload_velocity_floor", DefaultOverloadVelocityFloor)) {
 
     m_description = GetDeviceList()[device_id];
+    m_latency = loadLatency(latencySettingKey("output_latency_", m_description.name));
+    m_per_note_reset = (UserSetting::Get("per_note_reset", "false") == "true");
+
+    for (int ch = 0; ch < 16; ++ch)
+        m_notes_on_count[ch] = 0;
 
     // Connect local out to selected port
-    int res = snd_seq_connect_to(alsa_seq, local_out, m_description.client, m_description.port);
-    if (res < 0) {
-        string msg = snd_strerror(res);
+    string msg = backend->ConnectOutput(m_description);
+    if (!msg.empty())
         cout << "[WARNING] Output, cannot connect to '" << m_description.name
              << "': " << msg << endl;
-    }
 }
 
 MidiCommOut::~MidiCommOut() {
 
+    // midiStop() took the backend along
+    if (!midi_ready)
+        return;
+
+    // Whatever is still buffered belongs to this device
+    drainOutput();
+
     // Disconnect local out to selected port
-    snd_seq_disconnect_to(alsa_seq, local_out, m_description.client, m_description.port);
+    backend->DisconnectOutput(m_description);
+}
 
-    // This does not harm if done everytime...
-    emulate_kb = false;
+MidiCommDescription MidiCommOut::GetDeviceDescription() const {
+
+    return currentDescription(m_description, out_list);
 }
 
 void MidiCommOut::UpdateDeviceList() {
-    built_output_list = false;
-    out_list = MidiCommOut::GetDeviceList();
+
+    if (!midi_ready)
+        return;
+
+    backend->Rescan();
+    refreshDeviceLists();
 }
 
 MidiCommDescriptionList MidiCommOut::GetDeviceList() {
 
-    if (built_output_list)
-        return out_list;
+    // Still being built by midiInitAsync()
+    if (!midi_ready)
+        return MidiCommDescriptionList();
 
-    built_output_list = true;
-    MidiCommDescriptionList devices;
+    return out_list;
+}
+
+void MidiCommOut::TrackEvent(const MidiEvent& out) {
 
-    unsigned int perms = SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE;
-    doRetrieveDevices(perms, devices);
+    if (out.Type() == MidiEventType_SysEx)
+        return;
 
-    return devices;
+    MidiEventSimple simple;
+    if (!out.GetSimpleEvent(&simple))
+        return;
+
+    const int ch = out.Channel();
+    m_channels_used.set(ch);
+
+    // save for reset
+    if (out.Type() == MidiEventType_NoteOn && out.NoteVelocity() > 0)
+        NoteStarted(ch, out.NoteNumber());
+
+    else if (out.Type() == MidiEventType_NoteOn || out.Type() == MidiEventType_NoteOff)
+        NoteStopped(ch, out.NoteNumber());
 }
 
 void MidiCommOut::Write(const MidiEvent& out) {
 
-    snd_seq_event_t ev;
-    snd_seq_ev_clear(&ev);
+    TrackEvent(out);
+    midiStats().EventOut();
 
-    // Set my source, to all subscribers, direct delivery
-    snd_seq_ev_set_source(&ev, local_out);
-    snd_seq_ev_set_subs(&ev);
-    snd_seq_ev_set_direct(&ev);
+    // Sent on the next midiDrainOutput()
+    backend->Write(out, 0);
+}
 
-    // set event type
-    switch (out.Type()) {
-        case MidiEventType_NoteOn: {
-            int ch = out.Channel();
-            int note = out.NoteNumber();
-            snd_seq_ev_set_noteon(&ev, ch, note, out.NoteVelocity());
+void MidiCommOut::StartBatch() {
 
-            // save for reset
-            notes_on.push_back(pair<int, int>(ch, note));
-            break;
-        }
+    m_voices.StartBatch();
+}
 
-        case MidiEventType_NoteOff: {
-            int note = out.NoteNumber();
-            int ch = out.Channel();
-            snd_seq_ev_set_noteoff(&ev, ch, note, out.NoteVelocity());
-
-            // remove from reset
-            pair<int, int> p(ch, note);
-            vector<pair<int, int>>::iterator i;
-            for (i = notes_on.begin(); i != notes_on.end(); ++i) {
-                if (*i == p) {
-                    notes_on.erase(i);
-                    break;
-                }
-            }
+void MidiCommOut::Schedule(const MidiEvent& out, microseconds_t delay_microseconds) {
 
-            break;
-        }
+    m_admitted.clear();
+    m_voices.Admit(out, m_admitted);
 
-        case MidiEventType_ProgramChange:snd_seq_ev_set_pgmchange(&ev, out.Channel(), out.ProgramNumber());
-            break;
+    for (size_t i = 0; i < m_admitted.size(); ++i) {
+        TrackEvent(m_admitted[i]);
+        midiStats().EventOut();
 
-            // Unknown type, do nothing
-        default:return;
+        // Sent on the next midiDrainOutput()
+        backend->Write(m_admitted[i], delay_microseconds);
     }
+}
+
+void MidiCommOut::Flush() {
+
+    backend->DropScheduled();
 
-    snd_seq_event_output(alsa_seq, &ev);
-    snd_seq_drain_output(alsa_seq);
+    // The Note-Ons the voices were counted for may be gone
+    m_voices.Reset();
+}
+
+void MidiCommOut::NoteStarted(int channel, int note) {
+
+    if (m_notes_on[channel].test(note))
+        return;
+
+    m_notes_on[channel].set(note);
+    m_notes_on_count[channel]++;
+}
+
+void MidiCommOut::NoteStopped(int channel, int note) {
+
+    if (!m_notes_on[channel].test(note))
+        return;
+
+    m_notes_on[channel].reset(note);
+    m_notes_on_count[channel]--;
 }
 
 void MidiCommOut::Reset() {
 
-    // Sent Note-Off to every open note
-    snd_seq_event_t ev;
-    snd_seq_ev_clear(&ev);
-    snd_seq_ev_set_source(&ev, local_out);
-    snd_seq_ev_set_subs(&ev);
-    snd_seq_ev_set_direct(&ev);
+    // Forget about everything still waiting in the queue
+    Flush();
+
+    // Channel mode messages, all in one burst.  Controllers go first so a
+    // held sustain pedal doesn't keep the released notes ringing.
+    const static unsigned char ResetAllControllers = 121;
+    const static unsigned char AllNotesOff = 123;
+
+    for (int ch = 0; ch < 16; ++ch) {
+        if (!m_channels_used.test(ch) && m_notes_on_count[ch] == 0)
+            continue;
+
+        backend->Write(MidiEvent::Build(MidiEventSimple(0xB0 | ch, ResetAllControllers, 0)), 0);
+        backend->Write(MidiEvent::Build(MidiEventSimple(0xB0 | ch, AllNotesOff, 0)), 0);
+        midiStats().EventOut();
+        midiStats().EventOut();
+
+        if (m_per_note_reset && m_notes_on_count[ch] > 0) {
+            for (int note = 0; note < 128; ++note) {
+                if (!m_notes_on[ch].test(note))
+                    continue;
 
-    vector<pair<int, int>>::const_iterator i;
-    for (i = notes_on.begin(); i != notes_on.end(); ++i) {
-        snd_seq_ev_set_noteoff(&ev, i->first, i->second, 0);
+                backend->Write(MidiEvent::Build(MidiEventSimple(0x80 | ch, note, 0)), 0);
+                midiStats().EventOut();
+            }
+        }
 
-        snd_seq_event_output(alsa_seq, &ev);
-        snd_seq_drain_output(alsa_seq);
+        m_notes_on[ch].reset();
+        m_notes_on_count[ch] = 0;
     }
+    m_channels_used.reset();
+
+    drainOutput();
+}
+
+void MidiCommOut::SetLatency(microseconds_t latency) {
+
+    m_latency = latency;
+    UserSetting::Set(latencySettingKey("output_latency_", m_description.name), STRING(latency));
 }
 
 void MidiCommOut::Reconnect() {
     // We assume, that the client and the port is the same after device's reconnect
-    snd_seq_connect_to(alsa_seq, local_out, m_description.client, m_description.port);
+    backend->ConnectOutput(m_description);
 }
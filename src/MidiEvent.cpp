@@ -62,6 +62,16 @@ MidiEvent MidiEvent::Build(const MidiEventSimple& simple) {
     return ev;
 }
 
+MidiEvent MidiEvent::BuildSysEx(const string& data) {
+    MidiEvent ev;
+
+    ev.m_delta_pulses = 0;
+    ev.m_status = 0xF0;
+    ev.m_sysex = data;
+
+    return ev;
+}
+
 MidiEvent MidiEvent::NullEvent() {
     MidiEvent ev;
 
@@ -136,13 +146,23 @@ void MidiEvent::ReadMeta(istream& stream) {
 }
 
 void MidiEvent::ReadSysEx(istream& stream) {
-    // NOTE: We would have to keep SysEx events around if we
-    // wanted to reproduce 1:1 MIDIs between file Save/Load
+    // NOTE: Only the payload is kept, to be sent to the output device.
+    // Reproducing 1:1 MIDIs between file Save/Load would need more.
     unsigned long sys_ex_length = parse_variable_length(stream);
 
-    // Discard
     char *buffer = new char[sys_ex_length];
     stream.read(buffer, sys_ex_length);
+    if (stream.fail()) {
+        delete[] buffer;
+        throw MidiError(MidiError_EventTooShort);
+    }
+
+    // The file leaves the 0xF0 status byte out of the length, but the
+    // device needs it.  0xF7 events are sent as they are.
+    if (m_status == 0xF0)
+        m_sysex = string(1, static_cast<char>(0xF0));
+    m_sysex.append(buffer, sys_ex_length);
+
     delete[] buffer;
 }
 
@@ -0,0 +1,159 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include <iostream>
+#include <algorithm>
+#include <iomanip>
+#include <cstdlib>
+
+#include "MidiStats.h"
+#include "StringUtil.h"
+
+using namespace std;
+
+const static microseconds_t WindowLength = 1000000;
+
+MidiStats::MidiStats() :
+    m_window_start(-1),
+    m_started(-1),
+    m_events_in(0),
+    m_events_out(0),
+    m_drains(0),
+    m_frames(0),
+    m_frame_events_out(0),
+    m_largest_burst(0),
+    m_input_depth(0),
+    m_shown_events_in(0),
+    m_shown_events_out(0),
+    m_shown_drains_per_frame(0),
+    m_shown_largest_burst(0),
+    m_shown_input_depth(0),
+    m_shown_latency_samples(0),
+    m_shown_latency_median(0),
+    m_shown_latency_p95(0),
+    m_shown_latency_max(0) {
+
+    const char *csv = getenv("LINTHESIA_MIDI_STATS_CSV");
+    if (!csv || !*csv)
+        return;
+
+    m_csv.open(csv, ios::out | ios::app);
+    if (!m_csv) {
+        cout << "[WARNING] Cannot write MIDI statistics to '" << csv << "'" << endl;
+        return;
+    }
+
+    // Fresh file, name the columns
+    if (m_csv.tellp() == 0)
+        m_csv << "seconds,events_in_per_s,events_out_per_s,drains_per_frame,"
+                 "largest_output_burst,largest_input_depth,latency_samples,"
+                 "latency_median_us,latency_p95_us,latency_max_us" << endl;
+}
+
+void MidiStats::InputDepth(size_t depth) {
+
+    m_input_depth = max(m_input_depth, depth);
+}
+
+void MidiStats::ScoringLatency(microseconds_t latency) {
+
+    m_latencies.push_back(latency);
+}
+
+void MidiStats::Frame(microseconds_t now) {
+
+    m_frames++;
+    m_largest_burst = max(m_largest_burst, m_frame_events_out);
+    m_frame_events_out = 0;
+
+    if (m_window_start < 0) {
+        m_window_start = now;
+        m_started = now;
+    }
+
+    if (now - m_window_start < WindowLength)
+        return;
+
+    Publish(now - m_window_start);
+    WriteCsv();
+
+    m_window_start = now;
+    m_events_in = 0;
+    m_events_out = 0;
+    m_drains = 0;
+    m_frames = 0;
+    m_largest_burst = 0;
+    m_input_depth = 0;
+    m_latencies.clear();
+}
+
+void MidiStats::Publish(microseconds_t elapsed) {
+
+    const double seconds = static_cast<double>(elapsed) / 1000000.0;
+
+    m_shown_events_in = m_events_in / seconds;
+    m_shown_events_out = m_events_out / seconds;
+    m_shown_drains_per_frame = (m_frames > 0 ? static_cast<double>(m_drains) / m_frames : 0.0);
+    m_shown_largest_burst = m_largest_burst;
+    m_shown_input_depth = m_input_depth;
+
+    // A second of playing is a few dozen notes at most, sorting them is fine
+    m_shown_latency_samples = m_latencies.size();
+    m_shown_latency_median = 0;
+    m_shown_latency_p95 = 0;
+    m_shown_latency_max = 0;
+
+    if (m_latencies.empty())
+        return;
+
+    sort(m_latencies.begin(), m_latencies.end());
+    const size_t count = m_latencies.size();
+    m_shown_latency_median = m_latencies[count / 2];
+    m_shown_latency_p95 = m_latencies[min(count - 1, count * 95 / 100)];
+    m_shown_latency_max = m_latencies[count - 1];
+}
+
+void MidiStats::WriteCsv() {
+
+    if (!m_csv.is_open())
+        return;
+
+    m_csv << fixed << setprecision(3)
+          << (m_window_start - m_started) / 1000000.0 << ","
+          << m_shown_events_in << ","
+          << m_shown_events_out << ","
+          << m_shown_drains_per_frame << ","
+          << m_shown_largest_burst << ","
+          << m_shown_input_depth << ","
+          << m_shown_latency_samples << ","
+          << m_shown_latency_median << ","
+          << m_shown_latency_p95 << ","
+          << m_shown_latency_max << endl;
+}
+
+string MidiStats::Summary() const {
+
+    return STRING(fixed << setprecision(0)
+                  << "MIDI in: " << m_shown_events_in << "/s"
+                  << "  out: " << m_shown_events_out << "/s"
+                  << setprecision(2)
+                  << "  drains/frame: " << m_shown_drains_per_frame
+                  << "  burst: " << m_shown_largest_burst
+                  << "  queue: " << m_shown_input_depth
+                  << setprecision(1)
+                  << "  scoring latency (ms): " << m_shown_latency_median / 1000.0
+                  << " median, " << m_shown_latency_p95 / 1000.0
+                  << " p95, " << m_shown_latency_max / 1000.0
+                  << " max, " << m_shown_latency_samples << " notes");
+}
+
+MidiStats& midiStats() {
+
+    static MidiStats stats;
+    return stats;
+}
@@ -0,0 +1,77 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include "MidiTrackCursor.h"
+
+using namespace std;
+
+MidiTrackCursor::MidiTrackCursor() :
+    m_track(0),
+    m_next_event(0),
+    m_position(0) {
+}
+
+MidiTrackCursor::MidiTrackCursor(const MidiTrack& track) :
+    m_track(&track),
+    m_next_event(0),
+    m_position(0) {
+}
+
+MidiEventList MidiTrackCursor::SeekToFirstNote(microseconds_t lead_in) {
+
+    MidiEventList setup;
+    m_next_event = 0;
+    m_position = 0;
+
+    if (!m_track)
+        return setup;
+
+    const MidiEventList& events = m_track->Events();
+    const MidiEventMicrosecondList& usecs = m_track->EventUsecs();
+
+    size_t first_note = events.size();
+    for (size_t i = 0; i < events.size(); ++i) {
+        if (events[i].Type() == MidiEventType_NoteOn && events[i].NoteVelocity() > 0) {
+            first_note = i;
+            break;
+        }
+    }
+
+    if (first_note == events.size()) {
+        m_next_event = events.size();
+        return setup;
+    }
+
+    m_position = usecs[first_note] - lead_in;
+
+    // Nothing before the first note can sound, so only what sets up the
+    // channel is worth sending
+    for (; m_next_event < first_note && usecs[m_next_event] <= m_position; ++m_next_event) {
+        const MidiEventType type = events[m_next_event].Type();
+        if (type != MidiEventType_NoteOn && type != MidiEventType_NoteOff)
+            setup.push_back(events[m_next_event]);
+    }
+
+    return setup;
+}
+
+MidiEventList MidiTrackCursor::Update(microseconds_t delta_microseconds) {
+
+    MidiEventList evs;
+    if (!m_track)
+        return evs;
+
+    m_position += delta_microseconds;
+
+    const MidiEventList& events = m_track->Events();
+    const MidiEventMicrosecondList& usecs = m_track->EventUsecs();
+    for (; m_next_event < events.size() && usecs[m_next_event] <= m_position; ++m_next_event)
+        evs.push_back(events[m_next_event]);
+
+    return evs;
+}
@@ -0,0 +1,589 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+// Shaders and buffer objects are past the OpenGL 1.x headers
+#define GL_GLEXT_PROTOTYPES
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "NoteBuffer.h"
+#include "StringUtil.h"
+
+using namespace std;
+
+// Three quads a note: crown, middle and heel
+const static int VerticesPerNote = 12;
+
+// Attribute locations, bound before linking
+enum {
+    AttributeTime = 0,
+    AttributePlace,
+    AttributeTexel,
+    AttributeColor,
+    AttributeMissed
+};
+
+struct NoteVertex {
+
+    // Song time, microseconds
+    GLfloat start;
+    GLfloat end;
+
+    // Pixels, and which of the four edges of the note sections (top of
+    // the crown to bottom of the heel) this vertex sits on
+    GLshort x;
+    GLshort row;
+
+    // Texels, inside a single color of the texture
+    GLshort tex_x;
+    GLshort tex_y;
+
+    GLfloat color;
+};
+
+// The same as KeyboardDisplay::DrawNotePass() and DrawNote() do, vertex
+// by vertex.  int() truncates, as the casts there do.  The version and
+// MISSED_COLOR (Track::MissedNote) go in front, see linkProgram().
+const static char *VertexShader =
+    "uniform float now;\n"
+    "uniform float roll_under;\n"
+    "uniform float scale;\n"
+    "uniform float bottom;\n"
+    "uniform vec4 shape;\n"
+    "uniform float min_height;\n"
+    "uniform vec4 texture_map;\n"
+    "uniform float column;\n"
+    "attribute vec2 time;\n"
+    "attribute vec2 place;\n"
+    "attribute vec2 texel;\n"
+    "attribute float color;\n"
+    "attribute float missed;\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    float start = time.x - now;\n"
+    "    float end = time.y - now;\n"
+    "    float adjusted_start = max(start, -roll_under);\n"
+    "    float adjusted_end = max(end, 0.0);\n"
+    "    float y = bottom - float(int(adjusted_end * scale));\n"
+    "    float h = bottom - float(int(adjusted_start * scale)) - y;\n"
+    "    if (adjusted_start == start && adjusted_end == end)\n"
+    "        h = max(h, 3.0);\n"
+    "    if (h < min_height) {\n"
+    "        float diff = float(int(min_height - h));\n"
+    "        h += diff;\n"
+    "        y -= diff;\n"
+    "    }\n"
+    "    float y1 = float(int(y - shape.x));\n"
+    "    float y2 = float(int(y1 + shape.y));\n"
+    "    float y3 = float(int(y + h - shape.z));\n"
+    "    float y4 = float(int(y3 + shape.w));\n"
+    "    float edge = (place.y < 0.5 ? y1 : (place.y < 1.5 ? y2 : (place.y < 2.5 ? y3 : y4)));\n"
+    "    if (adjusted_end < adjusted_start)\n"
+    "        edge = bottom;\n"
+    "    float brush = (missed > 0.5 ? MISSED_COLOR : color);\n"
+    "    uv = vec2(texture_map.x + (brush * column + texel.x) * texture_map.y,\n"
+    "              texture_map.z - texel.y * texture_map.w);\n"
+    "    gl_FrontColor = gl_Color;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(place.x, edge, 0.0, 1.0);\n"
+    "}\n";
+
+const static char *FragmentShader =
+    "#version 120\n"
+    "uniform sampler2D note_texture;\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    gl_FragColor = texture2D(note_texture, uv) * gl_Color;\n"
+    "}\n";
+
+static bool isMissed(const TranslatedNote& note) {
+
+    return (note.state == UserMissed || note.retry_state == UserMissed);
+}
+
+static bool startsBefore(const TranslatedNote& note, microseconds_t time) {
+
+    return note.start < time;
+}
+
+static unsigned int compileShader(GLenum type, const char *source) {
+
+    const GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, 0);
+    glCompileShader(shader);
+
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled)
+        return shader;
+
+    char log[1024] = "";
+    glGetShaderInfoLog(shader, sizeof(log), 0, log);
+    cout << "[WARNING] Could not compile the note shader: " << log << endl;
+
+    glDeleteShader(shader);
+    return 0;
+}
+
+enum Uniform {
+    UniformNow,
+    UniformRollUnder,
+    UniformScale,
+    UniformBottom,
+    UniformShape,
+    UniformMinHeight,
+    UniformTexture,
+    UniformColumn,
+    UniformCount
+};
+
+// One program for every NoteBuffer, built by Available() and kept with
+// the context
+static GLuint program = 0;
+static GLint uniforms[UniformCount];
+
+static bool linkProgram() {
+
+    // Missed notes get the same color as on the CPU path
+    const string vertex_source = STRING("#version 120\n"
+                                        << "#define MISSED_COLOR " << Track::MissedNote << ".0\n"
+                                        << VertexShader);
+
+    const GLuint vertex = compileShader(GL_VERTEX_SHADER, vertex_source.c_str());
+    const GLuint fragment = compileShader(GL_FRAGMENT_SHADER, FragmentShader);
+    if (!vertex || !fragment) {
+        if (vertex)
+            glDeleteShader(vertex);
+        if (fragment)
+            glDeleteShader(fragment);
+        return false;
+    }
+
+    program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+
+    glBindAttribLocation(program, AttributeTime, "time");
+    glBindAttribLocation(program, AttributePlace, "place");
+    glBindAttribLocation(program, AttributeTexel, "texel");
+    glBindAttribLocation(program, AttributeColor, "color");
+    glBindAttribLocation(program, AttributeMissed, "missed");
+    glLinkProgram(program);
+
+    // The program keeps them
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        char log[1024] = "";
+        glGetProgramInfoLog(program, sizeof(log), 0, log);
+        cout << "[WARNING] Could not link the note shader: " << log << endl;
+
+        glDeleteProgram(program);
+        program = 0;
+        return false;
+    }
+
+    uniforms[UniformNow] = glGetUniformLocation(program, "now");
+    uniforms[UniformRollUnder] = glGetUniformLocation(program, "roll_under");
+    uniforms[UniformScale] = glGetUniformLocation(program, "scale");
+    uniforms[UniformBottom] = glGetUniformLocation(program, "bottom");
+    uniforms[UniformShape] = glGetUniformLocation(program, "shape");
+    uniforms[UniformMinHeight] = glGetUniformLocation(program, "min_height");
+    uniforms[UniformTexture] = glGetUniformLocation(program, "texture_map");
+    uniforms[UniformColumn] = glGetUniformLocation(program, "column");
+
+    return true;
+}
+
+// GLSL 1.20 came with OpenGL 2.1
+static bool glsl120Supported() {
+
+    const char *version = reinterpret_cast<const char *>(glGetString(GL_SHADING_LANGUAGE_VERSION));
+    int major = 0;
+    int minor = 0;
+    if (!version || sscanf(version, "%d.%d", &major, &minor) != 2)
+        return false;
+
+    return major > 1 || (major == 1 && minor >= 20);
+}
+
+struct NoteBufferObjects {
+
+    NoteBufferObjects() :
+        vertex_buffer(0),
+        state_buffer(0) {
+    }
+
+    ~NoteBufferObjects() {
+
+        if (vertex_buffer)
+            glDeleteBuffers(1, &vertex_buffer);
+        if (state_buffer)
+            glDeleteBuffers(1, &state_buffer);
+    }
+
+    unsigned int vertex_buffer;
+    unsigned int state_buffer;
+
+  private:
+    NoteBufferObjects(const NoteBufferObjects&);
+    NoteBufferObjects& operator=(const NoteBufferObjects&);
+};
+
+// What Build() made, going to the graphics card
+class FillNoteBuffers : public DrawCommand {
+  public:
+
+    // Takes the contents of vertices and states
+    FillNoteBuffers(shared_ptr<NoteBufferObjects> objects, vector<NoteVertex>& vertices,
+                    vector<GLubyte>& states) :
+        m_objects(objects) {
+
+        m_vertices.swap(vertices);
+        m_states.swap(states);
+    }
+
+    void Submit() {
+
+        glGenBuffers(1, &m_objects->vertex_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, m_objects->vertex_buffer);
+        glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(NoteVertex),
+                     m_vertices.empty() ? 0 : &m_vertices[0], GL_STATIC_DRAW);
+
+        glGenBuffers(1, &m_objects->state_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, m_objects->state_buffer);
+        glBufferData(GL_ARRAY_BUFFER, m_states.size(), m_states.empty() ? 0 : &m_states[0],
+                     GL_DYNAMIC_DRAW);
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+  private:
+    shared_ptr<NoteBufferObjects> m_objects;
+    vector<NoteVertex> m_vertices;
+    vector<GLubyte> m_states;
+};
+
+// The notes of one NoteBuffer::Part, one texture
+struct NoteDrawingPart {
+
+    unsigned int texture_id;
+    GLfloat texture_map[4];
+    GLfloat shape[4];
+    GLfloat min_height;
+    GLfloat column;
+
+    size_t first_vertex;
+    size_t vertex_count;
+};
+
+// One NoteBuffer::Draw()
+struct NoteDrawing : public DrawCommand {
+
+    NoteDrawing(shared_ptr<NoteBufferObjects> buffers) :
+        objects(buffers) {
+    }
+
+    void Submit();
+
+    shared_ptr<NoteBufferObjects> objects;
+    vector<pair<size_t, unsigned char> > changes;
+
+    GLfloat now;
+    GLfloat roll_under;
+    GLfloat scale;
+    GLfloat bottom;
+
+    // The buffers don't know about the renderer's offset
+    GLfloat x_offset;
+    GLfloat y_offset;
+
+    GLubyte color[4];
+    vector<NoteDrawingPart> parts;
+};
+
+void NoteDrawing::Submit() {
+
+    glBindBuffer(GL_ARRAY_BUFFER, objects->state_buffer);
+    for (size_t i = 0; i < changes.size(); ++i) {
+        const GLubyte value = changes[i].second;
+        const GLubyte states[VerticesPerNote] = { value, value, value, value, value, value,
+                                                  value, value, value, value, value, value };
+
+        glBufferSubData(GL_ARRAY_BUFFER, changes[i].first * VerticesPerNote, VerticesPerNote, states);
+    }
+
+    if (parts.empty()) {
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return;
+    }
+
+    glUseProgram(program);
+    glUniform1f(uniforms[UniformNow], now);
+    glUniform1f(uniforms[UniformRollUnder], roll_under);
+    glUniform1f(uniforms[UniformScale], scale);
+    glUniform1f(uniforms[UniformBottom], bottom);
+
+    glBindBuffer(GL_ARRAY_BUFFER, objects->vertex_buffer);
+    glEnableVertexAttribArray(AttributeTime);
+    glEnableVertexAttribArray(AttributePlace);
+    glEnableVertexAttribArray(AttributeTexel);
+    glEnableVertexAttribArray(AttributeColor);
+    glVertexAttribPointer(AttributeTime, 2, GL_FLOAT, GL_FALSE, sizeof(NoteVertex),
+                          reinterpret_cast<const GLvoid *>(offsetof(NoteVertex, start)));
+    glVertexAttribPointer(AttributePlace, 2, GL_SHORT, GL_FALSE, sizeof(NoteVertex),
+                          reinterpret_cast<const GLvoid *>(offsetof(NoteVertex, x)));
+    glVertexAttribPointer(AttributeTexel, 2, GL_SHORT, GL_FALSE, sizeof(NoteVertex),
+                          reinterpret_cast<const GLvoid *>(offsetof(NoteVertex, tex_x)));
+    glVertexAttribPointer(AttributeColor, 1, GL_FLOAT, GL_FALSE, sizeof(NoteVertex),
+                          reinterpret_cast<const GLvoid *>(offsetof(NoteVertex, color)));
+
+    glBindBuffer(GL_ARRAY_BUFFER, objects->state_buffer);
+    glEnableVertexAttribArray(AttributeMissed);
+    glVertexAttribPointer(AttributeMissed, 1, GL_UNSIGNED_BYTE, GL_FALSE, 0, 0);
+
+    glColor4ubv(color);
+
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glTranslatef(x_offset, y_offset, 0.);
+
+    for (size_t i = 0; i < parts.size(); ++i) {
+        const NoteDrawingPart& part = parts[i];
+
+        glUniform4fv(uniforms[UniformShape], 1, part.shape);
+        glUniform1f(uniforms[UniformMinHeight], part.min_height);
+        glUniform1f(uniforms[UniformColumn], part.column);
+        glUniform4fv(uniforms[UniformTexture], 1, part.texture_map);
+
+        glBindTexture(GL_TEXTURE_2D, part.texture_id);
+        glDrawArrays(GL_QUADS, static_cast<GLint>(part.first_vertex), static_cast<GLsizei>(part.vertex_count));
+    }
+
+    glPopMatrix();
+
+    glDisableVertexAttribArray(AttributeMissed);
+    glDisableVertexAttribArray(AttributeColor);
+    glDisableVertexAttribArray(AttributeTexel);
+    glDisableVertexAttribArray(AttributePlace);
+    glDisableVertexAttribArray(AttributeTime);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glUseProgram(0);
+}
+
+bool NoteBuffer::Available() {
+
+    const static bool turned_off = (getenv("LINTHESIA_NOTE_RENDERER") &&
+                                    strcmp(getenv("LINTHESIA_NOTE_RENDERER"), "cpu") == 0);
+    if (turned_off)
+        return false;
+
+    // Asked once, there has to be a context by then.  Notes are drawn by
+    // the CPU if the shader doesn't build.
+    const static bool works = glsl120Supported() && linkProgram();
+    return works;
+}
+
+NoteBuffer::NoteBuffer() {
+
+    m_white.shape = &m_white_shape;
+    m_white.first = 0;
+    m_black.shape = &m_black_shape;
+    m_black.first = 0;
+}
+
+NoteBuffer::~NoteBuffer() {
+}
+
+void NoteBuffer::Build(Renderer& renderer, const TranslatedNoteSet& notes,
+                       const vector<Track::Properties>& track_properties,
+                       const NoteLane lanes[128], const NoteShape& white, const NoteShape& black) {
+
+    // Frames still to be submitted may draw the old buffers
+    if (m_objects)
+        renderer.Hold(m_objects);
+
+    m_objects.reset();
+    m_white.notes.clear();
+    m_black.notes.clear();
+    m_missed.clear();
+    m_changes.clear();
+
+    if (!Available())
+        return;
+
+    m_white_shape = white;
+    m_black_shape = black;
+
+    for (TranslatedNoteSet::const_iterator i = notes.begin(); i != notes.end(); ++i) {
+        const Track::Mode mode = track_properties[i->track_id].mode;
+        if (mode == Track::ModeNotPlayed || mode == Track::ModePlayedButHidden)
+            continue;
+
+        if (i->note_id >= 128)
+            continue;
+
+        if (lanes[i->note_id].black)
+            m_black.notes.push_back(*i);
+        else
+            m_white.notes.push_back(*i);
+    }
+
+    m_white.first = 0;
+    m_black.first = m_white.notes.size();
+
+    const size_t note_count = m_white.notes.size() + m_black.notes.size();
+    vector<NoteVertex> vertices;
+    vertices.reserve(note_count * VerticesPerNote);
+    m_missed.reserve(note_count);
+
+    const Part *parts[2] = { &m_white, &m_black };
+    for (int p = 0; p < 2; ++p) {
+        const NoteShape& s = *parts[p]->shape;
+
+        // Top and bottom texel of each section
+        const int section_texels[4] = { 0, s.tex_crown_end, s.tex_heel_start, s.tex_height };
+
+        for (size_t n = 0; n < parts[p]->notes.size(); ++n) {
+            const TranslatedNote& note = parts[p]->notes[n];
+
+            const int left = int(lanes[note.note_id].left - s.left_offset);
+            const int right = left + s.width;
+
+            NoteVertex v;
+            v.start = static_cast<GLfloat>(note.start);
+            v.end = static_cast<GLfloat>(note.end);
+            v.color = static_cast<GLfloat>(track_properties[note.track_id].color);
+
+            for (int section = 0; section < 3; ++section) {
+
+                // Corners in the order glBegin(GL_QUADS) got them (see DrawList)
+                const int corner_x[4] = { left, left, right, right };
+                const int corner_row[4] = { section, section + 1, section + 1, section };
+                const int corner_tex_x[4] = { 0, 0, s.tex_width, s.tex_width };
+
+                for (int c = 0; c < 4; ++c) {
+                    v.x = static_cast<GLshort>(corner_x[c]);
+                    v.row = static_cast<GLshort>(corner_row[c]);
+                    v.tex_x = static_cast<GLshort>(corner_tex_x[c]);
+                    v.tex_y = static_cast<GLshort>(section_texels[corner_row[c]]);
+                    vertices.push_back(v);
+                }
+            }
+
+            m_missed.push_back(isMissed(note) ? 1 : 0);
+        }
+    }
+
+    vector<GLubyte> states;
+    states.reserve(note_count * VerticesPerNote);
+    for (size_t n = 0; n < m_missed.size(); ++n)
+        states.insert(states.end(), VerticesPerNote, m_missed[n]);
+
+    m_objects = make_shared<NoteBufferObjects>();
+    renderer.AddCommand(new FillNoteBuffers(m_objects, vertices, states));
+}
+
+long NoteBuffer::Find(const TranslatedNote& note) const {
+
+    const Part *parts[2] = { &m_white, &m_black };
+    for (int p = 0; p < 2; ++p) {
+        const vector<TranslatedNote>& n = parts[p]->notes;
+
+        vector<TranslatedNote>::const_iterator found = lower_bound(n.begin(), n.end(), note, TranslatedNote());
+        if (found != n.end() && !TranslatedNote()(note, *found))
+            return static_cast<long>(parts[p]->first + (found - n.begin()));
+    }
+
+    return -1;
+}
+
+void NoteBuffer::NoteChanged(const TranslatedNote& note) {
+
+    if (!IsBuilt())
+        return;
+
+    const long index = Find(note);
+    if (index < 0)
+        return;
+
+    const unsigned char value = (isMissed(note) ? 1 : 0);
+    if (m_missed[index] == value)
+        return;
+
+    m_missed[index] = value;
+    m_changes.push_back(make_pair(static_cast<size_t>(index), value));
+}
+
+void NoteBuffer::Draw(Renderer& renderer, const Tga *tex_white, const Tga *tex_black,
+                      microseconds_t current_time, microseconds_t longest_note, microseconds_t show_duration,
+                      double scaling_factor, long long roll_under, int bottom) {
+
+    if (!IsBuilt())
+        return;
+
+    NoteDrawing *drawing = new NoteDrawing(m_objects);
+    drawing->changes.swap(m_changes);
+
+    drawing->now = static_cast<GLfloat>(current_time);
+    drawing->roll_under = static_cast<GLfloat>(roll_under);
+    drawing->scale = static_cast<GLfloat>(scaling_factor);
+    drawing->bottom = static_cast<GLfloat>(bottom);
+    drawing->x_offset = static_cast<GLfloat>(renderer.m_xoffset);
+    drawing->y_offset = static_cast<GLfloat>(renderer.m_yoffset);
+    copy(renderer.m_list->GetColor(), renderer.m_list->GetColor() + 4, drawing->color);
+
+    DrawPart(drawing, m_white, tex_white, current_time, longest_note, show_duration);
+    DrawPart(drawing, m_black, tex_black, current_time, longest_note, show_duration);
+
+    // After the quads drawn so far
+    renderer.AddCommand(drawing);
+}
+
+void NoteBuffer::DrawPart(NoteDrawing *drawing, const Part& part, const Tga *tex, microseconds_t current_time,
+                          microseconds_t longest_note, microseconds_t show_duration) {
+
+    // Only the notes that can be on screen, see KeyboardDisplay::GatherVisibleNotes()
+    vector<TranslatedNote>::const_iterator first =
+        lower_bound(part.notes.begin(), part.notes.end(), current_time - longest_note, startsBefore);
+    vector<TranslatedNote>::const_iterator last =
+        lower_bound(first, part.notes.end(), current_time + show_duration + 1, startsBefore);
+
+    if (first == last)
+        return;
+
+    const NoteShape& s = *part.shape;
+
+    NoteDrawingPart drawn;
+    drawn.shape[0] = static_cast<GLfloat>(s.crown_start);
+    drawn.shape[1] = static_cast<GLfloat>(s.crown_end);
+    drawn.shape[2] = static_cast<GLfloat>(s.heel_height);
+    drawn.shape[3] = static_cast<GLfloat>(s.bottom_height);
+    drawn.min_height = static_cast<GLfloat>(s.min_height);
+    drawn.column = static_cast<GLfloat>(s.tex_width);
+
+    // The texture may be a part of an atlas, see Tga::TexU() and TexV()
+    drawn.texture_id = tex->GetId();
+    drawn.texture_map[0] = static_cast<GLfloat>(tex->TexU(0));
+    drawn.texture_map[1] = static_cast<GLfloat>(tex->TexU(1) - tex->TexU(0));
+    drawn.texture_map[2] = static_cast<GLfloat>(tex->TexV(0));
+    drawn.texture_map[3] = static_cast<GLfloat>(tex->TexV(0) - tex->TexV(1));
+
+    drawn.first_vertex = (part.first + (first - part.notes.begin())) * VerticesPerNote;
+    drawn.vertex_count = (last - first) * VerticesPerNote;
+
+    drawing->parts.push_back(drawn);
+}
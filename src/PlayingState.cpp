@@ -7,6 +7,7 @@
 // See COPYING for license information
 
 #include "PlayingState.h"
+#include "MidiStats.h"
 #include "TrackSelectionState.h"
 #include "StatsState.h"
 
@@ -16,9 +17,11 @@ void PlayingState::SetupNoteState() {
 
     TranslatedNoteSet old = m_notes;
     m_notes.clear();
+    m_longest_note = 0;
 
     for (TranslatedNoteSet::const_iterator i = old.begin(); i != old.end(); ++i) {
         TranslatedNote n = *i;
+        m_longest_note = max(m_longest_note, n.end - n.start);
 
         n.state = AutoPlayed;
         n.retry_state = AutoPlayed;
@@ -29,6 +32,9 @@ void PlayingState::SetupNoteState() {
 
         m_notes.insert(n);
     }
+
+    if (m_keyboard)
+        m_keyboard->ResetNotes();
 }
 
 void PlayingState::ResetSong() {
@@ -48,6 +54,7 @@ void PlayingState::ResetSong() {
         return;
 
     m_state.midi->Reset(LeadIn, LeadOut);
+    m_scheduled_until = m_state.midi->GetSongPositionInMicroseconds();
 
     m_notes = m_state.midi->Notes();
     m_notes_history.clear();
@@ -69,8 +76,10 @@ void PlayingState::ResetSong() {
 PlayingState::PlayingState(const SharedState& state) :
     m_paused(false),
     m_keyboard(0),
+    m_longest_note(0),
     m_any_you_play_tracks(false),
     m_first_update(true),
+    m_scheduled_until(0),
     m_should_retry(false),
     m_should_wait_after_retry(false),
     m_retry_start(0),
@@ -105,9 +114,13 @@ void PlayingState::Init() {
     Compatible::HideMouseCursor();
 
     ResetSong();
+
+    // The user's notes go straight to the output, routed by UpdateThruRoutes()
+    midiSetThru(m_state.midi_out);
 }
 
 PlayingState::~PlayingState() {
+    midiSetThru(0);
     Compatible::ShowMouseCursor();
 }
 
@@ -126,73 +139,132 @@ void PlayingState::Play(microseconds_t delta_microseconds) {
     // Move notes, time tracking, everything
     // delta_microseconds = 0 means, that we are on pause
     MidiEventListWithTrackId evs = m_state.midi->Update(delta_microseconds);
+    const microseconds_t song_time = m_state.midi->GetSongPositionInMicroseconds();
 
-    // These cycle is for keyboard updates (not falling keys)
+    // These cycle is for keyboard updates (not falling keys).  Sound is not
+    // sent from here, see ScheduleOutput().
     const size_t length = evs.size();
     for (size_t i = 0; i < length; ++i) {
 
         const size_t& track_id = evs[i].first;
         const MidiEvent& ev = evs[i].second;
 
+        if (ev.Type() != MidiEventType_NoteOn && ev.Type() != MidiEventType_NoteOff)
+            continue;
+
         // Draw refers to the keys lighting up (automatically) -- not necessarily
         // the falling notes.  The KeyboardDisplay object contains its own logic
         // to decide how to draw the falling notes
-        bool draw = false;
-        bool play = false;
-        switch (m_state.track_properties[track_id].mode) {
-            case Track::ModeNotPlayed: draw = false;
-                play = false;
-                break;
-            case Track::ModePlayedButHidden: draw = false;
-                play = true;
-                break;
-            case Track::ModeYouPlay: draw = false;
-                play = false;
-                break;
-            case Track::ModeYouPlaySilently: draw = false;
-                play = false;
-                break;
-            case Track::ModeLearning: draw = false;
-                play = false;
-                break;
-            case Track::ModeLearningSilently: draw = false;
-                play = false;
-                break;
-            case Track::ModePlayedAutomatically: draw = true;
-                play = true;
-                break;
-            case Track::ModeCount: break;
-        }
+        bool draw = (m_state.track_properties[track_id].mode == Track::ModePlayedAutomatically);
+
+        int vel = ev.NoteVelocity();
+
+        bool active = (vel > 0);
+        // Display pressed or released a key based on information from a MIDI-file.
+        // If this line is deleted, than no notes will be pressed automatically.
+        // It is not related to falling notes.
+        if (draw)
+            m_keyboard->SetKeyActive(ev.NoteNumber(), active, m_state.track_properties[track_id].color,
+                                     KeyLitBySong, song_time);
+        filePressedKey(ev.NoteNumber(), active, track_id);
+    }
+}
 
-        // Even in "You Play" tracks, we have to play the non-note
-        // events as per usual.
-        if (m_state.track_properties[track_id].mode
-            && ev.Type() != MidiEventType_NoteOn
-            && ev.Type() != MidiEventType_NoteOff)
-            play = true;
-
-        if (ev.Type() == MidiEventType_NoteOn || ev.Type() == MidiEventType_NoteOff) {
-            int vel = ev.NoteVelocity();
-            const string name = MidiEvent::NoteName(ev.NoteNumber());
-
-            bool active = (vel > 0);
-            // Display pressed or released a key based on information from a MIDI-file.
-            // If this line is deleted, than no notes will be pressed automatically.
-            // It is not related to falling notes.
-            if (draw)
-                m_keyboard->SetKeyActive(name, active, m_state.track_properties[track_id].color);
-            filePressedKey(ev.NoteNumber(), active, track_id);
-        }
+bool PlayingState::ShouldPlayEvent(size_t track_id, const MidiEvent& ev) const {
+
+    bool play = false;
+    switch (m_state.track_properties[track_id].mode) {
+        case Track::ModePlayedButHidden:
+        case Track::ModePlayedAutomatically: play = true;
+            break;
+        default: break;
+    }
+
+    // Even in "You Play" tracks, we have to play the non-note
+    // events as per usual.
+    if (m_state.track_properties[track_id].mode
+        && ev.Type() != MidiEventType_NoteOn
+        && ev.Type() != MidiEventType_NoteOff)
+        play = true;
+
+    return play;
+}
+
+bool PlayingState::CanScheduleAhead() const {
+
+    if (m_paused || m_state.song_speed == 0)
+        return false;
+
+    // The song may stop and wait for the user at any note, so nothing
+    // can be sent before it is actually reached
+    if (m_should_wait_after_retry)
+        return false;
+
+    for (size_t i = 0; i < m_state.track_properties.size(); ++i) {
+        if (m_state.track_properties[i].mode == Track::ModeLearning ||
+            m_state.track_properties[i].mode == Track::ModeLearningSilently)
+            return false;
+    }
+
+    return true;
+}
+
+void PlayingState::ScheduleOutput() {
+
+    // How far ahead (in real time) file events are handed to the sequencer.
+    // Long enough to ride over a slow frame, short enough to react quickly
+    // to pause, seek and speed changes.
+    const static microseconds_t OutputLookAhead = 60000;
+
+    const microseconds_t cur_time = m_state.midi->GetSongPositionInMicroseconds();
+
+    // Events are sent early by the calibrated output latency, so they are
+    // heard when their notes reach the keyboard
+    microseconds_t output_latency = 0;
+    if (m_state.midi_out)
+        output_latency = m_state.midi_out->GetLatency();
+
+    microseconds_t horizon = cur_time;
+    if (CanScheduleAhead())
+        horizon += (OutputLookAhead + output_latency) * m_state.song_speed / 100;
+
+    if (horizon <= m_scheduled_until)
+        return;
+
+    if (m_state.midi_out) {
+        TimedMidiEventList evs = m_state.midi->EventsInRange(m_scheduled_until, horizon);
+        m_state.midi_out->StartBatch();
+
+        const size_t length = evs.size();
+        for (size_t i = 0; i < length; ++i) {
+            if (!ShouldPlayEvent(evs[i].track_id, evs[i].event))
+                continue;
+
+            // Song time to real time, at the current speed
+            microseconds_t delay = 0;
+            if (evs[i].usecs > cur_time && m_state.song_speed > 0)
+                delay = (evs[i].usecs - cur_time) * 100 / m_state.song_speed - output_latency;
 
-        if (play && m_state.midi_out) {
             // Clone event
-            MidiEvent ev_out = ev;
-            int vel = ev.NoteVelocity();
+            MidiEvent ev_out = evs[i].event;
+            int vel = ev_out.NoteVelocity();
             // Scale note's volume before playing
             ev_out.SetVelocity(vel * m_state.base_volume);
-            m_state.midi_out->Write(ev_out);
+            m_state.midi_out->Schedule(ev_out, delay);
         }
     }
+
+    m_scheduled_until = horizon;
+}
+
+void PlayingState::RescheduleOutput() {
+
+    // Whatever was sent ahead was timed for the old song position or
+    // speed.  Take it back and start over from where the song is now.
+    if (m_state.midi_out)
+        m_state.midi_out->Flush();
+
+    m_scheduled_until = m_state.midi->GetSongPositionInMicroseconds();
 }
 
 double PlayingState::CalculateScoreMultiplier() const {
@@ -209,15 +281,25 @@ void PlayingState::Listen() {
     if (!m_state.midi_in)
         return;
 
+    if (m_state.midi_in->ShouldReconnect()) {
+        m_state.midi_in->Reconnect();
+        if (m_state.midi_out)
+            m_state.midi_out->Reconnect();
+    }
+
+    // The key was pressed a little before its event reached us
+    const microseconds_t input_latency = m_state.midi_in->GetLatency();
+    const microseconds_t now = midiNow();
+
     while (m_state.midi_in->KeepReading()) {
 
-        microseconds_t cur_time = m_state.midi->GetSongPositionInMicroseconds();
-        MidiEvent ev = m_state.midi_in->Read();
-        if (m_state.midi_in->ShouldReconnect()) {
-            m_state.midi_in->Reconnect();
-            m_state.midi_out->Reconnect();
-            continue;
-        }
+        // Score the event at the song time it arrived, not at the time
+        // we got around to reading it
+        microseconds_t arrival = now;
+        MidiEvent ev = m_state.midi_in->Read(&arrival);
+
+        const microseconds_t age = max(static_cast<microseconds_t>(0), now - arrival) + input_latency;
+        microseconds_t cur_time = m_state.midi->GetSongPositionInMicroseconds() - age * m_state.song_speed / 100;
 
 
         // Just eat input if we're paused
@@ -228,37 +310,22 @@ void PlayingState::Listen() {
         if (ev.Type() != MidiEventType_NoteOn && ev.Type() != MidiEventType_NoteOff)
             continue;
 
+        if (ev.Type() == MidiEventType_NoteOn && ev.NoteVelocity() > 0)
+            midiStats().ScoringLatency(now - arrival);
+
         // Octave Sliding
         ev.ShiftNote(m_note_offset);
 
         int note_number = ev.NoteNumber();
-        string note_name = MidiEvent::NoteName(note_number);
 
         // On key release we have to look for existing "active" notes and turn them off.
         if (ev.Type() == MidiEventType_NoteOff || ev.NoteVelocity() == 0) {
 
-            // NOTE: This assumes mono-channel input.  If they're piping an entire MIDI file
-            //       (or even the *same* MIDI file) through another source, we could get the
-            //       same NoteId on different channels -- and this code would start behaving
-            //       incorrectly.
-            for (ActiveNoteSet::iterator i = m_active_notes.begin(); i != m_active_notes.end(); ++i) {
-                if (ev.NoteNumber() != i->note_id)
-                    continue;
-
-                // Play it on the correct channel to turn the note we started
-                // previously, off.
-                ev.SetChannel(i->channel);
-                if (m_state.midi_out)
-                    m_state.midi_out->Write(ev);
-
-                m_active_notes.erase(i);
-                break;
-            }
-
+            // The Note-Off already went out with the thru routing
             // User releases the key
             // If we delete this line, than all pressed keys will be gray until
             // it is unpressed automatically
-            m_keyboard->SetKeyActive(note_name, false, Track::FlatGray);
+            m_keyboard->SetKeyActive(note_number, false, Track::FlatGray, KeyLitByStray, cur_time);
             userPressedKey(note_number, false);
             continue;
         }
@@ -298,28 +365,13 @@ void PlayingState::Listen() {
         }
 
         Track::TrackColor note_color = Track::FlatGray;
+        KeyLitBy lit_by = KeyLitByStray;
 
         if (closest_match != m_notes.end()) {
             note_color = m_state.track_properties[closest_match->track_id].color;
+            lit_by = KeyLitByHit;
 
-            // "Open" this note so we can catch the close later and turn off
-            // the note.
-            ActiveNote n;
-            n.channel = closest_match->channel;
-            n.note_id = closest_match->note_id;
-            n.velocity = closest_match->velocity;
-            m_active_notes.insert(n);
-
-            // Play it
-            ev.SetChannel(n.channel);
-            ev.SetVelocity(n.velocity);
-
-            bool silently =
-                m_state.track_properties[closest_match->track_id].mode == Track::ModeYouPlaySilently ||
-                    m_state.track_properties[closest_match->track_id].mode == Track::ModeLearningSilently;
-            if (m_state.midi_out && !silently)
-                m_state.midi_out->Write(ev);
-
+            // The note itself was played by the thru routing as it arrived
             // Adjust our statistics
             const static double NoteValue = 100.0;
             m_state.stats.score += NoteValue * CalculateScoreMultiplier() * (m_state.song_speed / 100.0);
@@ -346,11 +398,79 @@ void PlayingState::Listen() {
         //
         // If we comment this code, than a missed user pressed key will not shown.
         // But correct presed key will be shown as usual.
-        m_keyboard->SetKeyActive(note_name, true, note_color);
+        m_keyboard->SetKeyActive(note_number, true, note_color, lit_by, cur_time);
         userPressedKey(note_number, true);
     }
 }
 
+void PlayingState::UpdateThruRoutes() {
+
+    if (!m_state.midi_out)
+        return;
+
+    MidiThruRoute routes[128];
+    microseconds_t distances[128];
+    bool found[128];
+
+    for (int i = 0; i < 128; ++i) {
+        routes[i].enabled = false;
+        found[i] = false;
+    }
+
+    // Input is eaten while paused
+    if (m_paused) {
+        midiSetThruRoutes(routes);
+        return;
+    }
+
+    // Same matching as Listen() does, for a key pressed right now
+    microseconds_t cur_time = m_state.midi->GetSongPositionInMicroseconds();
+    if (m_state.midi_in)
+        cur_time -= m_state.midi_in->GetLatency() * m_state.song_speed / 100;
+
+    for (TranslatedNoteSet::const_iterator i = m_notes.begin(); i != m_notes.end(); ++i) {
+
+        const microseconds_t window_start = i->start - (KeyboardDisplay::NoteWindowLength / 2);
+        const microseconds_t window_end = i->start + (KeyboardDisplay::NoteWindowLength / 2);
+
+        if (window_start > cur_time)
+            break;
+
+        if (i->state != UserPlayable || window_end <= cur_time)
+            continue;
+
+        // Keys are routed before octave sliding
+        const int pitch = i->note_id - m_note_offset;
+        if (pitch < 0 || pitch > 127)
+            continue;
+
+        microseconds_t distance = cur_time - i->start;
+        if (i->start > cur_time)
+            distance = i->start - cur_time;
+
+        if (found[pitch] && distances[pitch] <= distance)
+            continue;
+
+        const Track::Mode mode = m_state.track_properties[i->track_id].mode;
+        const bool silently = (mode == Track::ModeYouPlaySilently || mode == Track::ModeLearningSilently);
+
+        found[pitch] = true;
+        distances[pitch] = distance;
+
+        routes[pitch].enabled = !silently;
+        routes[pitch].channel = i->channel;
+        routes[pitch].note = static_cast<unsigned char>(i->note_id);
+        routes[pitch].velocity = static_cast<unsigned char>(i->velocity);
+    }
+
+    midiSetThruRoutes(routes);
+}
+
+bool PlayingState::IsAnimating() const {
+
+    return !m_paused;
+}
+
 void PlayingState::Update() {
 
     // Calculate how visible the title bar should be
@@ -389,6 +509,7 @@ void PlayingState::Update() {
     if (!m_first_update) {
         if (areAllRequiredKeysPressed()) {
             Play(delta_microseconds);
+            ScheduleOutput();
 //      m_should_wait_after_retry = false; // always reset onces pressed
         } else
             m_current_combo = 0;
@@ -397,9 +518,15 @@ void PlayingState::Update() {
     }
 
     m_first_update = false;
+    UpdateThruRoutes();
 
     microseconds_t cur_time = m_state.midi->GetSongPositionInMicroseconds();
 
+    // Presses that are still on their way from the device may hit a note
+    // whose window just closed, so wait for them before calling it missed
+    if (m_state.midi_in)
+        cur_time -= max(static_cast<microseconds_t>(0), m_state.midi_in->GetLatency()) * m_state.song_speed / 100;
+
     // Delete notes that are finished playing (and are no longer available to hit)
     TranslatedNoteSet::iterator i = m_notes.begin();
     while (i != m_notes.end()) {
@@ -416,6 +543,7 @@ void PlayingState::Update() {
 
             // Re-connect the (now-invalid) iterator to the replacement
             note = m_notes.find(note_copy);
+            m_keyboard->NoteChanged(*note);
 
             if (m_state.track_properties[note->track_id].is_retry_on
                 && !m_should_wait_after_retry)
@@ -469,12 +597,14 @@ void PlayingState::Update() {
         m_state.song_speed -= 10;
         if (m_state.song_speed < 0)
             m_state.song_speed = 0;
+        RescheduleOutput();
     }
 
     if (IsKeyPressed(KeyRight)) {
         m_state.song_speed += 10;
         if (m_state.song_speed > 400)
             m_state.song_speed = 400;
+        RescheduleOutput();
     }
 
     if (IsKeyPressed(KeyVolumeDown)) {
@@ -503,6 +633,7 @@ void PlayingState::Update() {
         m_should_retry = false;
         m_should_wait_after_retry = false;
         m_retry_start = new_time;
+        m_scheduled_until = new_time;
     } else if (IsKeyPressed(KeyBackward)) {
         // Go 5 seconds back
         microseconds_t cur_time = m_state.midi->GetSongPositionInMicroseconds();
@@ -517,6 +648,7 @@ void PlayingState::Update() {
         m_should_retry = false;
         m_should_wait_after_retry = false;
         m_retry_start = new_time;
+        m_scheduled_until = new_time;
     } else {
         // Check retry conditions
         // track_properties
@@ -553,8 +685,10 @@ void PlayingState::Update() {
                 // from SetupNoteState
                 m_notes.clear();
                 m_notes_history.clear();
+                m_longest_note = 0;
                 for (TranslatedNoteSet::iterator i = def.begin(); i != def.end(); i++) {
                     TranslatedNote n = *i;
+                    m_longest_note = max(m_longest_note, n.end - n.start);
 
                     n.state = AutoPlayed;
                     n.retry_state = AutoPlayed;
@@ -568,6 +702,8 @@ void PlayingState::Update() {
 
                 // To avoid checks for keys that start before and stop after new_time
                 eraseUntilTime(new_time);
+                m_keyboard->ResetNotes();
+                m_scheduled_until = new_time;
             } else {
                 // Handle new retry block
                 m_retry_start = cur_time;
@@ -575,8 +711,10 @@ void PlayingState::Update() {
         }
     }
 
-    if (IsKeyPressed(KeySpace))
+    if (IsKeyPressed(KeySpace)) {
         m_paused = !m_paused;
+        RescheduleOutput();
+    }
 
     if (IsKeyPressed(KeyEscape)) {
         if (m_state.midi_out)
@@ -616,10 +754,9 @@ void PlayingState::Draw(Renderer& renderer) const {
                               GetTexture(PlayNotesBlackShadow, true),
                               GetTexture(PlayNotesWhiteColor, true),
                               GetTexture(PlayNotesBlackColor, true)};
-    renderer.ForceTexture(0);
 
     // Draw a keyboard, fallen keys and background for them
-    m_keyboard->Draw(renderer, key_tex, note_tex, Layout::ScreenMarginX, 0, m_notes, m_show_duration,
+    m_keyboard->Draw(renderer, key_tex, note_tex, Layout::ScreenMarginX, 0, m_notes, m_longest_note, m_show_duration,
                      m_state.midi->GetSongPositionInMicroseconds(), m_state.track_properties,
                      m_state.midi->GetBarLines());
 
@@ -0,0 +1,446 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include <string>
+#include <iostream>
+#include <cerrno>
+#include <chrono>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "RawMidiBackend.h"
+#include "CompatibleSystem.h"
+#include "StringUtil.h"
+
+using namespace std;
+
+// The PC keyboard, which has no raw device of its own
+const static int KeyboardCard = -1;
+
+// How soon the output thread tries again when the device buffer is full
+const static microseconds_t OutputRetry = 1000;
+
+// Where on the card a device is: port is device * 256 + subdevice
+static string deviceName(const MidiCommDescription& device) {
+
+    return STRING("hw:" << device.client << "," << (device.port >> 8) << "," << (device.port & 0xFF));
+}
+
+RawMidiBackend::RawMidiBackend() :
+    m_in(NULL),
+    m_out(NULL),
+    m_epoll_fd(-1),
+    m_should_exit(false) {
+}
+
+RawMidiBackend::~RawMidiBackend() {
+
+    Close();
+}
+
+string RawMidiBackend::Open() {
+
+    m_epoll_fd = epoll_create1(0);
+    if (m_epoll_fd < 0)
+        return "Could not watch the raw MIDI devices. No MIDI available";
+
+    m_should_exit = false;
+    m_output_thread = thread(&RawMidiBackend::runOutput, this);
+
+    Rescan();
+    return "";
+}
+
+void RawMidiBackend::Close() {
+
+    CloseInput();
+
+    if (m_output_thread.joinable()) {
+        {
+            lock_guard<mutex> lock(m_out_mutex);
+            m_should_exit = true;
+        }
+
+        m_out_changed.notify_all();
+        m_output_thread.join();
+    }
+
+    if (m_out != NULL) {
+        SendDue();
+        snd_rawmidi_close(m_out);
+        m_out = NULL;
+    }
+
+    if (m_epoll_fd >= 0) {
+        close(m_epoll_fd);
+        m_epoll_fd = -1;
+    }
+}
+
+MidiCommDescriptionList RawMidiBackend::InputDevices() const {
+
+    return m_inputs;
+}
+
+MidiCommDescriptionList RawMidiBackend::OutputDevices() const {
+
+    return m_outputs;
+}
+
+void RawMidiBackend::Rescan() {
+
+    m_inputs.clear();
+    m_outputs.clear();
+
+    int card = -1;
+    while (snd_card_next(&card) >= 0 && card >= 0) {
+        Enumerate(card, SND_RAWMIDI_STREAM_INPUT, m_inputs);
+        Enumerate(card, SND_RAWMIDI_STREAM_OUTPUT, m_outputs);
+    }
+
+    MidiCommDescription d;
+    d.id = static_cast<unsigned int>(m_inputs.size());
+    d.name = "Linthesia Keyboard";
+    d.client = KeyboardCard;
+    d.port = 0;
+    d.backend = 0;
+    m_inputs.push_back(d);
+}
+
+void RawMidiBackend::Enumerate(int card, snd_rawmidi_stream_t stream,
+                               MidiCommDescriptionList& devices) const {
+
+    snd_ctl_t *ctl;
+    if (snd_ctl_open(&ctl, STRING("hw:" << card).c_str(), 0) < 0)
+        return;
+
+    snd_rawmidi_info_t *info;
+    snd_rawmidi_info_alloca(&info);
+
+    int device = -1;
+    while (snd_ctl_rawmidi_next_device(ctl, &device) >= 0 && device >= 0) {
+
+        snd_rawmidi_info_set_device(info, device);
+        snd_rawmidi_info_set_subdevice(info, 0);
+        snd_rawmidi_info_set_stream(info, stream);
+
+        // The device doesn't go this way
+        if (snd_ctl_rawmidi_info(ctl, info) < 0)
+            continue;
+
+        const unsigned int subdevices = snd_rawmidi_info_get_subdevices_count(info);
+        for (unsigned int sub = 0; sub < subdevices; ++sub) {
+
+            snd_rawmidi_info_set_subdevice(info, sub);
+            if (snd_ctl_rawmidi_info(ctl, info) < 0)
+                continue;
+
+            string name = snd_rawmidi_info_get_name(info);
+            const string sub_name = snd_rawmidi_info_get_subdevice_name(info);
+            if (subdevices > 1 && !sub_name.empty())
+                name = sub_name;
+
+            MidiCommDescription d;
+            d.id = static_cast<unsigned int>(devices.size());
+            d.client = card;
+            d.port = (device << 8) | sub;
+            d.backend = 0;
+            d.name = STRING(name << " (" << deviceName(d) << ")");
+
+            devices.push_back(d);
+        }
+    }
+
+    snd_ctl_close(ctl);
+}
+
+bool RawMidiBackend::IsKeyboard(const MidiCommDescription& device) const {
+
+    return device.client == KeyboardCard;
+}
+
+string RawMidiBackend::ConnectInput(const MidiCommDescription& device) {
+
+    if (m_epoll_fd < 0)
+        return "MIDI is not available";
+
+    CloseInput();
+
+    int err = snd_rawmidi_open(&m_in, NULL, deviceName(device).c_str(), SND_RAWMIDI_NONBLOCK);
+    if (err < 0) {
+        m_in = NULL;
+        return snd_strerror(err);
+    }
+
+    int count = snd_rawmidi_poll_descriptors_count(m_in);
+    if (count > 0) {
+        m_in_fds.resize(count);
+        count = snd_rawmidi_poll_descriptors(m_in, &m_in_fds[0], count);
+        m_in_fds.resize(count > 0 ? count : 0);
+    }
+
+    for (size_t i = 0; i < m_in_fds.size(); ++i) {
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = m_in_fds[i].fd;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_in_fds[i].fd, &ev);
+    }
+
+    m_parser.Reset();
+    return "";
+}
+
+void RawMidiBackend::CloseInput() {
+
+    if (m_in == NULL)
+        return;
+
+    for (size_t i = 0; i < m_in_fds.size(); ++i)
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, m_in_fds[i].fd, NULL);
+    m_in_fds.clear();
+
+    snd_rawmidi_close(m_in);
+    m_in = NULL;
+}
+
+void RawMidiBackend::DisconnectInput(const MidiCommDescription&) {
+
+    CloseInput();
+}
+
+string RawMidiBackend::ConnectOutput(const MidiCommDescription& device) {
+
+    if (m_epoll_fd < 0)
+        return "MIDI is not available";
+
+    if (m_out != NULL)
+        DisconnectOutput(device);
+
+    lock_guard<mutex> lock(m_out_mutex);
+    int err = snd_rawmidi_open(NULL, &m_out, deviceName(device).c_str(), SND_RAWMIDI_NONBLOCK);
+    if (err < 0) {
+        m_out = NULL;
+        return snd_strerror(err);
+    }
+
+    return "";
+}
+
+void RawMidiBackend::DisconnectOutput(const MidiCommDescription&) {
+
+    lock_guard<mutex> lock(m_out_mutex);
+    if (m_out == NULL)
+        return;
+
+    // Send what is due, the rest was meant for this device only
+    SendDue();
+    m_out_bytes.clear();
+    m_scheduled.clear();
+
+    snd_rawmidi_close(m_out);
+    m_out = NULL;
+}
+
+unsigned int RawMidiBackend::ReadBatch(MidiBackendEventList& events) {
+
+    if (m_in == NULL)
+        return MidiReadNothing;
+
+    unsigned int result = MidiReadNothing;
+    microseconds_t arrival = 0;
+
+    unsigned char buffer[256];
+    while (true) {
+        long got = snd_rawmidi_read(m_in, buffer, sizeof(buffer));
+        if (got == -EAGAIN || got == 0)
+            break;
+
+        if (got < 0) {
+            // Unplugged, most likely
+            cout << "[WARNING] Raw MIDI input lost: " << snd_strerror(static_cast<int>(got)) << endl;
+            CloseInput();
+            Rescan();
+            result |= MidiReadSomething | MidiReadDevicesChanged;
+            break;
+        }
+
+        // Everything in the batch arrived by now
+        if (result == MidiReadNothing)
+            arrival = Now();
+
+        result |= MidiReadSomething;
+        m_parser.Feed(buffer, static_cast<size_t>(got), m_parsed);
+    }
+
+    for (size_t i = 0; i < m_parsed.size(); ++i) {
+
+        // The same as the sequencer lets through
+        const MidiEventType type = m_parsed[i].Type();
+        if (type != MidiEventType_NoteOn && type != MidiEventType_NoteOff &&
+            type != MidiEventType_ProgramChange)
+            continue;
+
+        MidiBackendEvent in;
+        if (!m_parsed[i].GetSimpleEvent(&in.event))
+            continue;
+
+        in.arrival = arrival;
+        events.push_back(in);
+    }
+    m_parsed.clear();
+
+    return result;
+}
+
+void RawMidiBackend::DropInput() {
+
+    if (m_in == NULL)
+        return;
+
+    unsigned char buffer[256];
+    while (snd_rawmidi_read(m_in, buffer, sizeof(buffer)) > 0) {
+    }
+
+    m_parser.Reset();
+}
+
+void RawMidiBackend::Encode(const MidiEvent& out) {
+
+    if (out.Type() == MidiEventType_SysEx) {
+        m_out_bytes += out.SysExData();
+        return;
+    }
+
+    MidiEventSimple simple;
+    if (!out.GetSimpleEvent(&simple))
+        return;
+
+    m_out_bytes += static_cast<char>(simple.status);
+    m_out_bytes += static_cast<char>(simple.byte1);
+
+    // Program change and channel pressure have a single data byte
+    const unsigned char kind = simple.status & 0xF0;
+    if (kind != 0xC0 && kind != 0xD0)
+        m_out_bytes += static_cast<char>(simple.byte2);
+}
+
+void RawMidiBackend::Write(const MidiEvent& out, microseconds_t delay_microseconds) {
+
+    lock_guard<mutex> lock(m_out_mutex);
+    if (m_out == NULL)
+        return;
+
+    if (delay_microseconds <= 0) {
+        Encode(out);
+        return;
+    }
+
+    ScheduledEvent ev;
+    ev.event = out;
+    ev.due = Now() + delay_microseconds;
+
+    // Mostly written in order, so this is usually the end
+    vector<ScheduledEvent>::iterator i = m_scheduled.end();
+    while (i != m_scheduled.begin() && (i - 1)->due > ev.due)
+        --i;
+
+    // The output thread waits for the first one
+    if (i == m_scheduled.begin())
+        m_out_changed.notify_all();
+
+    m_scheduled.insert(i, ev);
+}
+
+void RawMidiBackend::SendDue() {
+
+    if (m_out == NULL)
+        return;
+
+    const microseconds_t now = Now();
+    size_t due = 0;
+    while (due < m_scheduled.size() && m_scheduled[due].due <= now)
+        Encode(m_scheduled[due++].event);
+    m_scheduled.erase(m_scheduled.begin(), m_scheduled.begin() + due);
+
+    if (m_out_bytes.empty())
+        return;
+
+    // Whatever the device doesn't take now is tried again by the output
+    // thread
+    long written = snd_rawmidi_write(m_out, m_out_bytes.data(), m_out_bytes.length());
+    if (written > 0)
+        m_out_bytes.erase(0, static_cast<size_t>(written));
+
+    else if (written < 0 && written != -EAGAIN) {
+        cout << "[WARNING] Raw MIDI output failed: " << snd_strerror(static_cast<int>(written)) << endl;
+        m_out_bytes.clear();
+    }
+
+    if (!m_out_bytes.empty())
+        m_out_changed.notify_all();
+}
+
+void RawMidiBackend::Drain() {
+
+    lock_guard<mutex> lock(m_out_mutex);
+    SendDue();
+}
+
+void RawMidiBackend::runOutput() {
+
+    unique_lock<mutex> lock(m_out_mutex);
+    while (!m_should_exit) {
+        SendDue();
+
+        // Until the next event is due or the device may take more, or
+        // until Write() schedules something sooner
+        if (!m_out_bytes.empty())
+            m_out_changed.wait_for(lock, chrono::microseconds(OutputRetry));
+        else if (!m_scheduled.empty())
+            m_out_changed.wait_for(lock, chrono::microseconds(m_scheduled.front().due - Now()));
+        else
+            m_out_changed.wait(lock);
+    }
+}
+
+void RawMidiBackend::DropScheduled() {
+
+    lock_guard<mutex> lock(m_out_mutex);
+
+    vector<ScheduledEvent> kept;
+    for (size_t i = 0; i < m_scheduled.size(); ++i) {
+        const MidiEvent& ev = m_scheduled[i].event;
+        if (ev.Type() == MidiEventType_NoteOff || (ev.Type() == MidiEventType_NoteOn && ev.NoteVelocity() == 0))
+            kept.push_back(m_scheduled[i]);
+    }
+
+    m_scheduled.swap(kept);
+}
+
+void RawMidiBackend::KeyboardNote(unsigned char, bool, unsigned char) {
+}
+
+vector<pollfd> RawMidiBackend::PollDescriptors() const {
+
+    vector<pollfd> fds;
+    if (m_epoll_fd < 0)
+        return fds;
+
+    pollfd fd;
+    fd.fd = m_epoll_fd;
+    fd.events = POLLIN;
+    fd.revents = 0;
+    fds.push_back(fd);
+
+    return fds;
+}
+
+microseconds_t RawMidiBackend::Now() const {
+
+    return Compatible::GetMicroseconds();
+}
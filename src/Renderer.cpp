@@ -6,27 +6,28 @@
 // Adaptation to GNU/Linux by Oscar Aceña
 // See COPYING for license information
 
+#include <map>
+#include <algorithm>
+
 #include "Renderer.h"
 
 using namespace std;
 
-// These are static because OpenGL is (essentially) static
-static unsigned int last_texture_id = numeric_limits<unsigned int>::max();
-
-void SelectTexture(unsigned int texture_id) {
+// Where textures have a white texel, so DrawQuad() doesn't need to switch
+// to no texture at all.  Set up before any drawing, only read after.
+static map<unsigned int, pair<double, double> > solid_texels;
 
-    if (texture_id == last_texture_id)
-        return;
+static GLubyte colorByte(int value) {
 
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-    last_texture_id = texture_id;
+    return static_cast<GLubyte>(max(0, min(0xFF, value)));
 }
 
-Renderer::Renderer(GLContext glcontext, PGContext pangocontext) :
+Renderer::Renderer(GLContext glcontext, PGContext pangocontext, DrawList& list) :
     m_xoffset(0),
     m_yoffset(0),
     m_glcontext(glcontext),
-    m_pangocontext(pangocontext) {
+    m_pangocontext(pangocontext),
+    m_list(&list) {
 }
 
 Color Renderer::ToColor(int r, int g, int b, int a) {
@@ -40,6 +41,25 @@ Color Renderer::ToColor(int r, int g, int b, int a) {
     return c;
 }
 
+void Renderer::SetupView(int width, int height) {
+
+    glClearColor(.25, .25, .25, 1.0);
+    glClearDepth(1.0);
+
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_TEXTURE_2D);
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_BLEND);
+
+    glShadeModel(GL_SMOOTH);
+
+    glViewport(0, 0, width, height);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluOrtho2D(0, width, 0, height);
+}
+
 void Renderer::SetVSyncInterval(int) {
 // #ifdef WIN32
 
@@ -65,13 +85,12 @@ void Renderer::SetVSyncInterval(int) {
 // #endif
 }
 
-void Renderer::SwapBuffers() {
-    m_glcontext->get_gl_drawable()->swap_buffers();
+void Renderer::AddCommand(DrawCommand *command) {
+    m_list->AddCommand(command);
 }
 
-void Renderer::ForceTexture(unsigned int texture_id) {
-    last_texture_id = numeric_limits<unsigned int>::max();
-    SelectTexture(texture_id);
+void Renderer::Hold(shared_ptr<void> resource) {
+    m_list->Hold(resource);
 }
 
 void Renderer::SetColor(Color c) {
@@ -79,18 +98,28 @@ void Renderer::SetColor(Color c) {
 }
 
 void Renderer::SetColor(int r, int g, int b, int a) {
-    glColor4f(r / 255.0f, g / 255.0f, b / 255.0f, a / 255.0f);
+    m_list->SetColor(colorByte(r), colorByte(g), colorByte(b), colorByte(a));
+}
+
+void Renderer::SetSolidTexel(unsigned int texture_id, double u, double v) {
+    solid_texels[texture_id] = make_pair(u, v);
+}
+
+void Renderer::RemoveSolidTexel(unsigned int texture_id) {
+    solid_texels.erase(texture_id);
 }
 
 void Renderer::DrawQuad(int x, int y, int w, int h) {
-    SelectTexture(0);
 
-    glBegin(GL_QUADS);
-    glVertex3i(x + m_xoffset, y + m_yoffset, 0);
-    glVertex3i(x + w + m_xoffset, y + m_yoffset, 0);
-    glVertex3i(x + w + m_xoffset, y + h + m_yoffset, 0);
-    glVertex3i(x + m_xoffset, y + h + m_yoffset, 0);
-    glEnd();
+    // Stay with the current texture if it has some white to use
+    map<unsigned int, pair<double, double> >::const_iterator solid = solid_texels.find(m_list->GetTexture());
+    if (solid != solid_texels.end()) {
+        m_list->AddQuad(x + m_xoffset, y + m_yoffset, w, h, solid->second.first, solid->second.second, 0, 0);
+        return;
+    }
+
+    m_list->SetTexture(0);
+    m_list->AddQuad(x + m_xoffset, y + m_yoffset, w, h, 0, 0, 0, 0);
 }
 
 void Renderer::DrawTga(const Tga *tga, int x, int y) const {
@@ -103,22 +132,14 @@ void Renderer::DrawTga(const Tga *tga, int in_x, int in_y, int width, int height
     const int x = in_x + m_xoffset;
     const int y = in_y + m_yoffset;
 
-    const double tx = static_cast<double>(src_x) / static_cast<double>(tga->GetWidth());
-    const double ty = -static_cast<double>(src_y) / static_cast<double>(tga->GetHeight());
-    const double tw = static_cast<double>(width) / static_cast<double>(tga->GetWidth());
-    const double th = -static_cast<double>(height) / static_cast<double>(tga->GetHeight());
+    // The image may be a part of a bigger texture (see TextureAtlas)
+    const double tx = tga->TexU(src_x);
+    const double ty = tga->TexV(src_y);
+    const double tw = tga->TexU(src_x + width) - tx;
+    const double th = tga->TexV(src_y + height) - ty;
 
-    SelectTexture(tga->GetId());
-    glBegin(GL_QUADS);
-    glTexCoord2d(tx, ty);
-    glVertex3i(x, y, 0);
-    glTexCoord2d(tx, ty + th);
-    glVertex3i(x, y + height, 0);
-    glTexCoord2d(tx + tw, ty + th);
-    glVertex3i(x + width, y + height, 0);
-    glTexCoord2d(tx + tw, ty);
-    glVertex3i(x + width, y, 0);
-    glEnd();
+    m_list->SetTexture(tga->GetId());
+    m_list->AddQuad(x, y, width, height, tx, ty, tw, th);
 }
 
 void Renderer::DrawStretchedTga(const Tga *tga, int x, int y, int w, int h) const {
@@ -130,21 +151,12 @@ void Renderer::DrawStretchedTga(const Tga *tga, int x, int y, int w, int h,
     const int sx = x + m_xoffset;
     const int sy = y + m_yoffset;
 
-    const double tx = static_cast<double>(src_x) / static_cast<double>(tga->GetWidth());
-    const double ty = -static_cast<double>(src_y) / static_cast<double>(tga->GetHeight());
-    const double tw = static_cast<double>(src_w) / static_cast<double>(tga->GetWidth());
-    const double th = -static_cast<double>(src_h) / static_cast<double>(tga->GetHeight());
-
-    SelectTexture(tga->GetId());
-
-    glBegin(GL_QUADS);
-    glTexCoord2d(tx, ty);
-    glVertex3i(sx, sy, 0);
-    glTexCoord2d(tx, ty + th);
-    glVertex3i(sx, sy + h, 0);
-    glTexCoord2d(tx + tw, ty + th);
-    glVertex3i(sx + w, sy + h, 0);
-    glTexCoord2d(tx + tw, ty);
-    glVertex3i(sx + w, sy, 0);
-    glEnd();
+    // The image may be a part of a bigger texture (see TextureAtlas)
+    const double tx = tga->TexU(src_x);
+    const double ty = tga->TexV(src_y);
+    const double tw = tga->TexU(src_x + src_w) - tx;
+    const double th = tga->TexV(src_y + src_h) - ty;
+
+    m_list->SetTexture(tga->GetId());
+    m_list->AddQuad(sx, sy, w, h, tx, ty, tw, th);
 }
@@ -24,6 +24,11 @@ void StatsState::Init() {
         Layout::ButtonWidth, Layout::ButtonHeight);
 }
 
+bool StatsState::IsAnimating() const {
+
+    return false;
+}
+
 void StatsState::Update() {
 
     MouseInfo mouse = Mouse();
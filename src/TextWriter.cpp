@@ -7,19 +7,13 @@
 // See COPYING for license information
 
 #include "TextWriter.h"
-#include "LinthesiaError.h"
+#include "GlyphCache.h"
 #include "UserSettings.h"
 
 #include <X11/Xlib.h>
 
 using namespace std;
 
-// TODO: This should be deleted at shutdown
-static map<int, int> font_size_lookup;
-
-// TODO: This should be deleted at shutdown
-static map<int, Pango::FontDescription *> font_lookup;
-
 // Returns the most suitable font available on the platform
 // or an empty string if no font is available;
 static const std::string get_default_font();
@@ -32,39 +26,34 @@ TextWriter::TextWriter(int in_x, int in_y, Renderer& in_renderer,
     original_x(0),
     last_line_height(0),
     centered(in_centered),
+    font(fontname),
     renderer(in_renderer) {
 
-    x += renderer.m_xoffset;
     original_x = x;
-
-    y += renderer.m_yoffset;
     point_size = size;
 
-    if (font_size_lookup[size] == 0) {
-
-        // Get font from user settings
-        if (fontname.empty()) {
-            string key = "font_desc";
-            fontname = UserSetting::Get(key, "");
+    if (font.empty())
+        font = DefaultFont();
+}
 
-            // Or set it if there is no default
-            if (fontname.empty()) {
-                fontname = get_default_font();
-                UserSetting::Set(key, fontname);
-            }
-        }
+static string resolveDefaultFont() {
 
-        int list_start = glGenLists(128);
-        fontname = STRING(fontname << " " << in_size);
-        Pango::FontDescription *font_desc = new Pango::FontDescription(fontname);
-        Glib::RefPtr<Pango::Font> ret = Gdk::GL::Font::use_pango_font(*font_desc, 0, 128, list_start);
-        if (!ret)
-            throw LinthesiaError("An error ocurred while trying to use use_pango_font() with "
-                                 "font '" + fontname + "'");
+    const string key = "font_desc";
+    string font = UserSetting::Get(key, "");
 
-        font_size_lookup[size] = list_start;
-        font_lookup[size] = font_desc;
+    // Or set it if there is no default
+    if (font.empty()) {
+        font = get_default_font();
+        UserSetting::Set(key, font);
     }
+
+    return font;
+}
+
+const string& TextWriter::DefaultFont() {
+
+    const static string font = resolveDefaultFont();
+    return font;
 }
 
 int TextWriter::get_point_size() {
@@ -79,43 +68,56 @@ TextWriter& TextWriter::next_line() {
     return *this;
 }
 
+// Each glyph of layout (or its halo) with its top left corner at (x, y),
+// relative to the renderer's offset like anything else it draws
+static void draw_glyphs(Renderer& renderer, const TextLayout& layout, int x, int y, bool halos) {
+
+    for (size_t i = 0; i < layout.glyphs.size(); ++i) {
+        const PlacedGlyph& placed = layout.glyphs[i];
+        const Tga *image = (halos ? placed.glyph->halo : placed.glyph->image);
+        if (!image)
+            continue;
+
+        renderer.DrawTga(image, x + placed.x + placed.glyph->left, y + placed.y + placed.glyph->top);
+    }
+}
+
 TextWriter& Text::operator<<(TextWriter& tw) const {
+
+    const TextLayout& layout = glyphCache().Layout(tw.renderer, tw.font, tw.size, m_text,
+                                                   m_effect != TextPlain);
+
     int draw_x;
     int draw_y;
-    calculate_position_and_advance_cursor(tw, &draw_x, &draw_y);
+    calculate_position_and_advance_cursor(tw, layout, &draw_x, &draw_y);
 
-    string narrow(m_text.begin(), m_text.end());
+    if (m_effect == TextOutline) {
+        tw.renderer.SetColor(m_effect_color);
+        draw_glyphs(tw.renderer, layout, draw_x, draw_y, true);
+    }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    else if (m_effect == TextShadow) {
+        tw.renderer.SetColor(m_effect_color);
+        draw_glyphs(tw.renderer, layout, draw_x + 1, draw_y + 1, true);
+    }
 
-    glPushMatrix();
     tw.renderer.SetColor(m_color);
-    glListBase(font_size_lookup[tw.size]);
-    glRasterPos2i(draw_x, draw_y + tw.size);
-    glCallLists(static_cast<int>(narrow.length()), GL_UNSIGNED_BYTE, narrow.c_str());
-    glPopMatrix();
-
-    // TODO: Should probably delete these on shutdown.
-    //glDeleteLists(1000, 128);
+    draw_glyphs(tw.renderer, layout, draw_x, draw_y, false);
 
     return tw;
 }
 
-void Text::calculate_position_and_advance_cursor(TextWriter& tw, int *out_x, int *out_y) const {
+void Text::calculate_position_and_advance_cursor(TextWriter& tw, const TextLayout& layout,
+                                                 int *out_x, int *out_y) const {
 
-    Glib::RefPtr<Pango::Layout> layout = Pango::Layout::create(tw.renderer.m_pangocontext);
-    layout->set_text(m_text);
-    layout->set_font_description(*(font_lookup[tw.size]));
-
-    Pango::Rectangle drawing_rect = layout->get_pixel_logical_extents();
-    tw.last_line_height = drawing_rect.get_height();
+    tw.last_line_height = layout.height;
 
     if (tw.centered)
-        *out_x = tw.x - drawing_rect.get_width() / 2;
+        *out_x = tw.x - layout.width / 2;
 
     else {
         *out_x = tw.x;
-        tw.x += drawing_rect.get_width();
+        tw.x += layout.width;
     }
 
     *out_y = tw.y;
@@ -153,6 +155,10 @@ const std::string get_default_font() {
 
     // retrieve all fonts from the X server
     Display *const display = XOpenDisplay(NULL);
+    // no X server to ask (or no access to it), fontconfig has "sans" anyway
+    if (!display)
+        return "sans";
+
     int nbFonts = 0, i = 0;
     char **const allFonts = XListFonts(display, "-*", 32767, &nbFonts);
 
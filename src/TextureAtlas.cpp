@@ -0,0 +1,203 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include <algorithm>
+#include <iostream>
+
+#include "TextureAtlas.h"
+#include "Renderer.h"
+#include "OSGraphics.h"
+
+using namespace std;
+
+// Every image gets its edge pixels repeated around it, so smooth
+// filtering never picks up its neighbours
+const static unsigned int Padding = 1;
+
+// The white patch, for Renderer::DrawQuad()
+const static unsigned int SolidSize = 4;
+
+const static unsigned int MinAtlasSize = 256;
+const static unsigned int MaxAtlasSize = 4096;
+
+static unsigned int nextPowerOfTwo(unsigned int value) {
+
+    unsigned int result = 1;
+    while (result < value)
+        result *= 2;
+
+    return result;
+}
+
+// Sorts image indices tallest first
+class TallerImage {
+  public:
+
+    TallerImage(const vector<TgaImage>& images) :
+        m_images(images) {
+    }
+
+    bool operator()(size_t a, size_t b) const {
+        return m_images[a].height > m_images[b].height;
+    }
+
+  private:
+    const vector<TgaImage>& m_images;
+};
+
+TextureAtlas::TextureAtlas() :
+    m_texture_id(0) {
+}
+
+TextureAtlas::~TextureAtlas() {
+
+    for (size_t i = 0; i < m_regions.size(); ++i)
+        Tga::Release(m_regions[i]);
+
+    if (m_texture_id) {
+        Renderer::RemoveSolidTexel(m_texture_id);
+        glDeleteTextures(1, &m_texture_id);
+    }
+}
+
+size_t TextureAtlas::Add(const TgaImage& image) {
+
+    m_images.push_back(image);
+    return m_images.size() - 1;
+}
+
+unsigned int TextureAtlas::Pack(unsigned int width, vector<Placement>& placements) const {
+
+    // The white patch goes last, after all the images
+    vector<size_t> order;
+    for (size_t i = 0; i < m_images.size(); ++i)
+        order.push_back(i);
+    stable_sort(order.begin(), order.end(), TallerImage(m_images));
+    order.push_back(m_images.size());
+
+    placements.resize(m_images.size() + 1);
+
+    unsigned int x = 0;
+    unsigned int y = 0;
+    unsigned int shelf_height = 0;
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        const bool solid = (order[i] == m_images.size());
+        const unsigned int w = (solid ? SolidSize : m_images[order[i]].width) + Padding * 2;
+        const unsigned int h = (solid ? SolidSize : m_images[order[i]].height) + Padding * 2;
+
+        if (w > width)
+            return 0;
+
+        // Start a new shelf
+        if (x + w > width) {
+            y += shelf_height;
+            x = 0;
+            shelf_height = 0;
+        }
+
+        placements[order[i]].x = x + Padding;
+        placements[order[i]].y = y + Padding;
+
+        x += w;
+        shelf_height = max(shelf_height, h);
+    }
+
+    return y + shelf_height;
+}
+
+bool TextureAtlas::Build(bool smooth) {
+
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    const unsigned int limit = min(MaxAtlasSize, static_cast<unsigned int>(max(max_size, 0)));
+
+    // The smallest texture everything fits in
+    unsigned int best_width = 0;
+    unsigned int best_height = 0;
+    vector<Placement> placements;
+
+    for (unsigned int width = MinAtlasSize; width <= limit; width *= 2) {
+        vector<Placement> candidate;
+        const unsigned int used = Pack(width, candidate);
+        if (used == 0)
+            continue;
+
+        const unsigned int height = nextPowerOfTwo(max(used, MinAtlasSize));
+        if (height > limit)
+            continue;
+
+        if (best_width == 0 || width * height < best_width * best_height) {
+            best_width = width;
+            best_height = height;
+            placements.swap(candidate);
+        }
+    }
+
+    if (best_width == 0) {
+        cout << "[WARNING] Textures don't fit in a " << limit << " pixel texture atlas" << endl;
+        return false;
+    }
+
+    // Everything becomes RGBA, rows bottom-up like the images
+    vector<unsigned char> pixels(best_width * best_height * 4, 0);
+
+    for (size_t i = 0; i < m_images.size(); ++i) {
+        const TgaImage& image = m_images[i];
+        const unsigned int bytes_per_pixel = image.bpp / 8;
+
+        for (int ry = -static_cast<int>(Padding); ry < static_cast<int>(image.height + Padding); ++ry) {
+            const int sy = max(0, min(static_cast<int>(image.height) - 1, ry));
+
+            for (int rx = -static_cast<int>(Padding); rx < static_cast<int>(image.width + Padding); ++rx) {
+                const int sx = max(0, min(static_cast<int>(image.width) - 1, rx));
+
+                const unsigned char *src = &image.pixels[(sy * image.width + sx) * bytes_per_pixel];
+                unsigned char *dest = &pixels[((placements[i].y + ry) * best_width + placements[i].x + rx) * 4];
+
+                dest[0] = src[0];
+                dest[1] = src[1];
+                dest[2] = src[2];
+                dest[3] = (bytes_per_pixel == 4 ? src[3] : 0xFF);
+            }
+        }
+    }
+
+    const Placement& solid = placements[m_images.size()];
+    for (unsigned int ry = solid.y - Padding; ry < solid.y + SolidSize + Padding; ++ry)
+        for (unsigned int rx = solid.x - Padding; rx < solid.x + SolidSize + Padding; ++rx)
+            fill(&pixels[(ry * best_width + rx) * 4], &pixels[(ry * best_width + rx) * 4] + 4, 0xFF);
+
+    glGenTextures(1, &m_texture_id);
+    if (!m_texture_id)
+        return false;
+
+    const GLint filter = (smooth ? GL_LINEAR : GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, m_texture_id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, best_width, best_height,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+
+    for (size_t i = 0; i < m_images.size(); ++i)
+        m_regions.push_back(Tga::Region(m_texture_id, best_width, best_height,
+                                        placements[i].x, placements[i].y,
+                                        m_images[i].width, m_images[i].height));
+
+    Renderer::SetSolidTexel(m_texture_id,
+                            (solid.x + SolidSize / 2.0) / best_width,
+                            (solid.y + SolidSize / 2.0) / best_height);
+
+    // Uploaded, the decoded pixels aren't needed anymore
+    m_images.clear();
+    return true;
+}
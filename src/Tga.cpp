@@ -20,7 +20,7 @@
 
 using namespace std;
 
-Tga *Tga::Load(const string& resource_name) {
+TgaImage Tga::Decode(const string& resource_name) {
 
     // Append extension
     string full_name = resource_name + ".tga";
@@ -39,8 +39,23 @@ Tga *Tga::Load(const string& resource_name) {
     file.read((char *) bytes, size);
     file.close();
 
-    Tga *ret = LoadFromData(bytes);
+    TgaImage image;
+    try {
+        DecodeData(bytes, size, &image);
+    } catch (...) {
+        delete[] bytes;
+        throw;
+    }
+
     delete[] bytes;
+    return image;
+}
+
+Tga *Tga::Load(const string& resource_name) {
+
+    Tga *ret = Upload(Decode(resource_name));
+    if (!ret)
+        throw LinthesiaError("Couldn't create a texture for TGA resource (" + resource_name + ").");
 
     ret->SetSmooth(false);
     return ret;
@@ -50,7 +65,8 @@ void Tga::Release(Tga *tga) {
     if (!tga)
         return;
 
-    glDeleteTextures(1, &tga->m_texture_id);
+    if (tga->m_owns_texture)
+        glDeleteTextures(1, &tga->m_texture_id);
     delete tga;
 }
 
@@ -59,6 +75,14 @@ const static unsigned char UncompressedTgaHeader[TgaTypeHeaderLength] = {0, 0, 2
 const static unsigned char CompressedTgaHeader[TgaTypeHeaderLength] = {0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 void Tga::SetSmooth(bool smooth) {
+
+    // Nothing to do, and no OpenGL call while drawing (see DrawList)
+    if (m_smooth_set && m_smooth == smooth)
+        return;
+
+    m_smooth = smooth;
+    m_smooth_set = true;
+
     GLint filter = GL_NEAREST;
     if (smooth)
         filter = GL_LINEAR;
@@ -75,11 +99,14 @@ enum TgaType {
     TgaUnknown
 };
 
-Tga *Tga::LoadFromData(const unsigned char *bytes) {
-    if (!bytes)
-        return 0;
+void Tga::DecodeData(const unsigned char *bytes, size_t size, TgaImage *image) {
+
+    const static size_t TgaDataHeaderLength = 6;
+    if (!bytes || size < TgaTypeHeaderLength + TgaDataHeaderLength)
+        throw LinthesiaError("Unsupported TGA type.");
 
     const unsigned char *pos = bytes;
+    const unsigned char *end = bytes + size;
 
     TgaType type = TgaUnknown;
     if (memcmp(UncompressedTgaHeader, pos, TgaTypeHeaderLength) == 0)
@@ -99,7 +126,6 @@ Tga *Tga::LoadFromData(const unsigned char *bytes) {
     unsigned int bpp = pos[4];
 
     // We're done with the data header
-    const static int TgaDataHeaderLength = 6;
     pos += TgaDataHeaderLength;
 
     if (width <= 0 || height <= 0)
@@ -108,40 +134,40 @@ Tga *Tga::LoadFromData(const unsigned char *bytes) {
     if (bpp != 24 && bpp != 32)
         throw LinthesiaError("Unsupported TGA BPP.");
 
-    const unsigned int data_size = width * height * bpp / 8;
-    unsigned char *image_data = new unsigned char[data_size];
+    image->width = width;
+    image->height = height;
+    image->bpp = bpp;
+    image->pixels.resize(width * height * bpp / 8);
 
-    Tga *t = 0;
     if (type == TgaCompressed)
-        t = LoadCompressed(pos, image_data, width, height, bpp);
+        DecodeCompressed(pos, end, image);
 
     if (type == TgaUncompressed)
-        t = LoadUncompressed(pos, image_data, data_size, width, height, bpp);
-
-    delete[] image_data;
-    return t;
+        DecodeUncompressed(pos, end, image);
 }
 
-Tga *Tga::LoadUncompressed(const unsigned char *src, unsigned char *dest,
-                           unsigned int size, unsigned int width, unsigned int height,
-                           unsigned int bpp) {
+void Tga::DecodeUncompressed(const unsigned char *src, const unsigned char *end, TgaImage *image) {
+
+    unsigned char *dest = &image->pixels[0];
+    const unsigned int size = static_cast<unsigned int>(image->pixels.size());
+    if (static_cast<size_t>(end - src) < size)
+        throw LinthesiaError("Truncated TGA.");
+
     // We can use most of the data as-is with little modification
     memcpy(dest, src, size);
 
-    for (unsigned int cswap = 0; cswap < size; cswap += bpp / 8) {
+    for (unsigned int cswap = 0; cswap < size; cswap += image->bpp / 8) {
         dest[cswap] ^= dest[cswap + 2] ^= dest[cswap] ^= dest[cswap + 2];
     }
-
-    return BuildFromParameters(dest, width, height, bpp);
 }
 
-Tga *Tga::LoadCompressed(const unsigned char *src, unsigned char *dest,
-                         unsigned int width, unsigned int height, unsigned int bpp) {
+void Tga::DecodeCompressed(const unsigned char *src, const unsigned char *end, TgaImage *image) {
 
     const unsigned char *pos = src;
+    unsigned char *dest = &image->pixels[0];
 
-    const unsigned int BytesPerPixel = bpp / 8;
-    const unsigned int PixelCount = height * width;
+    const unsigned int BytesPerPixel = image->bpp / 8;
+    const unsigned int PixelCount = image->height * image->width;
 
     const static unsigned int MaxBytesPerPixel = 4;
     unsigned char pixel_buffer[MaxBytesPerPixel];
@@ -150,6 +176,9 @@ Tga *Tga::LoadCompressed(const unsigned char *src, unsigned char *dest,
     unsigned int byte = 0;
 
     while (pixel < PixelCount) {
+        if (pos >= end)
+            throw LinthesiaError("Truncated TGA.");
+
         unsigned char chunkheader = 0;
         memcpy(&chunkheader, pos, sizeof(unsigned char));
         pos += sizeof(unsigned char);
@@ -158,9 +187,15 @@ Tga *Tga::LoadCompressed(const unsigned char *src, unsigned char *dest,
             chunkheader++;
 
             for (short i = 0; i < chunkheader; i++) {
+                if (end - pos < static_cast<long>(BytesPerPixel))
+                    throw LinthesiaError("Truncated TGA.");
+
                 memcpy(pixel_buffer, pos, BytesPerPixel);
                 pos += BytesPerPixel;
 
+                if (pixel >= PixelCount)
+                    throw LinthesiaError("Too many pixels in TGA.");
+
                 dest[byte + 0] = pixel_buffer[2];
                 dest[byte + 1] = pixel_buffer[1];
                 dest[byte + 2] = pixel_buffer[0];
@@ -170,18 +205,21 @@ Tga *Tga::LoadCompressed(const unsigned char *src, unsigned char *dest,
 
                 byte += BytesPerPixel;
                 pixel++;
-
-                if (pixel > PixelCount)
-                    throw LinthesiaError("Too many pixels in TGA.");
             }
         } else {
             chunkheader -= 127;
 
+            if (end - pos < static_cast<long>(BytesPerPixel))
+                throw LinthesiaError("Truncated TGA.");
+
             memcpy(pixel_buffer, pos, BytesPerPixel);
             pos += BytesPerPixel;
 
             for (short i = 0; i < chunkheader; i++) {
 
+                if (pixel >= PixelCount)
+                    throw LinthesiaError("Too many pixels in TGA.");
+
                 dest[byte + 0] = pixel_buffer[2];
                 dest[byte + 1] = pixel_buffer[1];
                 dest[byte + 2] = pixel_buffer[0];
@@ -191,24 +229,18 @@ Tga *Tga::LoadCompressed(const unsigned char *src, unsigned char *dest,
 
                 byte += BytesPerPixel;
                 pixel++;
-
-                if (pixel > PixelCount)
-                    throw LinthesiaError("Too many pixels in TGA.");
             }
         }
     }
-
-    return BuildFromParameters(dest, width, height, bpp);
 }
 
-Tga *Tga::BuildFromParameters(const unsigned char *raw, unsigned int width,
-                              unsigned int height, unsigned int bpp) {
+Tga *Tga::Upload(const TgaImage& image) {
 
     unsigned int pixel_format = 0;
-    if (bpp == 24)
+    if (image.bpp == 24)
         pixel_format = GL_RGB;
 
-    if (bpp == 32)
+    if (image.bpp == 32)
         pixel_format = GL_RGBA;
 
     TextureId id;
@@ -218,13 +250,29 @@ Tga *Tga::BuildFromParameters(const unsigned char *raw, unsigned int width,
 
     glBindTexture(GL_TEXTURE_2D, id);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-    glTexImage2D(GL_TEXTURE_2D, 0, bpp / 8, width, height,
-                 0, pixel_format, GL_UNSIGNED_BYTE, raw);
+    glTexImage2D(GL_TEXTURE_2D, 0, image.bpp / 8, image.width, image.height,
+                 0, pixel_format, GL_UNSIGNED_BYTE, &image.pixels[0]);
+
+    Tga *t = Region(id, image.width, image.height, 0, 0, image.width, image.height);
+    t->m_owns_texture = true;
+
+    return t;
+}
+
+Tga *Tga::Region(TextureId texture_id, unsigned int texture_width, unsigned int texture_height,
+                 unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
 
     Tga *t = new Tga();
     t->m_width = width;
     t->m_height = height;
-    t->m_texture_id = id;
+    t->m_texture_id = texture_id;
+    t->m_x = x;
+    t->m_y = y;
+    t->m_texture_width = texture_width;
+    t->m_texture_height = texture_height;
+    t->m_owns_texture = false;
+    t->m_smooth = false;
+    t->m_smooth_set = false;
 
     return t;
 }
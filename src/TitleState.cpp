@@ -8,6 +8,7 @@
 
 #include "TitleState.h"
 #include "TrackSelectionState.h"
+#include "CalibrationState.h"
 
 #include "Version.h"
 
@@ -41,6 +42,26 @@ void TitleState::Init() {
         GetStateHeight() - Layout::ScreenMarginY / 2 - Layout::ButtonHeight / 2,
         Layout::ButtonWidth, Layout::ButtonHeight);
 
+    m_midi_ready = midiReady();
+    if (m_midi_ready)
+        SelectDevices();
+
+    const bool compress_height = (GetStateHeight() < 750);
+    const int initial_y = (compress_height ? 230 : 360);
+    const int each_y = (compress_height ? 94 : 100);
+
+    m_file_tile = new StringTile((GetStateWidth() - StringTileWidth) / 2,
+                                 initial_y + each_y * 0,
+                                 GetTexture(SongBox));
+
+    m_file_tile->SetString(m_state.song_title);
+
+    CreateDeviceTiles();
+}
+
+// Opens the devices used last time, unless we already have some
+void TitleState::SelectDevices() {
+
     string last_output_device = UserSetting::Get(OutputDeviceKey, "");
     string last_input_device = UserSetting::Get(InputDeviceKey, "");
 
@@ -91,28 +112,31 @@ void TitleState::Init() {
         // completely acceptable.
     }
 
+    if (m_state.midi_out)
+        m_state.midi_out->Reset();
+
+    if (m_state.midi_in)
+        m_state.midi_in->Reset();
+}
+
+void TitleState::CreateDeviceTiles() {
+
+    if (m_output_tile) delete m_output_tile;
+    if (m_input_tile) delete m_input_tile;
+
     int output_device_id = -1;
-    if (m_state.midi_out) {
+    if (m_state.midi_out)
         output_device_id = m_state.midi_out->GetDeviceDescription().id;
-        m_state.midi_out->Reset();
-    }
 
     int input_device_id = -1;
-    if (m_state.midi_in) {
+    if (m_state.midi_in)
         input_device_id = m_state.midi_in->GetDeviceDescription().id;
-        m_state.midi_in->Reset();
-    }
 
     const bool compress_height = (GetStateHeight() < 750);
     const int initial_y = (compress_height ? 230 : 360);
     const int each_y = (compress_height ? 94 : 100);
 
-    m_file_tile = new StringTile((GetStateWidth() - StringTileWidth) / 2,
-                                 initial_y + each_y * 0,
-                                 GetTexture(SongBox));
-
-    m_file_tile->SetString(m_state.song_title);
-
+    m_device_list_serial = midiDeviceListSerial();
     const MidiCommDescriptionList output_devices = MidiCommOut::GetDeviceList();
     const MidiCommDescriptionList input_devices = MidiCommIn::GetDeviceList();
 
@@ -133,11 +157,27 @@ void TitleState::Init() {
                                   GetTexture(InputBox));
 }
 
+bool TitleState::IsAnimating() const {
+
+    return m_output_tile->IsPreviewOn() || m_input_tile->IsPreviewOn();
+}
+
 void TitleState::Update() {
-    MidiCommOut::UpdateDeviceList();
-    MidiCommIn::UpdateDeviceList();
-    m_input_tile->ReplaceDeviceList(MidiCommIn::GetDeviceList());
-    m_output_tile->ReplaceDeviceList(MidiCommOut::GetDeviceList());
+
+    // MIDI came up in the background since we were shown
+    if (!m_midi_ready && midiReady()) {
+        m_midi_ready = true;
+        SelectDevices();
+        CreateDeviceTiles();
+    }
+
+    // The lists follow the sequencer announcements, only hand them to the
+    // tiles when a device came or went
+    if (midiDeviceListSerial() != m_device_list_serial) {
+        m_device_list_serial = midiDeviceListSerial();
+        m_input_tile->ReplaceDeviceList(MidiCommIn::GetDeviceList());
+        m_output_tile->ReplaceDeviceList(MidiCommOut::GetDeviceList());
+    }
 
     MouseInfo mouse = Mouse();
 
@@ -319,6 +359,15 @@ void TitleState::Update() {
         return;
     }
 
+    if (IsKeyPressed(KeyF2)) {
+
+        if (m_state.midi_out)
+            m_state.midi_out->Reset();
+
+        ChangeState(new CalibrationState(m_state));
+        return;
+    }
+
     m_tooltip = "";
 
     if (m_back_button.hovering)
@@ -391,6 +440,12 @@ void TitleState::Draw(Renderer& renderer) const {
 
     version << Text("version " + LinthesiaVersionString, Gray);
 
+    TextWriter calibrate(Layout::ScreenMarginX,
+                         GetStateHeight() - Layout::ScreenMarginY - Layout::SmallFontSize * 4,
+                         renderer, false, Layout::SmallFontSize);
+
+    calibrate << Text("Press F2 to calibrate device latency", Gray);
+
     Layout::DrawHorizontalRule(renderer,
                                GetStateWidth(),
                                GetStateHeight() - Layout::ScreenMarginY);
@@ -18,8 +18,6 @@ TrackSelectionState::TrackSelectionState(const SharedState& state) :
     m_current_page(0),
     m_tiles_per_page(0),
     m_preview_on(false),
-    m_first_update_after_seek(false),
-    m_preview_track_id(0),
     m_state(state) {
 }
 
@@ -146,6 +144,11 @@ vector<Track::Properties> TrackSelectionState::BuildTrackProperties() const {
     return props;
 }
 
+bool TrackSelectionState::IsAnimating() const {
+
+    return m_preview_on;
+}
+
 void TrackSelectionState::Update() {
     m_continue_button.Update(MouseInfo(Mouse()));
     m_back_button.Update(MouseInfo(Mouse()));
@@ -193,14 +196,7 @@ void TrackSelectionState::Update() {
     if (m_continue_button.hovering)
         m_tooltip = "Click to begin playing with these settings.";
 
-    // Our delta milliseconds on the first frame after we seek down to the
-    // first note is extra long because the seek takes a while.  By skipping
-    // the "Play" that update, we don't have an artificially fast-forwarded
-    // start.
-    if (!m_first_update_after_seek)
-        PlayTrackPreview(static_cast<microseconds_t>(GetDeltaMilliseconds()) * 1000);
-
-    m_first_update_after_seek = false;
+    PlayTrackPreview(static_cast<microseconds_t>(GetDeltaMilliseconds()) * 1000);
 
     // Do hit testing on each tile button on this page
     size_t start = m_current_page * m_tiles_per_page;
@@ -279,28 +275,17 @@ void TrackSelectionState::Update() {
                 }
 
                 const microseconds_t PreviewLeadIn = 25000;
-                const microseconds_t PreviewLeadOut = 25000;
 
+                // Only the previewed track is walked, and the song keeps
+                // whatever position it had
                 m_preview_on = true;
-                m_preview_track_id = t.GetTrackId();
-                m_state.midi->Reset(PreviewLeadIn, PreviewLeadOut);
-                PlayTrackPreview(0);
-
-                // Find the first note in this track so we can skip right to the good part.
-                microseconds_t additional_time = -PreviewLeadIn;
-                const MidiTrack& track = m_state.midi->Tracks()[m_preview_track_id];
-                for (size_t i = 0; i < track.Events().size(); ++i) {
-
-                    const MidiEvent& ev = track.Events()[i];
-                    if (ev.Type() == MidiEventType_NoteOn && ev.NoteVelocity() > 0) {
-                        additional_time +=
-                            track.EventUsecs()[i] - m_state.midi->GetDeadAirStartOffsetMicroseconds() - 1;
-                        break;
-                    }
-                }
+                m_preview = MidiTrackCursor(m_state.midi->Tracks()[t.GetTrackId()]);
 
-                PlayTrackPreview(additional_time);
-                m_first_update_after_seek = true;
+                const MidiEventList setup = m_preview.SeekToFirstNote(PreviewLeadIn);
+                if (m_state.midi_out) {
+                    for (MidiEventList::const_iterator j = setup.begin(); j != setup.end(); ++j)
+                        m_state.midi_out->Write(*j);
+                }
             } else
                 m_preview_on = false;
         }
@@ -312,17 +297,12 @@ void TrackSelectionState::PlayTrackPreview(microseconds_t delta_microseconds) {
     if (!m_preview_on)
         return;
 
-    MidiEventListWithTrackId evs = m_state.midi->Update(delta_microseconds);
-
-    for (MidiEventListWithTrackId::const_iterator i = evs.begin(); i != evs.end(); ++i) {
-        const MidiEvent& ev = i->second;
-
-        if (i->first != m_preview_track_id)
-            continue;
+    const MidiEventList evs = m_preview.Update(delta_microseconds);
+    if (!m_state.midi_out)
+        return;
 
-        if (m_state.midi_out)
-            m_state.midi_out->Write(ev);
-    }
+    for (MidiEventList::const_iterator i = evs.begin(); i != evs.end(); ++i)
+        m_state.midi_out->Write(*i);
 }
 
 void TrackSelectionState::Draw(Renderer& renderer) const {
@@ -13,6 +13,7 @@ using namespace std;
 namespace UserSetting {
 
 static bool g_initialized(false);
+static bool g_read_only(false);
 static string g_app_name("");
 static Glib::RefPtr<Gnome::Conf::Client> gconf;
 
@@ -39,9 +40,13 @@ string Get(const string& setting, const string& default_value) {
 }
 
 void Set(const string& setting, const string& value) {
-    if (!g_initialized)
+    if (!g_initialized || g_read_only)
         return;
 
     gconf->set(g_app_name + "/" + setting, value);
 }
+
+void MakeReadOnly() {
+    g_read_only = true;
+}
 }; // End namespace
@@ -0,0 +1,314 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+
+#include <cairo.h>
+
+#include "VideoExport.h"
+#include "OSGraphics.h"
+#include "StringUtil.h"
+#include "FileSelector.h"
+#include "LinthesiaError.h"
+#include "Renderer.h"
+#include "DrawList.h"
+#include "SharedState.h"
+#include "GameState.h"
+#include "PlayingState.h"
+
+using namespace std;
+
+// A frame as glReadPixels() gives it in GL_BGRA/GL_UNSIGNED_INT_8_8_8_8_REV:
+// 0xAARRGGBB pixels (the layout of CAIRO_FORMAT_RGB24), bottom row first
+typedef vector<unsigned int> Frame;
+
+class FrameWriter {
+  public:
+
+    virtual ~FrameWriter() {
+    }
+
+    // False if it could not be written
+    virtual bool Write(const Frame& frame) = 0;
+};
+
+// YUV4MPEG2, which ffmpeg and most encoders read as is.  4:4:4, so there
+// is nothing to get wrong about odd sizes and chroma siting.
+class Y4mWriter : public FrameWriter {
+  public:
+
+    Y4mWriter(FILE *file, int width, int height, unsigned int frame_rate) :
+        m_file(file),
+        m_width(width),
+        m_height(height),
+        m_planes(width * height * 3) {
+
+        fprintf(m_file, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C444\n", width, height, frame_rate);
+    }
+
+    ~Y4mWriter() {
+
+        fclose(m_file);
+    }
+
+    bool Write(const Frame& frame) {
+
+        const size_t plane = m_width * m_height;
+        unsigned char *y_plane = &m_planes[0];
+        unsigned char *cb_plane = y_plane + plane;
+        unsigned char *cr_plane = cb_plane + plane;
+
+        // BT.601, studio range
+        for (int row = 0; row < m_height; ++row) {
+            const unsigned int *src = &frame[(m_height - 1 - row) * m_width];
+
+            for (int x = 0; x < m_width; ++x) {
+                const int r = (src[x] >> 16) & 0xFF;
+                const int g = (src[x] >> 8) & 0xFF;
+                const int b = src[x] & 0xFF;
+
+                const size_t i = row * m_width + x;
+                y_plane[i] = static_cast<unsigned char>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                cb_plane[i] = static_cast<unsigned char>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                cr_plane[i] = static_cast<unsigned char>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            }
+        }
+
+        fputs("FRAME\n", m_file);
+        return fwrite(&m_planes[0], 1, m_planes.size(), m_file) == m_planes.size();
+    }
+
+  private:
+    FILE *m_file;
+    int m_width;
+    int m_height;
+
+    vector<unsigned char> m_planes;
+};
+
+// One numbered PNG per frame, through cairo (already there for the text)
+class PngWriter : public FrameWriter {
+  public:
+
+    PngWriter(const string& directory, int width, int height) :
+        m_directory(directory),
+        m_width(width),
+        m_height(height),
+        m_frame_number(0),
+        m_flipped(width * height) {
+    }
+
+    bool Write(const Frame& frame) {
+
+        for (int row = 0; row < m_height; ++row)
+            copy(frame.begin() + (m_height - 1 - row) * m_width, frame.begin() + (m_height - row) * m_width,
+                 m_flipped.begin() + row * m_width);
+
+        cairo_surface_t *surface = cairo_image_surface_create_for_data(
+            reinterpret_cast<unsigned char *>(&m_flipped[0]), CAIRO_FORMAT_RGB24,
+            m_width, m_height, m_width * sizeof(unsigned int));
+
+        const string filename = STRING(m_directory << "/frame" << setfill('0') << setw(6)
+                                       << m_frame_number++ << ".png");
+        const cairo_status_t status = cairo_surface_write_to_png(surface, filename.c_str());
+
+        cairo_surface_destroy(surface);
+        return status == CAIRO_STATUS_SUCCESS;
+    }
+
+  private:
+    string m_directory;
+    int m_width;
+    int m_height;
+    unsigned int m_frame_number;
+
+    Frame m_flipped;
+};
+
+static bool endsWith(const string& s, const string& end) {
+
+    return s.length() >= end.length() && s.compare(s.length() - end.length(), end.length(), end) == 0;
+}
+
+// What TrackSelectionState starts with: everything is played and shown,
+// but percussion, each track with notes in the next color
+static vector<Track::Properties> defaultTrackProperties(const Midi& midi) {
+
+    vector<Track::Properties> props(midi.Tracks().size());
+
+    int shown = 0;
+    for (size_t i = 0; i < midi.Tracks().size(); ++i) {
+        const MidiTrack& t = midi.Tracks()[i];
+        if (t.Notes().size() == 0)
+            continue;
+
+        props[i].mode = (t.IsPercussion() ? Track::ModePlayedButHidden : Track::ModePlayedAutomatically);
+        props[i].color = static_cast<Track::TrackColor>(shown++ % Track::UserSelectableColorCount);
+    }
+
+    return props;
+}
+
+// Standard output, for frames piped somewhere.  Whatever else is printed
+// there (the warnings about textures, shaders and framebuffers go to cout)
+// is sent to standard error from now on, so it can't end up in the middle
+// of the frames.  Null if that didn't work.
+static FILE *takeStandardOutput() {
+
+    cout.flush();
+    fflush(stdout);
+
+    const int frames_fd = dup(STDOUT_FILENO);
+    if (frames_fd < 0)
+        return 0;
+
+    if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        close(frames_fd);
+        return 0;
+    }
+
+    return fdopen(frames_fd, "wb");
+}
+
+static int runExport(const VideoExportOptions& options) {
+
+    // Before anything can print a warning
+    FILE *standard_output = 0;
+    if (options.output == "-") {
+        standard_output = takeStandardOutput();
+        if (!standard_output) {
+            cerr << "Cannot write to standard output." << endl;
+            return 1;
+        }
+    }
+
+    Midi midi = Midi::ReadFromFile(options.midi_file);
+
+    // An offscreen X pixmap instead of a window.  Under Xvfb this is Mesa
+    // (llvmpipe) in this process, no GPU involved.
+    Glib::RefPtr<Gdk::GL::Config> glconfig = Gdk::GL::Config::create(Gdk::GL::MODE_RGB | Gdk::GL::MODE_SINGLE);
+    if (!glconfig) {
+        cerr << "Cannot find an OpenGL visual to draw the frames with." << endl;
+        return 1;
+    }
+
+    Glib::RefPtr<Gdk::Pixmap> pixmap = Gdk::Pixmap::create(Glib::RefPtr<Gdk::Drawable>(), options.width,
+                                                           options.height, glconfig->get_depth());
+    Glib::RefPtr<Gdk::GL::Pixmap> glpixmap = Gdk::GL::ext(pixmap).set_gl_capability(glconfig);
+
+    // Direct: recent X servers (Xvfb included) only allow indirect GLX with
+    // +iglx, and it stops at OpenGL 1.4, without framebuffers and shaders
+    GLContext glcontext = Gdk::GL::Context::create(glpixmap, true);
+
+    if (!glcontext || !glpixmap->gl_begin(glcontext)) {
+        cerr << "Cannot draw into an offscreen OpenGL pixmap." << endl;
+        return 1;
+    }
+
+    if (!glcontext->is_direct())
+        cerr << "[WARNING] No direct rendering into the pixmap, the frames may take long." << endl;
+
+    FrameWriter *writer = 0;
+    if (options.output == "-" || endsWith(options.output, ".y4m")) {
+        FILE *file = (standard_output ? standard_output : fopen(options.output.c_str(), "wb"));
+        if (file)
+            writer = new Y4mWriter(file, options.width, options.height, options.frame_rate);
+    } else if (g_mkdir_with_parents(options.output.c_str(), 0755) == 0)
+        writer = new PngWriter(options.output, options.width, options.height);
+
+    if (!writer) {
+        cerr << "Cannot write to '" << options.output << "'." << endl;
+        glpixmap->gl_end();
+        return 1;
+    }
+
+    Renderer::SetupView(options.width, options.height);
+
+    Frame frame(options.width * options.height);
+    unsigned long frame_count = 0;
+    bool written = true;
+    microseconds_t song_start = 0;
+
+    // The textures go before the context does
+    {
+        // Recorded and submitted right away, there is time enough
+        DrawList list;
+
+        GameStateManager manager(options.width, options.height);
+        manager.SetFixedFrameRate(options.frame_rate);
+        manager.PrepareDrawing();
+
+        SharedState state;
+        state.song_title = FileSelector::TrimFilename(options.midi_file);
+        state.midi = &midi;
+        state.track_properties = defaultTrackProperties(midi);
+        manager.SetInitialState(new PlayingState(state));
+
+        // The song starts after a lead-in, its audio has to wait this long
+        song_start = -midi.GetSongPositionInMicroseconds();
+
+        while (written) {
+            manager.Update(false);
+            if (midi.IsSongOver())
+                break;
+
+            Renderer renderer(glcontext, PGContext(), list);
+            manager.Draw(renderer);
+
+            list.Submit();
+            list.Clear();
+            glFlush();
+
+            glReadBuffer(GL_FRONT);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(0, 0, options.width, options.height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, &frame[0]);
+
+            written = writer->Write(frame);
+            ++frame_count;
+        }
+    }
+
+    delete writer;
+    glpixmap->gl_end();
+
+    if (!written) {
+        cerr << "Could not write frame " << frame_count << " to '" << options.output << "'." << endl;
+        return 1;
+    }
+
+    cerr << "Wrote " << frame_count << " frames at " << options.frame_rate << " fps.  The song starts at "
+         << fixed << setprecision(3) << song_start / 1000000.0 << " s, delay its audio by that much." << endl;
+
+    return 0;
+}
+
+int exportVideo(const VideoExportOptions& options) {
+
+    // Nobody is there to close a dialog, see main()
+    try {
+        return runExport(options);
+    }
+
+    catch (const LinthesiaError& e) {
+        cerr << "Export failed: " << e.GetErrorDescription() << endl;
+    }
+
+    catch (const MidiError& e) {
+        cerr << "Problem while loading file: " << options.midi_file << ": " << e.GetErrorDescription() << endl;
+    }
+
+    catch (const exception& e) {
+        cerr << "Export failed: " << e.what() << endl;
+    }
+
+    return 1;
+}
@@ -0,0 +1,178 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+#include "VoiceManager.h"
+
+using namespace std;
+
+VoiceManager::VoiceManager(int max_voices, int max_channel_voices, int velocity_floor) :
+    m_max_voices(max_voices),
+    m_max_channel_voices(max_channel_voices),
+    m_velocity_floor(velocity_floor),
+    m_clock(0),
+    m_batch(0) {
+
+    Reset();
+}
+
+void VoiceManager::StartBatch() {
+
+    m_batch++;
+}
+
+void VoiceManager::Reset() {
+
+    for (int key = 0; key < 16 * 128; ++key) {
+        m_voices[key].velocity = 0;
+        m_voices[key].started = 0;
+        m_voices[key].batch = 0;
+        m_voices[key].depth = 0;
+        m_voices[key].sounding_index = -1;
+        m_swallow[key] = 0;
+    }
+
+    for (int ch = 0; ch < 16; ++ch)
+        m_channel_voices[ch] = 0;
+
+    m_sounding.clear();
+
+    // Merging only happens within a batch, and no batch is open now
+    m_batch++;
+}
+
+void VoiceManager::Admit(const MidiEvent& ev, MidiEventList& out) {
+
+    if (ev.Type() == MidiEventType_NoteOn && ev.NoteVelocity() > 0)
+        NoteOn(ev, out);
+
+    else if (ev.Type() == MidiEventType_NoteOn || ev.Type() == MidiEventType_NoteOff)
+        NoteOff(ev, out);
+
+    else
+        out.push_back(ev);
+}
+
+void VoiceManager::NoteOn(const MidiEvent& ev, MidiEventList& out) {
+
+    const int channel = ev.Channel();
+    const int velocity = ev.NoteVelocity();
+    const int key = Key(channel, ev.NoteNumber());
+    Voice& voice = m_voices[key];
+
+    // Struck again in the same batch: already on its way, keep it sounding
+    // until the last of its Note-Offs
+    if (voice.sounding_index >= 0 && voice.batch == m_batch) {
+        voice.depth++;
+        return;
+    }
+
+    // Struck again later: the synth restarts the note, but still only
+    // one Note-Off has to reach it
+    if (voice.sounding_index >= 0) {
+        voice.depth++;
+        voice.velocity = static_cast<unsigned char>(velocity);
+        voice.started = ++m_clock;
+        voice.batch = m_batch;
+        out.push_back(ev);
+        return;
+    }
+
+    int victim = -1;
+    const bool channel_full = (m_channel_voices[channel] >= m_max_channel_voices);
+    const bool all_full = (static_cast<int>(m_sounding.size()) >= m_max_voices);
+
+    if (channel_full || all_full) {
+
+        // Overloaded, quiet notes wouldn't be missed
+        if (velocity < m_velocity_floor) {
+            m_swallow[key]++;
+            return;
+        }
+
+        victim = PickVictim(channel_full ? channel : -1);
+        if (victim < 0 || m_voices[victim].velocity > velocity) {
+            m_swallow[key]++;
+            return;
+        }
+
+        out.push_back(MidiEvent::Build(MidiEventSimple(0x80 | (victim / 128), victim % 128, 0)));
+        m_swallow[victim] += m_voices[victim].depth;
+        Silence(victim);
+    }
+
+    voice.velocity = static_cast<unsigned char>(velocity);
+    voice.started = ++m_clock;
+    voice.batch = m_batch;
+    voice.depth = 1;
+    voice.sounding_index = static_cast<int>(m_sounding.size());
+    m_sounding.push_back(key);
+    m_channel_voices[channel]++;
+
+    out.push_back(ev);
+}
+
+void VoiceManager::NoteOff(const MidiEvent& ev, MidiEventList& out) {
+
+    const int key = Key(ev.Channel(), ev.NoteNumber());
+    if (m_swallow[key] > 0) {
+        m_swallow[key]--;
+        return;
+    }
+
+    Voice& voice = m_voices[key];
+    if (voice.sounding_index >= 0) {
+        voice.depth--;
+        if (voice.depth > 0)
+            return;
+
+        Silence(key);
+    }
+
+    // Unknown notes (from before a Reset()) are let through, a stray
+    // Note-Off doesn't hurt
+    out.push_back(ev);
+}
+
+int VoiceManager::PickVictim(int channel) const {
+
+    int victim = -1;
+    for (size_t i = 0; i < m_sounding.size(); ++i) {
+        const int key = m_sounding[i];
+        if (channel >= 0 && key / 128 != channel)
+            continue;
+
+        if (victim < 0) {
+            victim = key;
+            continue;
+        }
+
+        const Voice& v = m_voices[key];
+        const Voice& best = m_voices[victim];
+        if (v.velocity < best.velocity || (v.velocity == best.velocity && v.started < best.started))
+            victim = key;
+    }
+
+    return victim;
+}
+
+void VoiceManager::Silence(int key) {
+
+    Voice& voice = m_voices[key];
+    if (voice.sounding_index < 0)
+        return;
+
+    // Swap with the last one so removing doesn't move everything
+    const int last = m_sounding.back();
+    m_sounding[voice.sounding_index] = last;
+    m_voices[last].sounding_index = voice.sounding_index;
+    m_sounding.pop_back();
+
+    voice.sounding_index = -1;
+    voice.depth = 0;
+    m_channel_voices[key / 128]--;
+}
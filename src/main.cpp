@@ -16,9 +16,13 @@
 #include "CompatibleSystem.h"
 #include "LinthesiaError.h"
 #include "Renderer.h"
+#include "DrawList.h"
+#include "DrawThread.h"
 #include "SharedState.h"
 #include "GameState.h"
 #include "TitleState.h"
+#include "MidiStats.h"
+#include "VideoExport.h"
 
 #include <gconfmm.h>
 
@@ -75,11 +79,120 @@ class EdgeTracker {
 
 static EdgeTracker window_state;
 
+// The game loop timer is stopped while nothing happens on screen and
+// there is no input, and started again by the next input
+const static unsigned long IdleTimeout = 1000;
+
+static sigc::connection game_loop_timer;
+static sigc::slot<bool> game_loop_slot;
+static unsigned int game_loop_interval = 1000 / 65;
+
+static unsigned long last_activity = 0;
+static bool sleeping = false;
+static bool just_woken = false;
+
+// As of the last Update(), the manager isn't asked while recording
+static bool animating = true;
+
+static void WakeUp() {
+
+    last_activity = Compatible::GetMilliseconds();
+    if (!sleeping)
+        return;
+
+    sleeping = false;
+    just_woken = true;
+    game_loop_timer = Glib::signal_timeout().connect(game_loop_slot, game_loop_interval);
+}
+
+// Input for the state manager waits here while a frame is recorded (see
+// DrawThread), and is handed over before the next Update()
+enum InputKind {
+
+    InputKey,
+    InputMousePress,
+    InputMouseRelease,
+    InputMouseMove
+};
+
+struct PendingInput {
+
+    InputKind kind;
+    int a;
+    int b;
+};
+
+static vector<PendingInput> pending_input;
+
+static void queueInput(InputKind kind, int a, int b = 0) {
+
+    PendingInput input;
+    input.kind = kind;
+    input.a = a;
+    input.b = b;
+    pending_input.push_back(input);
+}
+
+// Once no frame is being recorded
+static void deliverInput() {
+
+    for (size_t i = 0; i < pending_input.size(); ++i) {
+        const PendingInput& input = pending_input[i];
+        switch (input.kind) {
+            case InputKey: state_manager->KeyPress(static_cast<GameKey>(input.a));
+                break;
+            case InputMousePress: state_manager->MousePress(static_cast<MouseButton>(input.a));
+                break;
+            case InputMouseRelease: state_manager->MouseRelease(static_cast<MouseButton>(input.a));
+                break;
+            case InputMouseMove: state_manager->MouseMove(input.a, input.b);
+                break;
+        }
+    }
+
+    pending_input.clear();
+}
+
+static bool OnMidiInput(Glib::IOCondition) {
+
+    // Read it right away (not on the next frame) so it is stamped with
+    // the time it really arrived
+    if (midiReadInput())
+        WakeUp();
+
+    return true;
+}
+
+// MIDI is brought up in the background, this gets us back on the main
+// thread when it is done
+static Glib::Dispatcher *midi_ready_dispatcher = 0;
+
+static void NotifyMidiReady() {
+
+    midi_ready_dispatcher->emit();
+}
+
+static void OnMidiReady() {
+
+    const string error = midiInitError();
+    if (!error.empty())
+        Compatible::ShowError(error);
+
+    // Wake up as soon as MIDI input arrives
+    vector<pollfd> midi_fds = midiPollDescriptors();
+    for (size_t i = 0; i < midi_fds.size(); ++i)
+        Glib::signal_io().connect(sigc::ptr_fun(&OnMidiInput), midi_fds[i].fd, Glib::IO_IN);
+
+    // Let the title screen pick up the devices
+    WakeUp();
+}
+
 class DrawingArea : public Gtk::GL::DrawingArea {
   public:
 
     DrawingArea(const Glib::RefPtr<const Gdk::GL::Config>& config) :
-        Gtk::GL::DrawingArea(config) {
+        Gtk::GL::DrawingArea(config),
+        m_recording(0) {
 
         set_events(Gdk::POINTER_MOTION_MASK |
             Gdk::BUTTON_PRESS_MASK |
@@ -107,16 +220,27 @@ class DrawingArea : public Gtk::GL::DrawingArea {
     virtual bool on_button_press(GdkEventButton *event);
     virtual bool on_key_press(GdkEventKey *event);
     virtual bool on_key_release(GdkEventKey *event);
+
+  private:
+
+    // Frames take turns in these, m_recording is the one the DrawThread
+    // is recording into (or has recorded, for the next GameLoop())
+    DrawList m_draw_lists[2];
+    int m_recording;
+
+    DrawThread m_draw_thread;
 };
 
 bool DrawingArea::on_motion_notify(GdkEventMotion *event) {
 
-    state_manager->MouseMove(event->x, event->y);
+    WakeUp();
+    queueInput(InputMouseMove, int(event->x), int(event->y));
     return true;
 }
 
 bool DrawingArea::on_button_press(GdkEventButton *event) {
 
+    WakeUp();
     MouseButton b;
 
     // left and right click allowed
@@ -131,76 +255,157 @@ bool DrawingArea::on_button_press(GdkEventButton *event) {
 
     // press or release?
     if (event->type == GDK_BUTTON_PRESS)
-        state_manager->MousePress(b);
+        queueInput(InputMousePress, b);
     else if (event->type == GDK_BUTTON_RELEASE)
-        state_manager->MouseRelease(b);
+        queueInput(InputMouseRelease, b);
     else
         return false;
 
     return true;
 }
 
+// PC keyboard as a piano, for the "Linthesia Keyboard" input device.
+// The bottom letter row plays the octave from C3, the top one from C4.
+struct PianoKey {
+
+    guint keyval;
+    unsigned char note;
+};
+
+const static PianoKey PianoKeys[] = {
+    { GDK_z, 48 }, { GDK_s, 49 }, { GDK_x, 50 }, { GDK_d, 51 }, { GDK_c, 52 },
+    { GDK_v, 53 }, { GDK_g, 54 }, { GDK_b, 55 }, { GDK_h, 56 }, { GDK_n, 57 },
+    { GDK_j, 58 }, { GDK_m, 59 },
+    { GDK_q, 60 }, { GDK_2, 61 }, { GDK_w, 62 }, { GDK_3, 63 }, { GDK_e, 64 },
+    { GDK_r, 65 }, { GDK_5, 66 }, { GDK_t, 67 }, { GDK_6, 68 }, { GDK_y, 69 },
+    { GDK_7, 70 }, { GDK_u, 71 }, { GDK_i, 72 }
+};
+
+// Returns -1 for keys that are not part of the piano
+static int keyToNote(guint keyval) {
+
+    keyval = gdk_keyval_to_lower(keyval);
+    for (size_t i = 0; i < sizeof(PianoKeys) / sizeof(PianoKeys[0]); ++i)
+        if (PianoKeys[i].keyval == keyval)
+            return PianoKeys[i].note;
+
+    return -1;
+}
+
+// When the key event happened, as in Compatible::GetMicroseconds().  The X
+// server stamps events in milliseconds of the same monotonic clock, but
+// only keeps the lower 32 bits of it.
+static microseconds_t keyEventMicroseconds(const GdkEventKey *event) {
+
+    const microseconds_t now = Compatible::GetMicroseconds();
+    const guint32 age = static_cast<guint32>(now / 1000) - event->time;
+
+    // Some other clock after all
+    if (age > 1000)
+        return now;
+
+    return now - static_cast<microseconds_t>(age) * 1000;
+}
+
+// Notes being held.  Key repeat sends a release and a press again, so the
+// Note-Off waits a little (the connection) to see if that happens.
 typedef map<int, sigc::connection> ConnectMap;
 ConnectMap pressed;
 
-bool __sendNoteOff(int note) {
+const static unsigned int KeyRepeatWait = 20;
+
+bool __sendNoteOff(int note, microseconds_t released) {
 
     ConnectMap::iterator it = pressed.find(note);
     if (it == pressed.end())
         return false;
 
-    sendNote(note, false);
+    sendNote(note, false, released);
     pressed.erase(it);
 
-    return true;
+    return false;
 }
 
 bool DrawingArea::on_key_press(GdkEventKey *event) {
+    WakeUp();
+
     switch (event->keyval) {
-        case GDK_Up: state_manager->KeyPress(KeyUp);
+        case GDK_Up: queueInput(InputKey, KeyUp);
+            break;
+        case GDK_Down: queueInput(InputKey, KeyDown);
             break;
-        case GDK_Down: state_manager->KeyPress(KeyDown);
+        case GDK_Left: queueInput(InputKey, KeyLeft);
             break;
-        case GDK_Left: state_manager->KeyPress(KeyLeft);
+        case GDK_Right: queueInput(InputKey, KeyRight);
             break;
-        case GDK_Right: state_manager->KeyPress(KeyRight);
+        case GDK_space: queueInput(InputKey, KeySpace);
             break;
-        case GDK_space: state_manager->KeyPress(KeySpace);
+        case GDK_Return: queueInput(InputKey, KeyEnter);
             break;
-        case GDK_Return: state_manager->KeyPress(KeyEnter);
+        case GDK_Escape: queueInput(InputKey, KeyEscape);
             break;
-        case GDK_Escape: state_manager->KeyPress(KeyEscape);
+
+            // latency calibration
+        case GDK_F2: queueInput(InputKey, KeyF2);
             break;
 
             // show FPS
-        case GDK_F6: state_manager->KeyPress(KeyF6);
+        case GDK_F6: queueInput(InputKey, KeyF6);
+            break;
+
+            // show MIDI statistics
+        case GDK_F7: queueInput(InputKey, KeyF7);
             break;
 
             // increase/decrease octave
-        case GDK_greater: state_manager->KeyPress(KeyGreater);
+        case GDK_greater: queueInput(InputKey, KeyGreater);
             break;
-        case GDK_less: state_manager->KeyPress(KeyLess);
+        case GDK_less: queueInput(InputKey, KeyLess);
             break;
 
             // +/- 5 seconds
-        case GDK_Page_Down:state_manager->KeyPress(KeyForward);
+        case GDK_Page_Down:queueInput(InputKey, KeyForward);
             break;
-        case GDK_Page_Up: state_manager->KeyPress(KeyBackward);
+        case GDK_Page_Up: queueInput(InputKey, KeyBackward);
             break;
 
-        case GDK_bracketleft: state_manager->KeyPress(KeyVolumeDown);
+        case GDK_bracketleft: queueInput(InputKey, KeyVolumeDown);
             break; // [
-        case GDK_bracketright: state_manager->KeyPress(KeyVolumeUp);
+        case GDK_bracketright: queueInput(InputKey, KeyVolumeUp);
             break; // ]
 
-        default:return false;
+        default: {
+            const int note = keyToNote(event->keyval);
+            if (note < 0)
+                return false;
+
+            // Only the first press starts the note, a repeat just keeps
+            // the Note-Off from going out
+            ConnectMap::iterator it = pressed.find(note);
+            if (it == pressed.end())
+                sendNote(note, true, keyEventMicroseconds(event));
+            else
+                it->second.disconnect();
+
+            pressed[note] = sigc::connection();
+        }
     }
 
     return true;
 }
 
 bool DrawingArea::on_key_release(GdkEventKey *event) {
-    return false;
+    WakeUp();
+
+    const int note = keyToNote(event->keyval);
+    if (note < 0 || pressed.find(note) == pressed.end())
+        return false;
+
+    pressed[note] = Glib::signal_timeout().connect(
+        sigc::bind(sigc::ptr_fun(&__sendNoteOff), note, keyEventMicroseconds(event)),
+        KeyRepeatWait);
+
+    return true;
 }
 
 void DrawingArea::on_realize() {
@@ -211,6 +416,9 @@ void DrawingArea::on_realize() {
     if (!glwindow->gl_begin(get_gl_context()))
         return;
 
+    // Frames are recorded on the DrawThread, away from the context
+    state_manager->PrepareDrawing();
+
     glwindow->gl_end();
 }
 
@@ -220,23 +428,17 @@ bool DrawingArea::on_configure_event(GdkEventConfigure *) {
     if (!glwindow->gl_begin(get_gl_context()))
         return false;
 
-    glClearColor(.25, .25, .25, 1.0);
-    glClearDepth(1.0);
-
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_TEXTURE_2D);
-
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_BLEND);
+    Renderer::SetupView(get_width(), get_height());
 
-    glShadeModel(GL_SMOOTH);
+    WakeUp();
+    const bool skip = window_state.JustActivated() || just_woken;
+    just_woken = false;
 
-    glViewport(0, 0, get_width(), get_height());
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluOrtho2D(0, get_width(), 0, get_height());
-
-    state_manager->Update(window_state.JustActivated());
+    m_draw_thread.Wait();
+    deliverInput();
+    state_manager->Update(skip);
+    animating = state_manager->IsAnimating();
+    midiDrainOutput();
 
     glwindow->gl_end();
     return true;
@@ -244,24 +446,8 @@ bool DrawingArea::on_configure_event(GdkEventConfigure *) {
 
 bool DrawingArea::on_expose_event(GdkEventExpose *) {
 
-    Glib::RefPtr<Gdk::GL::Window> glwindow = get_gl_window();
-    if (!glwindow->gl_begin(get_gl_context()))
-        return false;
-
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glCallList(1);
-
-    Renderer rend(get_gl_context(), get_pango_context());
-    rend.SetVSyncInterval(1);
-    state_manager->Draw(rend);
-
-    // swap buffers.
-    if (glwindow->is_double_buffered())
-        glwindow->swap_buffers();
-    else
-        glFlush();
-
-    glwindow->gl_end();
+    // The game loop shows a frame soon, there is none at hand here
+    WakeUp();
     return true;
 }
 
@@ -269,17 +455,85 @@ bool DrawingArea::GameLoop() {
 
     if (window_state.IsActive()) {
 
-        state_manager->Update(window_state.JustActivated());
+        Glib::RefPtr<Gdk::GL::Window> glwindow = get_gl_window();
+        if (!glwindow->gl_begin(get_gl_context()))
+            return true;
+
+        // The frame recorded during the last call
+        m_draw_thread.Wait();
+        DrawList& recorded = m_draw_lists[m_recording];
+
+        // The time spent sleeping must not count as a (very long) frame
+        const bool skip = window_state.JustActivated() || just_woken;
+        just_woken = false;
+
+        deliverInput();
+        state_manager->Update(skip);
+        animating = state_manager->IsAnimating();
+
+        // Everything the states wrote this frame goes out at once
+        midiDrainOutput();
+        midiStats().Frame(midiNow());
 
-        Renderer rend(get_gl_context(), get_pango_context());
+        // The next frame is recorded while this one is submitted and
+        // shown.  Its commands only hold copies and shared_ptrs, nothing
+        // the recording changes.
+        m_recording = 1 - m_recording;
+        Renderer rend(get_gl_context(), get_pango_context(), m_draw_lists[m_recording]);
         rend.SetVSyncInterval(1);
+        m_draw_thread.Record(state_manager, rend);
 
-        state_manager->Draw(rend);
+        recorded.Submit();
+        if (!recorded.IsEmpty()) {
+            glFlush();
+            glwindow->swap_buffers();
+        }
+
+        recorded.Clear();
+        glwindow->gl_end();
+    }
+
+    // Nothing is moving and nobody touched anything for a while, stop
+    // the timer until the next input
+    if (!animating &&
+        Compatible::GetMilliseconds() - last_activity > IdleTimeout) {
+
+        sleeping = true;
+        return false;
     }
 
     return true;
 }
 
+// linthesia --export OUTPUT [--fps N] [--size WIDTHxHEIGHT] FILE.mid
+static bool parseExportOptions(int argc, char *argv[], VideoExportOptions& options) {
+
+    if (argc < 4)
+        return false;
+
+    options.output = argv[2];
+    for (int i = 3; i < argc; ++i) {
+        const string arg = argv[i];
+
+        if (arg == "--fps" && i + 1 < argc) {
+            istringstream iss(argv[++i]);
+            if (!(iss >> options.frame_rate) || options.frame_rate == 0)
+                return false;
+        } else if (arg == "--size" && i + 1 < argc) {
+            istringstream iss(argv[++i]);
+            char x = 0;
+            if (!(iss >> options.width >> x >> options.height) || x != 'x' ||
+                options.width <= 0 || options.height <= 0)
+                return false;
+        } else if (options.midi_file.empty())
+            options.midi_file = arg;
+        else
+            return false;
+    }
+
+    return !options.midi_file.empty();
+}
+
 int main(int argc, char *argv[]) {
     Gtk::Main main_loop(argc, argv);
     Gtk::GL::init(argc, argv);
@@ -294,6 +548,20 @@ int main(int argc, char *argv[]) {
 
         UserSetting::Initialize("Linthesia");
 
+        // Render a song to video frames, no window and no MIDI devices
+        if (argc > 1 && string(argv[1]) == "--export") {
+            VideoExportOptions options;
+            if (!parseExportOptions(argc, argv, options)) {
+                cerr << "Usage: " << argv[0] << " --export OUTPUT [--fps N] [--size WIDTHxHEIGHT] FILE.mid\n"
+                     << "OUTPUT is a .y4m file, - for standard output, or a directory for PNG frames." << endl;
+                return 1;
+            }
+
+            // The default font is looked up as usual, but not saved
+            UserSetting::MakeReadOnly();
+            return exportVideo(options);
+        }
+
         if (argc > 1)
             midi_file = argv[1];
 
@@ -415,11 +683,23 @@ int main(int argc, char *argv[]) {
             }
         }
 
-        Glib::signal_timeout().connect(sigc::mem_fun(da, &DrawingArea::GameLoop), 1000 / rate);
+        game_loop_interval = 1000 / rate;
+        game_loop_slot = sigc::mem_fun(da, &DrawingArea::GameLoop);
+        last_activity = Compatible::GetMilliseconds();
+        game_loop_timer = Glib::signal_timeout().connect(game_loop_slot, game_loop_interval);
+
+        Glib::Dispatcher midi_ready;
+        midi_ready.connect(sigc::ptr_fun(&OnMidiReady));
+        midi_ready_dispatcher = &midi_ready;
+        midiInitAsync(&NotifyMidiReady);
 
         main_loop.run(window);
         window_state.Deactivate();
 
+        // Don't leave the MIDI thread behind with a dangling dispatcher
+        midiStop();
+        midi_ready_dispatcher = 0;
+
         delete dpms_thread;
         return 0;
     }
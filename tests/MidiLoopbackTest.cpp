@@ -0,0 +1,213 @@
+// -*- mode: c++; coding: utf-8 -*-
+
+// Linthesia
+
+// Copyright (c) 2007 Nicholas Piegdon
+// Adaptation to GNU/Linux by Oscar Aceña
+// See COPYING for license information
+
+// MidiComm, driven through the loopback backend with a manual clock: what
+// goes out when, what the thru routing sends on, and the arrival times the
+// scoring gets.  Runs without any MIDI hardware (see LoopbackBackend).
+
+#include <iostream>
+#include <thread>
+
+#include "MidiComm.h"
+#include "LoopbackBackend.h"
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, const char *file, int line) {
+
+    if (ok)
+        return;
+
+    cout << file << ":" << line << ": check failed: " << what << endl;
+    failures++;
+}
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static MidiEvent noteOn(int channel, int note, int velocity) {
+
+    return MidiEvent::Build(MidiEventSimple(0x90 | channel, note, velocity));
+}
+
+static MidiEvent noteOff(int channel, int note) {
+
+    return MidiEvent::Build(MidiEventSimple(0x80 | channel, note, 0));
+}
+
+static bool isNote(const LoopbackOutputEvent& out, MidiEventType type, int channel, NoteId note,
+                   microseconds_t due) {
+
+    return out.event.Type() == type && out.event.Channel() == channel &&
+        out.event.NoteNumber() == note && out.due == due;
+}
+
+// Scheduled events keep their timestamps (the frame rate doesn't matter),
+// and Flush() takes back what isn't due yet except the Note-Offs
+static void testPlaybackTiming(LoopbackBackend *loopback, MidiCommOut& out) {
+
+    loopback->ClearOutput();
+    loopback->SetNow(1000000);
+
+    out.StartBatch();
+    out.Schedule(noteOn(0, 60, 90), 0);
+    out.Schedule(noteOn(0, 64, 90), 250000);
+    out.Schedule(noteOff(0, 60), 500000);
+
+    // Buffered until the frame is over
+    CHECK(loopback->Output().empty());
+
+    midiDrainOutput();
+    const LoopbackOutputEventList& sent = loopback->Output();
+    CHECK(sent.size() == 3);
+    if (sent.size() == 3) {
+        CHECK(isNote(sent[0], MidiEventType_NoteOn, 0, 60, 1000000));
+        CHECK(isNote(sent[1], MidiEventType_NoteOn, 0, 64, 1250000));
+        CHECK(isNote(sent[2], MidiEventType_NoteOff, 0, 60, 1500000));
+    }
+
+    // A seek in between
+    loopback->SetNow(1100000);
+    out.Flush();
+
+    const LoopbackOutputEventList& kept = loopback->Output();
+    CHECK(kept.size() == 2);
+    if (kept.size() == 2) {
+        CHECK(isNote(kept[0], MidiEventType_NoteOn, 0, 60, 1000000));
+        CHECK(isNote(kept[1], MidiEventType_NoteOff, 0, 60, 1500000));
+    }
+
+    // Written events go out at the time of writing
+    loopback->ClearOutput();
+    loopback->SetNow(1200000);
+    out.Write(noteOn(2, 48, 70));
+    midiDrainOutput();
+
+    CHECK(loopback->Output().size() == 1);
+    if (loopback->Output().size() == 1)
+        CHECK(isNote(loopback->Output()[0], MidiEventType_NoteOn, 2, 48, 1200000));
+}
+
+// Routed keys go out as soon as they are read, not on the next frame, and
+// the input keeps the time it arrived at
+static void testThruAndArrival(LoopbackBackend *loopback, MidiCommIn& in, MidiCommOut& out) {
+
+    MidiThruRoute routes[128];
+    for (int i = 0; i < 128; ++i)
+        routes[i].enabled = false;
+
+    routes[60].enabled = true;
+    routes[60].channel = 1;
+    routes[60].note = 72;
+    routes[60].velocity = 100;
+
+    midiSetThru(&out);
+    midiSetThruRoutes(routes);
+    loopback->ClearOutput();
+    in.Reset();
+
+    loopback->Inject(MidiEventSimple(0x90, 60, 80), 2000000);
+    loopback->Inject(MidiEventSimple(0x90, 61, 80), 2000000);
+    loopback->Inject(MidiEventSimple(0x80, 60, 0), 2100000);
+
+    loopback->SetNow(2000000);
+    CHECK(midiReadInput());
+
+    // Without midiDrainOutput()
+    CHECK(loopback->Output().size() == 1);
+    if (loopback->Output().size() == 1)
+        CHECK(isNote(loopback->Output()[0], MidiEventType_NoteOn, 1, 72, 2000000));
+
+    microseconds_t arrival = 0;
+    CHECK(in.KeepReading());
+    MidiEvent ev = in.Read(&arrival);
+    CHECK(ev.Type() == MidiEventType_NoteOn && ev.NoteNumber() == 60 && arrival == 2000000);
+
+    // Not routed, but read all the same
+    ev = in.Read(&arrival);
+    CHECK(ev.Type() == MidiEventType_NoteOn && ev.NoteNumber() == 61 && arrival == 2000000);
+
+    // The release isn't due yet
+    CHECK(!in.KeepReading());
+
+    // Read late: the thru Note-Off goes out now, the scoring still sees
+    // when the key was released
+    loopback->SetNow(2300000);
+    CHECK(midiReadInput());
+
+    CHECK(loopback->Output().size() == 2);
+    if (loopback->Output().size() == 2)
+        CHECK(isNote(loopback->Output()[1], MidiEventType_NoteOff, 1, 72, 2300000));
+
+    ev = in.Read(&arrival);
+    CHECK(ev.Type() == MidiEventType_NoteOff && ev.NoteNumber() == 60 && arrival == 2100000);
+    CHECK(!in.KeepReading());
+
+    midiSetThru(0);
+}
+
+// A burst is read in one go, in order and without losing anything
+static void testInputBurst(LoopbackBackend *loopback, MidiCommIn& in) {
+
+    const static int BurstSize = 500;
+
+    in.Reset();
+    for (int i = 0; i < BurstSize; ++i)
+        loopback->Inject(MidiEventSimple(0x90, i % 128, 1 + i % 127), 3000000 + i);
+
+    loopback->SetNow(3000000 + BurstSize);
+    CHECK(midiReadInput());
+
+    int count = 0;
+    bool in_order = true;
+    while (in.KeepReading()) {
+        microseconds_t arrival = 0;
+        const MidiEvent ev = in.Read(&arrival);
+        in_order = (in_order && static_cast<int>(ev.NoteNumber()) == count % 128 &&
+                    arrival == 3000000 + count);
+        count++;
+    }
+
+    CHECK(count == BurstSize);
+    CHECK(in_order);
+}
+
+int main() {
+
+    LoopbackBackend *loopback = new LoopbackBackend();
+    midiUseBackend(loopback);
+
+    midiInitAsync(0);
+    while (!midiReady())
+        this_thread::yield();
+
+    CHECK(midiInitError().empty());
+    CHECK(MidiCommIn::GetDeviceList().size() == 2);
+    CHECK(MidiCommOut::GetDeviceList().size() == 1);
+
+    {
+        MidiCommIn in(0);
+        MidiCommOut out(0);
+
+        testPlaybackTiming(loopback, out);
+        testThruAndArrival(loopback, in, out);
+        testInputBurst(loopback, in);
+    }
+
+    // Deletes the loopback
+    midiStop();
+
+    if (failures) {
+        cout << failures << " check(s) failed" << endl;
+        return 1;
+    }
+
+    cout << "All checks passed" << endl;
+    return 0;
+}